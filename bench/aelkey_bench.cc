@@ -0,0 +1,756 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// aelkey-bench: end-to-end throughput and latency of a reference script.
+//
+// A virtual source device (uinput for evdev scenarios, uhid for hidraw
+// scenarios, a mock bluetoothd on a private bus for GATT scenarios)
+// stands in for the hardware. The script runs in a child Lua
+// interpreter; a driver thread writes one input frame per period, and
+// the output device created by the script is read back. Every input
+// frame produces exactly one output frame, so the n-th output frame is
+// matched to the n-th input. Results are printed as one JSON object.
+//
+//   aelkey-bench --scenario keyboard_remap --script keyboard_remap.lua --rate 1000
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <libevdev/libevdev-uinput.h>
+#include <libevdev/libevdev.h>
+
+#include "mock_bluez.h"
+#include "util/latency_histogram.h"
+
+namespace {
+
+constexpr const char *OUTPUT_NAME = "aelkey-bench output";
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void sleep_until_ns(uint64_t ns) {
+  struct timespec ts;
+  ts.tv_sec = static_cast<time_t>(ns / 1000000000ULL);
+  ts.tv_nsec = static_cast<long>(ns % 1000000000ULL);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+  }
+}
+
+void sleep_ms(int ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+struct Options {
+  std::string scenario;
+  std::string script;
+  std::string lua = "lua";
+  std::string json;   // also write the result here
+  std::string start;  // extra aelkey.start{} fields, as a Lua table constructor
+  double rate = 1000;
+  double duration = 5;
+  unsigned window = 64;  // frames in flight with --rate 0
+  bool verbose = false;
+};
+
+// ---------------------------------------------------------------------------
+// Source devices
+
+class Source {
+ public:
+  virtual ~Source() = default;
+
+  virtual bool create() = 0;
+
+  // Write one input frame; the script turns it into one output frame
+  virtual bool send() = 0;
+
+  // Service the device between frames
+  virtual void poll() {}
+};
+
+class UinputSource : public Source {
+ public:
+  ~UinputSource() override {
+    if (uinput_) {
+      libevdev_uinput_destroy(uinput_);
+    }
+    if (dev_) {
+      libevdev_free(dev_);
+    }
+  }
+
+  bool create() override {
+    dev_ = libevdev_new();
+    setup(dev_);
+
+    int err = libevdev_uinput_create_from_device(dev_, LIBEVDEV_UINPUT_OPEN_MANAGED, &uinput_);
+    if (err < 0) {
+      std::fprintf(stderr, "aelkey-bench: uinput: %s\n", std::strerror(-err));
+      return false;
+    }
+    return true;
+  }
+
+ protected:
+  virtual void setup(struct libevdev *dev) = 0;
+
+  bool write(unsigned type, unsigned code, int value) {
+    return libevdev_uinput_write_event(uinput_, type, code, value) == 0;
+  }
+
+  struct libevdev *dev_ = nullptr;
+  struct libevdev_uinput *uinput_ = nullptr;
+};
+
+// Alternating press and release of one key
+class KeyboardSource : public UinputSource {
+ protected:
+  void setup(struct libevdev *dev) override {
+    libevdev_set_name(dev, "aelkey-bench keyboard");
+    libevdev_set_id_bustype(dev, BUS_VIRTUAL);
+    libevdev_enable_event_type(dev, EV_KEY);
+    libevdev_enable_event_code(dev, EV_KEY, KEY_F23, nullptr);
+  }
+
+ public:
+  bool send() override {
+    pressed_ = !pressed_;
+    return write(EV_KEY, KEY_F23, pressed_ ? 1 : 0) && write(EV_SYN, SYN_REPORT, 0);
+  }
+
+ private:
+  bool pressed_ = false;
+};
+
+// One finger held down, moving back and forth on the x axis
+class TouchpadSource : public UinputSource {
+ protected:
+  void setup(struct libevdev *dev) override {
+    libevdev_set_name(dev, "aelkey-bench touchpad");
+    libevdev_set_id_bustype(dev, BUS_VIRTUAL);
+    libevdev_enable_property(dev, INPUT_PROP_POINTER);
+
+    libevdev_enable_event_type(dev, EV_KEY);
+    libevdev_enable_event_code(dev, EV_KEY, BTN_TOUCH, nullptr);
+    libevdev_enable_event_code(dev, EV_KEY, BTN_TOOL_FINGER, nullptr);
+
+    struct input_absinfo abs{};
+    abs.maximum = 4095;
+    abs.resolution = 40;
+    libevdev_enable_event_type(dev, EV_ABS);
+    libevdev_enable_event_code(dev, EV_ABS, ABS_X, &abs);
+    libevdev_enable_event_code(dev, EV_ABS, ABS_Y, &abs);
+    libevdev_enable_event_code(dev, EV_ABS, ABS_MT_POSITION_X, &abs);
+    libevdev_enable_event_code(dev, EV_ABS, ABS_MT_POSITION_Y, &abs);
+
+    struct input_absinfo slot{};
+    slot.maximum = 4;
+    libevdev_enable_event_code(dev, EV_ABS, ABS_MT_SLOT, &slot);
+
+    struct input_absinfo tracking{};
+    tracking.maximum = 65535;
+    libevdev_enable_event_code(dev, EV_ABS, ABS_MT_TRACKING_ID, &tracking);
+  }
+
+ public:
+  bool send() override {
+    // the kernel drops unchanged values, so x always moves
+    x_ = x_ == 2000 ? 2010 : 2000;
+
+    bool ok = true;
+    if (!touching_) {
+      ok = write(EV_ABS, ABS_MT_SLOT, 0) && write(EV_ABS, ABS_MT_TRACKING_ID, 1) &&
+           write(EV_ABS, ABS_MT_POSITION_Y, 2000) && write(EV_ABS, ABS_Y, 2000) &&
+           write(EV_KEY, BTN_TOUCH, 1) && write(EV_KEY, BTN_TOOL_FINGER, 1);
+      touching_ = true;
+    }
+    return ok && write(EV_ABS, ABS_MT_POSITION_X, x_) && write(EV_ABS, ABS_X, x_) &&
+           write(EV_SYN, SYN_REPORT, 0);
+  }
+
+ private:
+  bool touching_ = false;
+  int x_ = 2000;
+};
+
+// Vendor-defined report of `size` bytes, so no input driver binds and
+// only hidraw sees the device
+class UhidSource : public Source {
+ public:
+  UhidSource(const char *name, size_t size) : name_(name), size_(size) {}
+
+  ~UhidSource() override {
+    if (fd_ >= 0) {
+      struct uhid_event ev{};
+      ev.type = UHID_DESTROY;
+      (void)::write(fd_, &ev, sizeof(ev));
+      close(fd_);
+    }
+  }
+
+  bool create() override {
+    fd_ = open("/dev/uhid", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+      std::fprintf(stderr, "aelkey-bench: /dev/uhid: %s\n", std::strerror(errno));
+      return false;
+    }
+
+    // clang-format off
+    const uint8_t descriptor[] = {
+      0x06, 0x00, 0xff,              // Usage Page (Vendor 0xff00)
+      0x09, 0x01,                    // Usage (1)
+      0xa1, 0x01,                    // Collection (Application)
+      0x09, 0x02,                    //   Usage (2)
+      0x15, 0x00,                    //   Logical Minimum (0)
+      0x26, 0xff, 0x00,              //   Logical Maximum (255)
+      0x75, 0x08,                    //   Report Size (8)
+      0x95, static_cast<uint8_t>(size_),  //   Report Count (size)
+      0x81, 0x02,                    //   Input (Data, Var, Abs)
+      0xc0,                          // End Collection
+    };
+    // clang-format on
+
+    struct uhid_event ev{};
+    ev.type = UHID_CREATE2;
+    std::snprintf(
+        reinterpret_cast<char *>(ev.u.create2.name), sizeof(ev.u.create2.name), "%s", name_
+    );
+    ev.u.create2.rd_size = sizeof(descriptor);
+    ev.u.create2.bus = BUS_VIRTUAL;
+    ev.u.create2.vendor = 0x1d6b;
+    ev.u.create2.product = 0xae1b;
+    std::memcpy(ev.u.create2.rd_data, descriptor, sizeof(descriptor));
+
+    if (::write(fd_, &ev, sizeof(ev)) < 0) {
+      std::fprintf(stderr, "aelkey-bench: uhid create: %s\n", std::strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  bool send() override {
+    struct uhid_event ev{};
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = static_cast<uint16_t>(size_);
+    fill(ev.u.input2.data);
+    return ::write(fd_, &ev, sizeof(ev)) >= 0;
+  }
+
+  void poll() override {
+    // start/open/close notifications; nothing to answer
+    struct uhid_event ev;
+    while (::read(fd_, &ev, sizeof(ev)) > 0) {
+    }
+  }
+
+ protected:
+  virtual void fill(uint8_t *report) = 0;
+
+  bool flip_ = false;
+
+ private:
+  const char *name_;
+  size_t size_;
+  int fd_ = -1;
+};
+
+// buttons, dx, dy, wheel
+class MouseSource : public UhidSource {
+ public:
+  MouseSource() : UhidSource("aelkey-bench mouse", 4) {}
+
+ protected:
+  void fill(uint8_t *report) override {
+    flip_ = !flip_;
+    report[0] = 0;
+    report[1] = static_cast<uint8_t>(flip_ ? 5 : -5);
+    report[2] = static_cast<uint8_t>(flip_ ? -3 : 3);
+    report[3] = 0;
+  }
+};
+
+// gyro x, y, z as little-endian int16
+class GyroSource : public UhidSource {
+ public:
+  GyroSource() : UhidSource("aelkey-bench gyro", 6) {}
+
+ protected:
+  void fill(uint8_t *report) override {
+    flip_ = !flip_;
+    int16_t axes[3] = { 0, 0, static_cast<int16_t>(flip_ ? 1000 : -1000) };
+    for (int i = 0; i < 3; ++i) {
+      report[2 * i] = static_cast<uint8_t>(axes[i] & 0xff);
+      report[2 * i + 1] = static_cast<uint8_t>((axes[i] >> 8) & 0xff);
+    }
+  }
+};
+
+// Notifications from the mock BlueZ (see mock_bluez.h): sequence number
+// and a flipping direction. The script's process finds the private bus
+// through DBUS_SYSTEM_BUS_ADDRESS; with signals, AcquireNotify is refused
+// and every notification is a PropertiesChanged signal.
+class GattSource : public Source {
+ public:
+  explicit GattSource(bool signals) : bluez_(MockBluezOptions{ .acquire_notify = !signals }) {}
+
+  bool create() override {
+    if (!bus_.start() || !bluez_.start(bus_.address())) {
+      return false;
+    }
+    setenv("DBUS_SYSTEM_BUS_ADDRESS", bus_.address().c_str(), 1);
+    return true;
+  }
+
+  bool send() override {
+    flip_ = !flip_;
+    uint8_t value[3] = {
+      static_cast<uint8_t>(seq_ & 0xff),
+      static_cast<uint8_t>((seq_ >> 8) & 0xff),
+      static_cast<uint8_t>(flip_ ? 1 : 0),
+    };
+    ++seq_;
+    return bluez_.notify(value, sizeof(value));
+  }
+
+ private:
+  PrivateBus bus_;  // outlives bluez_
+  MockBluez bluez_;
+  uint16_t seq_ = 0;
+  bool flip_ = false;
+};
+
+std::unique_ptr<Source> make_source(const std::string &scenario) {
+  if (scenario == "keyboard_remap") {
+    return std::make_unique<KeyboardSource>();
+  }
+  if (scenario == "touchpad_mt") {
+    return std::make_unique<TouchpadSource>();
+  }
+  if (scenario == "mouse_hidraw") {
+    return std::make_unique<MouseSource>();
+  }
+  if (scenario == "gyro_mouse") {
+    return std::make_unique<GyroSource>();
+  }
+  if (scenario == "gatt_notify") {
+    return std::make_unique<GattSource>(false);
+  }
+  if (scenario == "gatt_notify_signal") {
+    return std::make_unique<GattSource>(true);
+  }
+  return nullptr;
+}
+
+// ---------------------------------------------------------------------------
+// aelkey process and output device
+
+pid_t spawn_script(const Options &opts) {
+  pid_t pid = fork();
+  if (pid != 0) {
+    if (pid < 0) {
+      perror("aelkey-bench: fork");
+    }
+    return pid;
+  }
+
+  if (!opts.verbose) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+      dup2(null, STDOUT_FILENO);
+      close(null);
+    }
+  }
+  if (geteuid() == 0) {
+    setenv("AELKEY_ALLOW_ROOT", "1", 0);
+  }
+  if (!opts.start.empty()) {
+    setenv("AELKEY_BENCH_START", opts.start.c_str(), 1);
+  }
+
+  execlp(opts.lua.c_str(), opts.lua.c_str(), opts.script.c_str(), static_cast<char *>(nullptr));
+  std::fprintf(stderr, "aelkey-bench: %s: %s\n", opts.lua.c_str(), std::strerror(errno));
+  _exit(127);
+}
+
+// Wait for the device created by the script to appear
+int open_output(pid_t child, int timeout_ms) {
+  uint64_t deadline = now_ns() + static_cast<uint64_t>(timeout_ms) * 1000000ULL;
+
+  while (now_ns() < deadline) {
+    if (waitpid(child, nullptr, WNOHANG) == child) {
+      std::fprintf(stderr, "aelkey-bench: script exited before creating its output\n");
+      return -1;
+    }
+
+    if (DIR *dir = opendir("/dev/input")) {
+      while (struct dirent *ent = readdir(dir)) {
+        if (std::strncmp(ent->d_name, "event", 5) != 0) {
+          continue;
+        }
+        std::string path = std::string("/dev/input/") + ent->d_name;
+        int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+          continue;
+        }
+        char name[256] = {};
+        if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) >= 0 &&
+            std::strcmp(name, OUTPUT_NAME) == 0) {
+          closedir(dir);
+          return fd;
+        }
+        close(fd);
+      }
+      closedir(dir);
+    }
+    sleep_ms(20);
+  }
+
+  std::fprintf(stderr, "aelkey-bench: no \"%s\" device after %d ms\n", OUTPUT_NAME, timeout_ms);
+  return -1;
+}
+
+// Assembles output frames; a frame counts if it carries a key press or
+// release or a relative motion (autorepeat frames are not ours)
+class OutputReader {
+ public:
+  explicit OutputReader(int fd) : fd_(fd) {}
+
+  // Returns the number of completed frames; times[i] is each frame's
+  // kernel timestamp
+  size_t read(std::vector<uint64_t> &times) {
+    size_t frames = 0;
+    struct input_event evs[64];
+
+    for (;;) {
+      ssize_t n = ::read(fd_, evs, sizeof(evs));
+      if (n <= 0) {
+        break;
+      }
+      for (size_t i = 0; i < static_cast<size_t>(n) / sizeof(evs[0]); ++i) {
+        const auto &ev = evs[i];
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+          if (counted_) {
+            times.push_back(
+                static_cast<uint64_t>(ev.input_event_sec) * 1000000000ULL +
+                static_cast<uint64_t>(ev.input_event_usec) * 1000ULL
+            );
+            ++frames;
+          }
+          counted_ = false;
+        } else if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+          ++dropped_;
+        } else if ((ev.type == EV_KEY && ev.value != 2) || ev.type == EV_REL) {
+          counted_ = true;
+        }
+      }
+    }
+    return frames;
+  }
+
+  uint64_t dropped() const {
+    return dropped_;
+  }
+
+ private:
+  int fd_;
+  bool counted_ = false;
+  uint64_t dropped_ = 0;
+};
+
+// ---------------------------------------------------------------------------
+// Run
+
+struct Result {
+  uint64_t sent = 0;
+  uint64_t received = 0;
+  uint64_t syn_dropped = 0;
+  double elapsed_s = 0;
+  LatencyHistogram latency;
+};
+
+// Send single frames until the script answers, so the measurement does
+// not start while the input is still being attached
+bool wait_ready(Source &source, int out_fd, OutputReader &reader, int timeout_ms) {
+  uint64_t deadline = now_ns() + static_cast<uint64_t>(timeout_ms) * 1000000ULL;
+  std::vector<uint64_t> times;
+
+  while (now_ns() < deadline) {
+    source.send();
+    struct pollfd pfd{ out_fd, POLLIN, 0 };
+    if (::poll(&pfd, 1, 50) > 0 && reader.read(times) > 0) {
+      // let stragglers arrive, then discard them
+      sleep_ms(100);
+      source.poll();
+      reader.read(times);
+      return true;
+    }
+    source.poll();
+  }
+  return false;
+}
+
+Result run(const Options &opts, Source &source, int out_fd, OutputReader &reader) {
+  Result result;
+
+  // send times, indexed by frame; flooding is bounded by a generous rate
+  double rate = opts.rate > 0 ? opts.rate * 1.1 : 2e6;
+  size_t capacity = static_cast<size_t>(rate * opts.duration) + 1024;
+  std::unique_ptr<std::atomic<uint64_t>[]> send_ns(new std::atomic<uint64_t>[capacity]);
+
+  std::atomic<uint64_t> sent{ 0 };
+  std::atomic<uint64_t> received{ 0 };
+  std::atomic<bool> driving{ true };
+
+  uint64_t start = now_ns();
+  uint64_t end = start + static_cast<uint64_t>(opts.duration * 1e9);
+
+  // Driver: paced at --rate, or as fast as the window allows
+  std::thread driver([&] {
+    uint64_t period = opts.rate > 0 ? static_cast<uint64_t>(1e9 / opts.rate) : 0;
+    uint64_t next = now_ns();
+
+    for (uint64_t seq = 0; seq < capacity; ++seq) {
+      if (period) {
+        sleep_until_ns(next);
+        next += period;
+      } else {
+        while (seq - received.load(std::memory_order_acquire) >= opts.window &&
+               now_ns() < end) {
+          std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+      }
+
+      uint64_t t = now_ns();
+      if (t >= end) {
+        break;
+      }
+
+      send_ns[seq].store(t, std::memory_order_relaxed);
+      sent.store(seq + 1, std::memory_order_release);
+      if (!source.send()) {
+        perror("aelkey-bench: send");
+        break;
+      }
+
+      if ((seq & 63) == 0) {
+        source.poll();
+      }
+    }
+    driving.store(false, std::memory_order_release);
+  });
+
+  // Reader: this thread; a grace period after the driver stops collects
+  // the frames still in flight
+  std::vector<uint64_t> times;
+  times.reserve(1024);
+  uint64_t grace_end = 0;
+
+  for (;;) {
+    struct pollfd pfd{ out_fd, POLLIN, 0 };
+    ::poll(&pfd, 1, 10);
+
+    times.clear();
+    reader.read(times);
+
+    uint64_t n = received.load(std::memory_order_relaxed);
+    uint64_t limit = sent.load(std::memory_order_acquire);
+    for (uint64_t t : times) {
+      if (n >= limit) {
+        break;  // more outputs than inputs: the script is not 1:1
+      }
+      uint64_t s = send_ns[n].load(std::memory_order_relaxed);
+      result.latency.record(t > s ? t - s : 0);
+      ++n;
+    }
+    received.store(n, std::memory_order_release);
+
+    if (!driving.load(std::memory_order_acquire)) {
+      if (!grace_end) {
+        grace_end = now_ns() + 500000000ULL;
+      }
+      if (n >= sent.load(std::memory_order_acquire) || now_ns() >= grace_end) {
+        break;
+      }
+    }
+  }
+
+  driver.join();
+
+  result.sent = sent.load();
+  result.received = received.load();
+  result.syn_dropped = reader.dropped();
+  result.elapsed_s = static_cast<double>(std::min(now_ns(), end) - start) / 1e9;
+  return result;
+}
+
+std::string to_json(const Options &opts, const Result &r) {
+  auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+  const auto &h = r.latency;
+
+  char buf[1024];
+  std::snprintf(
+      buf,
+      sizeof(buf),
+      "{\"scenario\":\"%s\",\"version\":\"%s\",\"rate_hz\":%.0f,\"duration_s\":%.3f,"
+      "\"sent\":%llu,\"received\":%llu,\"lost\":%llu,\"syn_dropped\":%llu,"
+      "\"throughput_hz\":%.1f,\"latency_us\":{\"count\":%llu,\"min\":%.1f,\"mean\":%.1f,"
+      "\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}",
+      opts.scenario.c_str(),
+      AELKEY_VERSION,
+      opts.rate,
+      r.elapsed_s,
+      static_cast<unsigned long long>(r.sent),
+      static_cast<unsigned long long>(r.received),
+      static_cast<unsigned long long>(r.sent - r.received),
+      static_cast<unsigned long long>(r.syn_dropped),
+      r.elapsed_s > 0 ? static_cast<double>(r.received) / r.elapsed_s : 0.0,
+      static_cast<unsigned long long>(h.count()),
+      us(h.min()),
+      h.mean() / 1000.0,
+      us(h.percentile(50)),
+      us(h.percentile(90)),
+      us(h.percentile(99)),
+      us(h.percentile(99.9)),
+      us(h.max())
+  );
+  return buf;
+}
+
+void usage() {
+  std::fprintf(
+      stderr,
+      "usage: aelkey-bench --scenario <name> --script <file.lua> [options]\n"
+      "\n"
+      "scenarios: keyboard_remap touchpad_mt mouse_hidraw gyro_mouse\n"
+      "           gatt_notify gatt_notify_signal\n"
+      "\n"
+      "  --lua <program>     Lua interpreter (default lua)\n"
+      "  --rate <hz>         input frames per second; 0 floods (default 1000)\n"
+      "  --duration <s>      measured time (default 5)\n"
+      "  --window <n>        frames in flight with --rate 0 (default 64)\n"
+      "  --start <table>     extra aelkey.start{} fields, e.g. '{ io_uring = true }'\n"
+      "  --json <path>       also write the result to this file\n"
+      "  --verbose           keep the script's stdout\n"
+  );
+}
+
+bool parse_args(int argc, char **argv, Options &opts) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char * { return i + 1 < argc ? argv[++i] : nullptr; };
+
+    if (arg == "--verbose") {
+      opts.verbose = true;
+      continue;
+    }
+
+    const char *v = value();
+    if (!v) {
+      return false;
+    }
+    if (arg == "--scenario") {
+      opts.scenario = v;
+    } else if (arg == "--script") {
+      opts.script = v;
+    } else if (arg == "--lua") {
+      opts.lua = v;
+    } else if (arg == "--rate") {
+      opts.rate = std::atof(v);
+    } else if (arg == "--duration") {
+      opts.duration = std::atof(v);
+    } else if (arg == "--window") {
+      opts.window = static_cast<unsigned>(std::max(1, std::atoi(v)));
+    } else if (arg == "--start") {
+      opts.start = v;
+    } else if (arg == "--json") {
+      opts.json = v;
+    } else {
+      return false;
+    }
+  }
+  return !opts.scenario.empty() && !opts.script.empty() && opts.rate >= 0 && opts.duration > 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!parse_args(argc, argv, opts)) {
+    usage();
+    return 2;
+  }
+
+  auto source = make_source(opts.scenario);
+  if (!source) {
+    std::fprintf(stderr, "aelkey-bench: unknown scenario '%s'\n", opts.scenario.c_str());
+    return 2;
+  }
+  if (!source->create()) {
+    return 1;
+  }
+  sleep_ms(200);  // udev applies permissions
+  source->poll();
+
+  pid_t child = spawn_script(opts);
+  if (child < 0) {
+    return 1;
+  }
+
+  int status = 1;
+  int out_fd = open_output(child, 10000);
+  if (out_fd >= 0) {
+    // compare against our CLOCK_MONOTONIC send times
+    int clk = CLOCK_MONOTONIC;
+    if (ioctl(out_fd, EVIOCSCLOCKID, &clk) < 0) {
+      perror("aelkey-bench: EVIOCSCLOCKID");
+    }
+
+    OutputReader reader(out_fd);
+    if (!wait_ready(*source, out_fd, reader, 5000)) {
+      std::fprintf(stderr, "aelkey-bench: the script did not answer the source device\n");
+    } else {
+      Result result = run(opts, *source, out_fd, reader);
+      std::string json = to_json(opts, result);
+      std::printf("%s\n", json.c_str());
+
+      if (!opts.json.empty()) {
+        if (FILE *f = std::fopen(opts.json.c_str(), "w")) {
+          std::fprintf(f, "%s\n", json.c_str());
+          std::fclose(f);
+        } else {
+          std::fprintf(stderr, "aelkey-bench: %s: %s\n", opts.json.c_str(), strerror(errno));
+        }
+      }
+      status = result.received > 0 ? 0 : 1;
+    }
+    close(out_fd);
+  }
+
+  kill(child, SIGTERM);
+  waitpid(child, nullptr, 0);
+  return status;
+}
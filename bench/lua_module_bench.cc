@@ -0,0 +1,338 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// aelkey-lua-bench: cost of the embedded Lua modules, without devices.
+//
+// The modules are loaded from the same generated sources as the aelkey
+// library, into a plain Lua state whose aelkey.emit, syn_report, and
+// tick only count calls. Each case feeds a synthetic input stream to one
+// module; an "event" is one delivery, as a callback would make it (one
+// evdev frame, one HID report, one touch frame, one filter sample).
+// Allocations are counted by the state's allocator, with the collector
+// running normally.
+//
+//   aelkey-lua-bench [--iterations <n>] [--case <name>]... [--json]
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <sol/sol.hpp>
+
+#include "lua_scripts.h"
+
+namespace {
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+struct Counters {
+  uint64_t allocs = 0;  // new blocks and blocks that grew
+  uint64_t bytes = 0;
+  uint64_t emits = 0;
+};
+
+void *counting_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  if (nsize == 0) {
+    std::free(ptr);
+    return nullptr;
+  }
+
+  auto *c = static_cast<Counters *>(ud);
+  if (!ptr || nsize > osize) {
+    ++c->allocs;
+    c->bytes += nsize;
+  }
+  return std::realloc(ptr, nsize);
+}
+
+// Loaded in dependency order; log first, edge before touchpad
+struct ScriptModule {
+  const char *name;
+  const char *script;
+};
+
+constexpr ScriptModule script_modules[] = {
+  { "log", aelkey_log_script },
+  { "edge", aelkey_edge_script },
+  { "filter", aelkey_filter_script },
+  { "keyboard", aelkey_keyboard_script },
+  { "touchpad", aelkey_touchpad_script },
+  { "sequence", aelkey_sequence_script },
+};
+
+// Each case is a chunk that sets up its module and returns step(i),
+// called once per event
+struct Case {
+  const char *name;
+  const char *chunk;
+};
+
+constexpr Case cases[] = {
+  { "keyboard", R"LUA(
+    local kb = aelkey.keyboard.new{
+      normal_map = { KEY_A = "KEY_B", KEY_S = { "KEY_LEFTCTRL", "KEY_C" } },
+      modifier_map = { KEY_CAPSLOCK = "KEY_LEFTCTRL" },
+    }
+
+    -- evdev frames as delivered: scan code, key, report
+    local keys = { "KEY_A", "KEY_S", "KEY_D", "KEY_CAPSLOCK" }
+    local frames = {}
+    for _, key in ipairs(keys) do
+      for value = 1, 0, -1 do
+        frames[#frames + 1] = {
+          { device = "kbd", type = "EV_MSC", code = "MSC_SCAN", value = 458756 },
+          { device = "kbd", type = "EV_KEY", code = key, value = value },
+          { device = "kbd", type = "EV_SYN", code = "SYN_REPORT", value = 0 },
+        }
+      end
+    end
+
+    return function(i)
+      kb.begin_frame()
+      kb.feed_events(frames[i % #frames + 1])
+      kb.end_frame()
+      kb.emit_events("out")
+      aelkey.syn_report("out")
+    end
+  )LUA" },
+
+  { "keyboard_hid", R"LUA(
+    local kb = aelkey.keyboard.new{ normal_map = { KEY_A = "KEY_B" } }
+
+    -- boot reports: a, a+b, shift+b, nothing
+    local reports = {
+      { 0, 0, 4, 0, 0, 0, 0, 0 },
+      { 0, 0, 4, 5, 0, 0, 0, 0 },
+      { 2, 0, 5, 0, 0, 0, 0, 0 },
+      { 0, 0, 0, 0, 0, 0, 0, 0 },
+    }
+
+    return function(i)
+      kb.begin_frame()
+      kb.feed_events(kb.parse_report(reports[i % #reports + 1]))
+      kb.end_frame()
+      kb.emit_events("out")
+      aelkey.syn_report("out")
+    end
+  )LUA" },
+
+  { "touchpad", R"LUA(
+    local tp = aelkey.touchpad.new{ mode = "multitouch", max_slots = 5 }
+
+    -- two fingers moving, lifted every 64 frames
+    return function(i)
+      local t = i % 64
+      tp.begin_frame()
+      if t < 60 then
+        tp.feed_contact{ slot = 0, x = 1000 + t * 7, y = 2000 + t * 3, pressure = 40 }
+        tp.feed_contact{ slot = 1, x = 3000 - t * 5, y = 2500, pressure = 35,
+                         button_left = t > 30 and t < 40 }
+      end
+      tp.end_frame()
+      tp.emit_events("out")
+      aelkey.syn_report("out")
+    end
+  )LUA" },
+
+  { "filter", R"LUA(
+    local f = aelkey.filter
+    f.highpass_configure{ id = "gyro", lp_fn = f.lowpass_ema, lp_param = 0.05 }
+
+    -- one IMU sample: smoothed x, y and a high-passed z
+    return function(i)
+      local s = math.sin(i * 0.01)
+      local x = f.lowpass_ema("x", s * 900, 0.3)
+      local y = f.lowpass_ema2("y", s * 400, 0.3)
+      local z = f.highpass("gyro", s * 1200 + 30)
+      aelkey.emit{ device = "out", type = "EV_REL", code = "REL_X", value = math.floor(x + z) }
+      aelkey.emit{ device = "out", type = "EV_REL", code = "REL_Y", value = math.floor(y) }
+      aelkey.syn_report("out")
+    end
+  )LUA" },
+
+  { "edge", R"LUA(
+    local edge = aelkey.edge
+    local function press() aelkey.emit{ type = "EV_KEY", code = "BTN_LEFT", value = 1 } end
+    local function release() aelkey.emit{ type = "EV_KEY", code = "BTN_LEFT", value = 0 } end
+
+    -- three buttons sampled per report, one of them toggling
+    return function(i)
+      edge.detect("a", i % 8 < 4, press, release)
+      edge.detect("b", false, press, release)
+      edge.detect("c", true, press, release)
+    end
+  )LUA" },
+
+  { "sequence", R"LUA(
+    local seq = aelkey.sequence.new{ window = 500, interval = 20, stream = true }
+    seq.add_pattern{ 1, 2, 1 }
+    seq.add_pattern{ 3, 3 }
+
+    local function match() aelkey.emit{ type = "EV_KEY", code = "KEY_F13", value = 1 } end
+    local buttons = { 1, 2, 1, 3, 3, 2 }
+
+    return function(i)
+      seq.detect(buttons[i % #buttons + 1], match)
+    end
+  )LUA" },
+};
+
+struct Result {
+  double ns = 0;
+  double allocs = 0;
+  double bytes = 0;
+  double emits = 0;
+};
+
+class Bench {
+ public:
+  Bench() : lua_(sol::default_at_panic, counting_alloc, &counters_) {
+    lua_.open_libraries();
+
+    sol::table aelkey = lua_.create_table();
+    aelkey.set_function("emit", [this](sol::table) { ++counters_.emits; });
+    aelkey.set_function("syn_report", [](sol::optional<std::string>) {});
+    aelkey.set_function("tick", [](sol::object, sol::object) {});
+
+    sol::table util = lua_.create_table();
+    util.set_function("now", [](sol::optional<std::string> unit) {
+      uint64_t ns = now_ns();
+      if (unit && *unit == "ms") {
+        return static_cast<double>(ns / 1000000);
+      }
+      return static_cast<double>(ns / 1000);
+    });
+    util.set_function("dump_hex", [](sol::object) { return std::string(); });
+    util.set_function("dump_table", [](sol::object) { return std::string(); });
+    aelkey["util"] = util;
+    lua_["aelkey"] = aelkey;
+
+    for (const auto &sm : script_modules) {
+      aelkey[sm.name] = lua_.script(sm.script);
+    }
+
+    runner_ = lua_.script("return function(step, n) for i = 1, n do step(i) end end");
+  }
+
+  Result run(const Case &c, uint64_t iterations) {
+    sol::protected_function step = lua_.script(c.chunk, c.name);
+
+    // warm caches and tables to their steady size
+    runner_(step, iterations / 10 + 1);
+    lua_.collect_garbage();
+
+    counters_ = Counters{};
+    uint64_t start = now_ns();
+    sol::protected_function_result r = runner_(step, iterations);
+    uint64_t elapsed = now_ns() - start;
+    Counters counted = counters_;
+
+    if (!r.valid()) {
+      sol::error err = r;
+      throw sol::error(std::string(c.name) + ": " + err.what());
+    }
+
+    auto n = static_cast<double>(iterations);
+    return Result{
+      static_cast<double>(elapsed) / n,
+      static_cast<double>(counted.allocs) / n,
+      static_cast<double>(counted.bytes) / n,
+      static_cast<double>(counted.emits) / n,
+    };
+  }
+
+ private:
+  Counters counters_;  // before lua_, which allocates through it
+  sol::state lua_;
+  sol::protected_function runner_;
+};
+
+void usage() {
+  std::fprintf(
+      stderr,
+      "usage: aelkey-lua-bench [--iterations <n>] [--case <name>]... [--json]\n"
+      "\n"
+      "cases:"
+  );
+  for (const auto &c : cases) {
+    std::fprintf(stderr, " %s", c.name);
+  }
+  std::fprintf(stderr, "\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  uint64_t iterations = 200000;
+  std::vector<std::string> selected;
+  bool json = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--json") {
+      json = true;
+    } else if (arg == "--iterations" && i + 1 < argc) {
+      iterations = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--case" && i + 1 < argc) {
+      selected.emplace_back(argv[++i]);
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (iterations == 0) {
+    usage();
+    return 2;
+  }
+
+  try {
+    Bench bench;
+
+    if (!json) {
+      std::printf(
+          "%-14s %12s %14s %13s %13s\n", "case", "ns/event", "allocs/event", "bytes/event",
+          "emits/event"
+      );
+    }
+
+    for (const auto &c : cases) {
+      if (!selected.empty() &&
+          std::find(selected.begin(), selected.end(), c.name) == selected.end()) {
+        continue;
+      }
+
+      Result r = bench.run(c, iterations);
+      if (json) {
+        std::printf(
+            "{\"case\":\"%s\",\"lua\":\"%s\",\"iterations\":%llu,\"ns_per_event\":%.1f,"
+            "\"allocs_per_event\":%.3f,\"bytes_per_event\":%.1f,\"emits_per_event\":%.3f}\n",
+            c.name,
+            LUA_RELEASE,
+            static_cast<unsigned long long>(iterations),
+            r.ns,
+            r.allocs,
+            r.bytes,
+            r.emits
+        );
+      } else {
+        std::printf(
+            "%-14s %12.1f %14.3f %13.1f %13.3f\n", c.name, r.ns, r.allocs, r.bytes, r.emits
+        );
+      }
+    }
+  } catch (const sol::error &err) {
+    std::fprintf(stderr, "aelkey-lua-bench: %s\n", err.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,615 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "mock_bluez.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util/dbus_bytes.h"
+
+namespace {
+
+constexpr const char *ADAPTER_PATH = "/org/bluez/hci0";
+constexpr const char *DEVICE_PATH = "/org/bluez/hci0/dev_AE_1B_00_00_00_01";
+constexpr const char *SERVICE_PATH = "/org/bluez/hci0/dev_AE_1B_00_00_00_01/service0010";
+constexpr const char *NOTIFY_PATH =
+    "/org/bluez/hci0/dev_AE_1B_00_00_00_01/service0010/char0011";
+constexpr const char *WRITE_PATH =
+    "/org/bluez/hci0/dev_AE_1B_00_00_00_01/service0010/char0014";
+
+constexpr const char *ADAPTER_IFACE = "org.bluez.Adapter1";
+constexpr const char *DEVICE_IFACE = "org.bluez.Device1";
+constexpr const char *SERVICE_IFACE = "org.bluez.GattService1";
+constexpr const char *CHAR_IFACE = "org.bluez.GattCharacteristic1";
+constexpr const char *OBJECT_MANAGER_IFACE = "org.freedesktop.DBus.ObjectManager";
+constexpr const char *PROPERTIES_IFACE = "org.freedesktop.DBus.Properties";
+
+struct MockObject {
+  const char *path;
+  const char *iface;
+};
+
+// In path order, as bluetoothd would list them
+constexpr MockObject OBJECTS[] = {
+  { ADAPTER_PATH, ADAPTER_IFACE },  { DEVICE_PATH, DEVICE_IFACE },
+  { SERVICE_PATH, SERVICE_IFACE },  { NOTIFY_PATH, CHAR_IFACE },
+  { WRITE_PATH, CHAR_IFACE },
+};
+
+// Enough to let any client in; nothing else is on this bus
+constexpr const char *BUS_CONFIG =
+    "<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-BUS Bus Configuration 1.0//EN\"\n"
+    " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+    "<busconfig>\n"
+    "  <listen>unix:path=%s/bus</listen>\n"
+    "  <auth>EXTERNAL</auth>\n"
+    "  <policy context=\"default\">\n"
+    "    <allow user=\"*\"/>\n"
+    "    <allow own=\"*\"/>\n"
+    "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+    "    <allow eavesdrop=\"true\"/>\n"
+    "  </policy>\n"
+    "</busconfig>\n";
+
+constexpr int BUS_START_TIMEOUT_MS = 5000;
+
+// dict entry {key: variant} of a basic type
+void append_entry(DBusMessageIter *dict, const char *key, int type, const void *value) {
+  char signature[2] = { static_cast<char>(type), '\0' };
+  DBusMessageIter entry, variant;
+  dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, nullptr, &entry);
+  dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+  dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, signature, &variant);
+  dbus_message_iter_append_basic(&variant, type, value);
+  dbus_message_iter_close_container(&entry, &variant);
+  dbus_message_iter_close_container(dict, &entry);
+}
+
+void append_string(DBusMessageIter *dict, const char *key, const char *value) {
+  append_entry(dict, key, DBUS_TYPE_STRING, &value);
+}
+
+void append_path(DBusMessageIter *dict, const char *key, const char *value) {
+  append_entry(dict, key, DBUS_TYPE_OBJECT_PATH, &value);
+}
+
+void append_bool(DBusMessageIter *dict, const char *key, bool value) {
+  dbus_bool_t b = value ? TRUE : FALSE;
+  append_entry(dict, key, DBUS_TYPE_BOOLEAN, &b);
+}
+
+void append_strings(
+    DBusMessageIter *dict, const char *key, const std::vector<const char *> &values
+) {
+  DBusMessageIter entry, variant, array;
+  dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, nullptr, &entry);
+  dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+  dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "as", &variant);
+  dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "s", &array);
+  for (const char *s : values) {
+    dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &s);
+  }
+  dbus_message_iter_close_container(&variant, &array);
+  dbus_message_iter_close_container(&entry, &variant);
+  dbus_message_iter_close_container(dict, &entry);
+}
+
+void append_bytes(DBusMessageIter *dict, const char *key, const uint8_t *data, size_t size) {
+  DBusMessageIter entry, variant;
+  dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, nullptr, &entry);
+  dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+  dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "ay", &variant);
+  dbus_append_byte_array(&variant, data, size);
+  dbus_message_iter_close_container(&entry, &variant);
+  dbus_message_iter_close_container(dict, &entry);
+}
+
+DBusMessage *not_supported(DBusMessage *msg) {
+  return dbus_message_new_error(
+      msg, "org.bluez.Error.NotSupported", "Operation is not supported"
+  );
+}
+
+void close_fd(int &fd) {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// PrivateBus
+
+bool PrivateBus::start() {
+  char dir[] = "/tmp/aelkey-bus-XXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mock bluez: mkdtemp");
+    return false;
+  }
+  dir_ = dir;
+
+  std::string config = dir_ + "/bus.conf";
+  FILE *f = std::fopen(config.c_str(), "w");
+  if (!f) {
+    perror("mock bluez: bus.conf");
+    stop();
+    return false;
+  }
+  std::fprintf(f, BUS_CONFIG, dir_.c_str());
+  std::fclose(f);
+
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC) < 0) {
+    perror("mock bluez: pipe");
+    stop();
+    return false;
+  }
+
+  // built before fork; the child only execs
+  std::string config_arg = "--config-file=" + config;
+  std::string address_arg = "--print-address=" + std::to_string(pipefd[1]);
+
+  pid_ = fork();
+  if (pid_ == 0) {
+    // the daemon writes its address to pipefd[1]; keep it across exec
+    fcntl(pipefd[1], F_SETFD, 0);
+    execlp(
+        "dbus-daemon",
+        "dbus-daemon",
+        "--nofork",
+        config_arg.c_str(),
+        address_arg.c_str(),
+        static_cast<char *>(nullptr)
+    );
+    std::fprintf(stderr, "mock bluez: dbus-daemon: %s\n", std::strerror(errno));
+    _exit(127);
+  }
+  close(pipefd[1]);
+  if (pid_ < 0) {
+    perror("mock bluez: fork");
+    close(pipefd[0]);
+    stop();
+    return false;
+  }
+
+  std::string line;
+  struct pollfd pfd{ pipefd[0], POLLIN, 0 };
+  while (line.find('\n') == std::string::npos && poll(&pfd, 1, BUS_START_TIMEOUT_MS) > 0) {
+    char buf[256];
+    ssize_t n = read(pipefd[0], buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    line.append(buf, static_cast<size_t>(n));
+  }
+  close(pipefd[0]);
+
+  size_t end = line.find('\n');
+  if (end == std::string::npos || end == 0) {
+    std::fprintf(stderr, "mock bluez: dbus-daemon did not report an address\n");
+    stop();
+    return false;
+  }
+  address_ = line.substr(0, end);
+  return true;
+}
+
+void PrivateBus::stop() {
+  if (pid_ > 0) {
+    kill(pid_, SIGTERM);
+    waitpid(pid_, nullptr, 0);
+    pid_ = -1;
+  }
+  if (!dir_.empty()) {
+    unlink((dir_ + "/bus").c_str());
+    unlink((dir_ + "/bus.conf").c_str());
+    rmdir(dir_.c_str());
+    dir_.clear();
+  }
+  address_.clear();
+}
+
+// ---------------------------------------------------------------------------
+// MockBluez
+
+MockBluez::MockBluez(MockBluezOptions options)
+    : options_(options),
+      notify_char_{
+        NOTIFY_PATH,
+        "0000fff1-0000-1000-8000-00805f9b34fb",
+        { "read", "notify" },
+        { 0 },
+      },
+      write_char_{
+        WRITE_PATH,
+        "0000fff2-0000-1000-8000-00805f9b34fb",
+        { "read", "write", "write-without-response" },
+        { 0 },
+      } {}
+
+bool MockBluez::start(const std::string &address) {
+  if (running_) {
+    return true;
+  }
+
+  DBusError err;
+  dbus_error_init(&err);
+
+  conn_ = dbus_connection_open_private(address.c_str(), &err);
+  if (!conn_ || !dbus_bus_register(conn_, &err)) {
+    std::fprintf(stderr, "mock bluez: connect: %s\n", err.message ? err.message : "failed");
+    dbus_error_free(&err);
+    stop();
+    return false;
+  }
+  dbus_connection_set_exit_on_disconnect(conn_, FALSE);
+
+  int ret = dbus_bus_request_name(conn_, "org.bluez", DBUS_NAME_FLAG_DO_NOT_QUEUE, &err);
+  if (ret != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+    std::fprintf(stderr, "mock bluez: org.bluez: %s\n", err.message ? err.message : "taken");
+    dbus_error_free(&err);
+    stop();
+    return false;
+  }
+
+  DBusObjectPathVTable vtable{};  // copied by libdbus
+  vtable.message_function = &MockBluez::on_message;
+  if (!dbus_connection_register_fallback(conn_, "/", &vtable, this) ||
+      pipe2(wake_, O_CLOEXEC | O_NONBLOCK) < 0) {
+    std::fprintf(stderr, "mock bluez: setup failed\n");
+    stop();
+    return false;
+  }
+
+  running_ = true;
+  thread_ = std::thread(&MockBluez::serve, this);
+  return true;
+}
+
+void MockBluez::stop() {
+  if (thread_.joinable()) {
+    running_ = false;
+    (void)!write(wake_[1], "", 1);
+    thread_.join();
+  }
+
+  int fd = notify_fd_.exchange(-1);
+  close_fd(fd);
+  notifying_ = false;
+  for (int &w : write_fds_) {
+    close_fd(w);
+  }
+  write_fds_.clear();
+  close_fd(wake_[0]);
+  close_fd(wake_[1]);
+
+  if (conn_) {
+    dbus_connection_close(conn_);
+    dbus_connection_unref(conn_);
+    conn_ = nullptr;
+  }
+}
+
+bool MockBluez::notify(const uint8_t *data, size_t size) {
+  int fd = notify_fd_.load();
+  if (fd >= 0) {
+    if (send(fd, data, size, MSG_NOSIGNAL) == static_cast<ssize_t>(size)) {
+      return true;
+    }
+    if (errno == EPIPE && notify_fd_.compare_exchange_strong(fd, -1)) {
+      close(fd);  // released by the client
+    }
+    return false;
+  }
+  if (!notifying_) {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(signals_mutex_);
+    signals_.emplace_back(data, data + size);
+  }
+  (void)!write(wake_[1], "", 1);  // a full pipe already wakes it
+  return true;
+}
+
+// libdbus is only ever used from this thread; notify() hands signals
+// over through signals_ and the wake pipe
+void MockBluez::serve() {
+  int bus_fd = -1;
+  dbus_connection_get_unix_fd(conn_, &bus_fd);
+
+  std::vector<struct pollfd> fds;
+  while (running_) {
+    fds.clear();
+    fds.push_back({ bus_fd, POLLIN, 0 });
+    fds.push_back({ wake_[0], POLLIN, 0 });
+    for (int w : write_fds_) {
+      fds.push_back({ w, POLLIN, 0 });
+    }
+
+    // data already read into the connection does not wake poll
+    bool buffered = dbus_connection_get_dispatch_status(conn_) == DBUS_DISPATCH_DATA_REMAINS;
+    poll(fds.data(), fds.size(), buffered ? 0 : 100);
+
+    char buf[64];
+    while (read(wake_[0], buf, sizeof(buf)) > 0) {
+    }
+
+    if (!dbus_connection_read_write(conn_, 0)) {
+      break;  // bus gone
+    }
+    while (dbus_connection_dispatch(conn_) == DBUS_DISPATCH_DATA_REMAINS) {
+    }
+
+    send_signals();
+    drain_writes();
+    dbus_connection_flush(conn_);
+  }
+}
+
+DBusHandlerResult MockBluez::on_message(DBusConnection *conn, DBusMessage *msg, void *data) {
+  if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+
+  auto *self = static_cast<MockBluez *>(data);
+  DBusMessage *reply = self->handle_call(msg);
+  if (!reply) {
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;  // libdbus answers UnknownMethod
+  }
+  dbus_connection_send(conn, reply, nullptr);
+  dbus_message_unref(reply);
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+DBusMessage *MockBluez::handle_call(DBusMessage *msg) {
+  const char *path = dbus_message_get_path(msg);
+  if (!path) {
+    return nullptr;
+  }
+
+  if (dbus_message_is_method_call(msg, OBJECT_MANAGER_IFACE, "GetManagedObjects")) {
+    return std::strcmp(path, "/") == 0 ? managed_objects(msg) : nullptr;
+  }
+  if (dbus_message_is_method_call(msg, PROPERTIES_IFACE, "GetAll")) {
+    return get_all(msg, path);
+  }
+  if (Characteristic *chr = find_characteristic(path)) {
+    return characteristic_call(msg, *chr);
+  }
+  return nullptr;
+}
+
+DBusMessage *MockBluez::managed_objects(DBusMessage *msg) {
+  DBusMessage *reply = dbus_message_new_method_return(msg);
+
+  DBusMessageIter iter, objects;
+  dbus_message_iter_init_append(reply, &iter);
+  dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{oa{sa{sv}}}", &objects);
+
+  for (const auto &obj : OBJECTS) {
+    DBusMessageIter entry, ifaces, iface, props;
+    dbus_message_iter_open_container(&objects, DBUS_TYPE_DICT_ENTRY, nullptr, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_OBJECT_PATH, &obj.path);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_ARRAY, "{sa{sv}}", &ifaces);
+    dbus_message_iter_open_container(&ifaces, DBUS_TYPE_DICT_ENTRY, nullptr, &iface);
+    dbus_message_iter_append_basic(&iface, DBUS_TYPE_STRING, &obj.iface);
+    dbus_message_iter_open_container(&iface, DBUS_TYPE_ARRAY, "{sv}", &props);
+    append_properties(&props, obj.path, obj.iface);
+    dbus_message_iter_close_container(&iface, &props);
+    dbus_message_iter_close_container(&ifaces, &iface);
+    dbus_message_iter_close_container(&entry, &ifaces);
+    dbus_message_iter_close_container(&objects, &entry);
+  }
+
+  dbus_message_iter_close_container(&iter, &objects);
+  return reply;
+}
+
+DBusMessage *MockBluez::get_all(DBusMessage *msg, const char *path) {
+  const char *iface_name = nullptr;
+  if (!dbus_message_get_args(
+          msg, nullptr, DBUS_TYPE_STRING, &iface_name, DBUS_TYPE_INVALID
+      )) {
+    return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "expected interface name");
+  }
+
+  DBusMessage *reply = dbus_message_new_method_return(msg);
+  DBusMessageIter iter, props;
+  dbus_message_iter_init_append(reply, &iter);
+  dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &props);
+  bool found = append_properties(&props, path, iface_name);
+  dbus_message_iter_close_container(&iter, &props);
+
+  if (!found) {
+    dbus_message_unref(reply);
+    return dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_INTERFACE, iface_name);
+  }
+  return reply;
+}
+
+bool MockBluez::append_properties(DBusMessageIter *props, const char *path, const char *iface) {
+  auto is = [&](const char *p, const char *i) {
+    return std::strcmp(path, p) == 0 && std::strcmp(iface, i) == 0;
+  };
+
+  if (is(ADAPTER_PATH, ADAPTER_IFACE)) {
+    append_string(props, "Address", "00:00:00:00:00:00");
+    append_string(props, "Name", "aelkey-mock");
+    append_bool(props, "Powered", true);
+    return true;
+  }
+
+  if (is(DEVICE_PATH, DEVICE_IFACE)) {
+    append_string(props, "Address", DEVICE_ADDRESS);
+    append_string(props, "Name", DEVICE_NAME);
+    append_string(props, "Alias", DEVICE_NAME);
+    append_path(props, "Adapter", ADAPTER_PATH);
+    append_bool(props, "Paired", true);
+    append_bool(props, "Connected", true);
+    append_bool(props, "ServicesResolved", true);
+    return true;
+  }
+
+  if (is(SERVICE_PATH, SERVICE_IFACE)) {
+    append_string(props, "UUID", "0000fff0-0000-1000-8000-00805f9b34fb");
+    append_path(props, "Device", DEVICE_PATH);
+    append_bool(props, "Primary", true);
+    return true;
+  }
+
+  if (std::strcmp(iface, CHAR_IFACE) == 0) {
+    Characteristic *chr = find_characteristic(path);
+    if (!chr) {
+      return false;
+    }
+    bool notifying = chr == &notify_char_ && subscribed();
+    append_string(props, "UUID", chr->uuid);
+    append_path(props, "Service", SERVICE_PATH);
+    append_strings(props, "Flags", chr->flags);
+    append_bytes(props, "Value", chr->value.data(), chr->value.size());
+    append_bool(props, "Notifying", notifying);
+    return true;
+  }
+
+  return false;
+}
+
+MockBluez::Characteristic *MockBluez::find_characteristic(const char *path) {
+  if (std::strcmp(path, NOTIFY_PATH) == 0) {
+    return &notify_char_;
+  }
+  if (std::strcmp(path, WRITE_PATH) == 0) {
+    return &write_char_;
+  }
+  return nullptr;
+}
+
+DBusMessage *MockBluez::characteristic_call(DBusMessage *msg, Characteristic &chr) {
+  if (dbus_message_is_method_call(msg, CHAR_IFACE, "ReadValue")) {
+    DBusMessage *reply = dbus_message_new_method_return(msg);
+    DBusMessageIter iter;
+    dbus_message_iter_init_append(reply, &iter);
+    dbus_append_byte_array(&iter, chr.value.data(), chr.value.size());
+    return reply;
+  }
+
+  if (dbus_message_is_method_call(msg, CHAR_IFACE, "WriteValue")) {
+    auto value = dbus_byte_array(msg);
+    chr.value.assign(value.begin(), value.end());
+    if (&chr == &write_char_) {
+      ++writes_;
+    }
+    return dbus_message_new_method_return(msg);
+  }
+
+  bool is_notify = &chr == &notify_char_;
+  if (dbus_message_is_method_call(msg, CHAR_IFACE, "StartNotify") ||
+      dbus_message_is_method_call(msg, CHAR_IFACE, "StopNotify")) {
+    if (!is_notify) {
+      return not_supported(msg);
+    }
+    notifying_ = dbus_message_is_method_call(msg, CHAR_IFACE, "StartNotify");
+    return dbus_message_new_method_return(msg);
+  }
+
+  if (dbus_message_is_method_call(msg, CHAR_IFACE, "AcquireNotify")) {
+    if (!is_notify || !options_.acquire_notify) {
+      return not_supported(msg);
+    }
+    return acquire(msg, true);
+  }
+
+  if (dbus_message_is_method_call(msg, CHAR_IFACE, "AcquireWrite")) {
+    if (is_notify) {
+      return not_supported(msg);
+    }
+    return acquire(msg, false);
+  }
+
+  return nullptr;
+}
+
+// (h fd, q mtu): a SOCK_SEQPACKET pair, one packet per value, as
+// bluetoothd hands out
+DBusMessage *MockBluez::acquire(DBusMessage *msg, bool notify) {
+  int sv[2];
+  int flags = SOCK_SEQPACKET | SOCK_CLOEXEC | (notify ? 0 : SOCK_NONBLOCK);
+  if (socketpair(AF_UNIX, flags, 0, sv) < 0) {
+    return dbus_message_new_error(msg, "org.bluez.Error.Failed", std::strerror(errno));
+  }
+
+  DBusMessage *reply = dbus_message_new_method_return(msg);
+  dbus_uint16_t mtu = options_.mtu;
+  dbus_message_append_args(
+      reply, DBUS_TYPE_UNIX_FD, &sv[1], DBUS_TYPE_UINT16, &mtu, DBUS_TYPE_INVALID
+  );
+  close(sv[1]);  // the message holds a duplicate
+
+  if (notify) {
+    int old = notify_fd_.exchange(sv[0]);
+    close_fd(old);
+  } else {
+    write_fds_.push_back(sv[0]);
+  }
+  return reply;
+}
+
+void MockBluez::send_signals() {
+  std::vector<std::vector<uint8_t>> pending;
+  {
+    std::lock_guard<std::mutex> lock(signals_mutex_);
+    pending.swap(signals_);
+  }
+
+  const char *iface = CHAR_IFACE;
+  for (const auto &value : pending) {
+    DBusMessage *signal =
+        dbus_message_new_signal(NOTIFY_PATH, PROPERTIES_IFACE, "PropertiesChanged");
+
+    DBusMessageIter iter, props, invalidated;
+    dbus_message_iter_init_append(signal, &iter);
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &iface);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &props);
+    append_bytes(&props, "Value", value.data(), value.size());
+    dbus_message_iter_close_container(&iter, &props);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &invalidated);
+    dbus_message_iter_close_container(&iter, &invalidated);
+
+    dbus_connection_send(conn_, signal, nullptr);
+    dbus_message_unref(signal);
+  }
+
+  if (!pending.empty()) {
+    notify_char_.value = pending.back();
+  }
+}
+
+void MockBluez::drain_writes() {
+  uint8_t buf[512];
+  for (auto it = write_fds_.begin(); it != write_fds_.end();) {
+    ssize_t n;
+    while ((n = read(*it, buf, sizeof(buf))) > 0) {
+      ++writes_;
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      close(*it);  // released
+      it = write_fds_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
@@ -0,0 +1,130 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// Stand-in for bluetoothd, for benchmarking and testing the GATT backend
+// without a radio.
+//
+// PrivateBus runs a dbus-daemon of its own; a process started with
+// DBUS_SYSTEM_BUS_ADDRESS set to its address uses it as the system bus.
+// MockBluez owns org.bluez on that bus and exports one connected LE
+// device with one service:
+//
+//   /org/bluez/hci0                                     Adapter1
+//   /org/bluez/hci0/dev_AE_1B_00_00_00_01               Device1 "aelkey-bench gatt"
+//     service0010                 fff0                  GattService1
+//     service0010/char0011        fff1  read, notify
+//     service0010/char0014        fff2  read, write, write-without-response
+//
+// ReadValue, WriteValue, StartNotify, StopNotify, AcquireNotify, and
+// AcquireWrite are implemented. notify() sends on the AcquireNotify
+// socket when one was handed out, else as a PropertiesChanged signal
+// while notifying.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dbus/dbus.h>
+#include <sys/types.h>
+
+class PrivateBus {
+ public:
+  ~PrivateBus() {
+    stop();
+  }
+
+  // Start dbus-daemon with a permissive configuration in a temporary
+  // directory and wait for its address
+  bool start();
+  void stop();
+
+  const std::string &address() const {
+    return address_;
+  }
+
+ private:
+  pid_t pid_ = -1;
+  std::string dir_;
+  std::string address_;
+};
+
+struct MockBluezOptions {
+  bool acquire_notify = true;  // false: AcquireNotify is refused, notifications are signals
+  uint16_t mtu = 247;
+};
+
+class MockBluez {
+ public:
+  static constexpr const char *DEVICE_NAME = "aelkey-bench gatt";
+  static constexpr const char *DEVICE_ADDRESS = "AE:1B:00:00:00:01";
+
+  explicit MockBluez(MockBluezOptions options = {});
+  ~MockBluez() {
+    stop();
+  }
+
+  // Connect to the bus at address, own org.bluez, and serve calls on a
+  // thread of its own
+  bool start(const std::string &address);
+  void stop();
+
+  // One notification from char0011; false while nobody is subscribed.
+  // Safe to call from any one thread besides the service thread.
+  bool notify(const uint8_t *data, size_t size);
+
+  bool subscribed() const {
+    return notify_fd_.load() >= 0 || notifying_.load();
+  }
+
+  // WriteValue calls and AcquireWrite packets received on char0014
+  uint64_t writes() const {
+    return writes_.load();
+  }
+
+ private:
+  struct Characteristic {
+    const char *path;
+    const char *uuid;
+    std::vector<const char *> flags;
+    std::vector<uint8_t> value;
+  };
+
+  static DBusHandlerResult on_message(DBusConnection *conn, DBusMessage *msg, void *data);
+
+  void serve();
+  DBusMessage *handle_call(DBusMessage *msg);
+  DBusMessage *managed_objects(DBusMessage *msg);
+  DBusMessage *get_all(DBusMessage *msg, const char *path);
+  DBusMessage *characteristic_call(DBusMessage *msg, Characteristic &chr);
+  DBusMessage *acquire(DBusMessage *msg, bool notify);
+
+  // a{sv} of one interface of path; false if path does not have it
+  bool append_properties(DBusMessageIter *props, const char *path, const char *iface);
+  Characteristic *find_characteristic(const char *path);
+
+  void send_signals();
+  void drain_writes();
+
+  MockBluezOptions options_;
+  DBusConnection *conn_ = nullptr;
+  std::thread thread_;
+  std::atomic<bool> running_{ false };
+  int wake_[2] = { -1, -1 };  // notify() -> service thread
+
+  Characteristic notify_char_;
+  Characteristic write_char_;
+
+  std::atomic<int> notify_fd_{ -1 };  // our end of the AcquireNotify socket
+  std::atomic<bool> notifying_{ false };
+  std::vector<int> write_fds_;  // our ends of AcquireWrite sockets
+  std::atomic<uint64_t> writes_{ 0 };
+
+  std::mutex signals_mutex_;
+  std::vector<std::vector<uint8_t>> signals_;  // notifications to send as signals
+};
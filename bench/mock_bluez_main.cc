@@ -0,0 +1,130 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+// aelkey-mock-bluez: the mock BlueZ of aelkey-bench on its own, for
+// trying GATT scripts without a radio. Prints the private bus address
+// and streams notifications on char0011 at --rate while subscribed.
+//
+//   aelkey-mock-bluez --rate 500 &   # prints DBUS_SYSTEM_BUS_ADDRESS=...
+//   DBUS_SYSTEM_BUS_ADDRESS=<printed address> lua my_gatt_script.lua
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "mock_bluez.h"
+
+namespace {
+
+std::atomic<bool> stop_requested{ false };
+
+void on_signal(int) {
+  stop_requested = true;
+}
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void sleep_until_ns(uint64_t ns) {
+  struct timespec ts;
+  ts.tv_sec = static_cast<time_t>(ns / 1000000000ULL);
+  ts.tv_nsec = static_cast<long>(ns % 1000000000ULL);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR &&
+         !stop_requested) {
+  }
+}
+
+void usage() {
+  std::fprintf(
+      stderr,
+      "usage: aelkey-mock-bluez [options]\n"
+      "\n"
+      "  --rate <hz>     notifications per second while subscribed (default 100)\n"
+      "  --size <n>      bytes per notification, at least 3 (default 3)\n"
+      "  --mtu <n>       MTU reported by AcquireNotify and AcquireWrite (default 247)\n"
+      "  --signals       refuse AcquireNotify; notify with PropertiesChanged\n"
+  );
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  MockBluezOptions options;
+  double rate = 100;
+  size_t size = 3;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--signals") {
+      options.acquire_notify = false;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      usage();
+      return 2;
+    }
+    const char *v = argv[++i];
+    if (arg == "--rate") {
+      rate = std::atof(v);
+    } else if (arg == "--size") {
+      size = static_cast<size_t>(std::max(3, std::atoi(v)));
+    } else if (arg == "--mtu") {
+      options.mtu = static_cast<uint16_t>(std::atoi(v));
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (rate < 0) {
+    usage();
+    return 2;
+  }
+
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+
+  PrivateBus bus;
+  MockBluez bluez(options);
+  if (!bus.start() || !bluez.start(bus.address())) {
+    return 1;
+  }
+  std::printf("DBUS_SYSTEM_BUS_ADDRESS=%s\n", bus.address().c_str());
+  std::fflush(stdout);
+
+  // same layout as aelkey-bench: sequence number, flipping direction
+  std::string value(size, '\0');
+  uint64_t sent = 0;
+  uint64_t period = rate > 0 ? static_cast<uint64_t>(1e9 / rate) : 100000000ULL;
+  uint64_t next = now_ns();
+
+  while (!stop_requested) {
+    next += period;
+    sleep_until_ns(next);
+
+    if (rate > 0 && bluez.subscribed()) {
+      value[0] = static_cast<char>(sent & 0xff);
+      value[1] = static_cast<char>((sent >> 8) & 0xff);
+      value[2] = static_cast<char>(sent & 1);
+      if (bluez.notify(reinterpret_cast<const uint8_t *>(value.data()), value.size())) {
+        ++sent;
+      }
+    }
+  }
+
+  std::fprintf(
+      stderr,
+      "aelkey-mock-bluez: %llu notifications sent, %llu writes received\n",
+      static_cast<unsigned long long>(sent),
+      static_cast<unsigned long long>(bluez.writes())
+  );
+  return 0;
+}
@@ -0,0 +1,23 @@
+-- aelkey-bench: GATT notifications from the mock BlueZ (sequence, direction)
+aelkey = require("aelkey")
+
+inputs = {
+  { id = "pad", type = "gatt", name = "aelkey-bench gatt", on_event = "notify" },
+}
+
+outputs = {
+  { id = "out", type = "mouse", name = "aelkey-bench output" },
+}
+
+function notify(n)
+  if n.status ~= "ok" or n.size < 3 then
+    return
+  end
+
+  local dir = n.data:byte(3) == 1 and 1 or -1
+  aelkey.emit{ device = "out", type = "EV_REL", code = "REL_X", value = dir }
+  aelkey.syn_report("out")
+end
+
+local start = os.getenv("AELKEY_BENCH_START")
+aelkey.start(start and load("return " .. start)() or nil)
@@ -0,0 +1,43 @@
+-- aelkey-bench: gyro rates (int16 x, y, z) scaled to pointer motion
+aelkey = require("aelkey")
+
+inputs = {
+  { id = "gyro", type = "hidraw", name = "aelkey-bench gyro", on_event = "report" },
+}
+
+outputs = {
+  { id = "out", type = "mouse", name = "aelkey-bench output" },
+}
+
+local SCALE = 0.01
+local rx, ry = 0.0, 0.0  -- sub-count remainders
+
+local function s16(lo, hi)
+  local v = lo + hi * 256
+  return v >= 32768 and v - 65536 or v
+end
+
+function report(r)
+  if r.status ~= "ok" or r.size < 6 then
+    return
+  end
+
+  local x0, x1, _, _, z0, z1 = r.data:byte(1, 6)
+  rx = rx + s16(z0, z1) * SCALE
+  ry = ry + s16(x0, x1) * SCALE
+
+  local dx = rx >= 0 and math.floor(rx) or math.ceil(rx)
+  local dy = ry >= 0 and math.floor(ry) or math.ceil(ry)
+  rx, ry = rx - dx, ry - dy
+
+  if dx ~= 0 then
+    aelkey.emit{ device = "out", type = "EV_REL", code = "REL_X", value = dx }
+  end
+  if dy ~= 0 then
+    aelkey.emit{ device = "out", type = "EV_REL", code = "REL_Y", value = dy }
+  end
+  aelkey.syn_report("out")
+end
+
+local start = os.getenv("AELKEY_BENCH_START")
+aelkey.start(start and load("return " .. start)() or nil)
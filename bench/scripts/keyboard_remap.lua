@@ -0,0 +1,25 @@
+-- aelkey-bench: one key remapped to another, evdev to uinput keyboard
+aelkey = require("aelkey")
+
+inputs = {
+  { id = "kbd", type = "evdev", name = "aelkey-bench keyboard", grab = true, on_event = "remap" },
+}
+
+outputs = {
+  { id = "out", type = "keyboard", name = "aelkey-bench output" },
+}
+
+local map = { KEY_F23 = "KEY_F24" }
+
+function remap(events)
+  for _, ev in ipairs(events) do
+    if ev.type == "EV_KEY" then
+      aelkey.emit{ device = "out", type = "EV_KEY", code = map[ev.code] or ev.code, value = ev.value }
+    end
+  end
+  aelkey.syn_report("out")
+end
+
+-- extra start options from aelkey-bench --start
+local start = os.getenv("AELKEY_BENCH_START")
+aelkey.start(start and load("return " .. start)() or nil)
@@ -0,0 +1,51 @@
+-- aelkey-bench: raw mouse reports (buttons, dx, dy, wheel) parsed in Lua
+aelkey = require("aelkey")
+
+inputs = {
+  { id = "mouse", type = "hidraw", name = "aelkey-bench mouse", on_event = "report" },
+}
+
+outputs = {
+  { id = "out", type = "mouse", name = "aelkey-bench output" },
+}
+
+local buttons = { "BTN_LEFT", "BTN_RIGHT", "BTN_MIDDLE" }
+local held = 0
+
+-- LuaJIT has no bitwise operators
+local function flag(v, i)
+  return math.floor(v / 2 ^ (i - 1)) % 2
+end
+
+local function s8(b)
+  return b >= 128 and b - 256 or b
+end
+
+function report(r)
+  if r.status ~= "ok" or r.size < 4 then
+    return
+  end
+
+  local b, x, y, w = r.data:byte(1, 4)
+  for i, code in ipairs(buttons) do
+    local pressed = flag(b, i)
+    if pressed ~= flag(held, i) then
+      aelkey.emit{ device = "out", type = "EV_KEY", code = code, value = pressed }
+    end
+  end
+  held = b
+
+  if x ~= 0 then
+    aelkey.emit{ device = "out", type = "EV_REL", code = "REL_X", value = s8(x) }
+  end
+  if y ~= 0 then
+    aelkey.emit{ device = "out", type = "EV_REL", code = "REL_Y", value = s8(y) }
+  end
+  if w ~= 0 then
+    aelkey.emit{ device = "out", type = "EV_REL", code = "REL_WHEEL", value = s8(w) }
+  end
+  aelkey.syn_report("out")
+end
+
+local start = os.getenv("AELKEY_BENCH_START")
+aelkey.start(start and load("return " .. start)() or nil)
@@ -0,0 +1,44 @@
+-- aelkey-bench: multitouch finger motion turned into relative pointer motion
+aelkey = require("aelkey")
+
+inputs = {
+  { id = "pad", type = "evdev", name = "aelkey-bench touchpad", grab = true, on_event = "touch" },
+}
+
+outputs = {
+  { id = "out", type = "mouse", name = "aelkey-bench output" },
+}
+
+local slot = 0
+local last = {}
+
+function touch(events)
+  local dx, dy = 0, 0
+  for _, ev in ipairs(events) do
+    if ev.code == "ABS_MT_SLOT" then
+      slot = ev.value
+    elseif ev.code == "ABS_MT_TRACKING_ID" then
+      last[slot] = ev.value >= 0 and {} or nil
+    elseif ev.code == "ABS_MT_POSITION_X" or ev.code == "ABS_MT_POSITION_Y" then
+      local axis = ev.code == "ABS_MT_POSITION_X" and "x" or "y"
+      local contact = last[slot]
+      if contact then
+        -- a new contact moves by one count so every frame has output
+        local delta = contact[axis] and ev.value - contact[axis] or 1
+        if axis == "x" then dx = delta else dy = delta end
+        contact[axis] = ev.value
+      end
+    end
+  end
+
+  if dx ~= 0 then
+    aelkey.emit{ device = "out", type = "EV_REL", code = "REL_X", value = dx }
+  end
+  if dy ~= 0 then
+    aelkey.emit{ device = "out", type = "EV_REL", code = "REL_Y", value = dy }
+  end
+  aelkey.syn_report("out")
+end
+
+local start = os.getenv("AELKEY_BENCH_START")
+aelkey.start(start and load("return " .. start)() or nil)
@@ -8,6 +8,7 @@
 #include "aelkey_hid.h"
 #include "aelkey_loop.h"
 #include "aelkey_state.h"
+#include "aelkey_stats.h"
 #include "aelkey_usb.h"
 #include "aelkey_util.h"
 #include "dispatcher_udev.h"
@@ -45,6 +46,7 @@ constexpr CModule c_modules[] = {
   { "gatt", luaopen_aelkey_gatt },
   { "haptics", luaopen_aelkey_haptics },
   { "hid", luaopen_aelkey_hid },
+  { "stats", luaopen_aelkey_stats },
   { "usb", luaopen_aelkey_usb },
   { "util", luaopen_aelkey_util },
 };
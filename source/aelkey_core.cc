@@ -9,7 +9,9 @@
 #include <unistd.h>
 
 #include "aelkey_state.h"
+#include "latency_stats.h"
 #include "tick_scheduler.h"
+#include "trace.h"
 
 // emit{ device=?, type=?, code=?, value=? }
 sol::object core_emit(sol::this_state ts, sol::table opts) {
@@ -48,6 +50,7 @@ sol::object core_emit(sol::this_state ts, sol::table opts) {
     if (state.uinput_devices.size() == 1) {
       auto it = state.uinput_devices.begin();
       libevdev_uinput_write_event(it->second, type, code, value);
+      state.loop_stats.count_output(it->first);
     } else {
       throw sol::error("emit requires 'device' when multiple output devices are present");
     }
@@ -57,6 +60,14 @@ sol::object core_emit(sol::this_state ts, sol::table opts) {
       throw sol::error("Unknown device id: " + std::string(dev_id));
     }
     libevdev_uinput_write_event(it->second, type, code, value);
+    state.loop_stats.count_output(it->first);
+  }
+
+  if (type == EV_SYN && code == SYN_REPORT) {
+    TRACE_INSTANT(TraceCategory::Uinput, "syn_report", dev_id ? dev_id : "");
+    LatencyStats::instance().output_written();
+  } else {
+    TRACE_INSTANT(TraceCategory::Uinput, "emit", dev_id ? dev_id : "");
   }
 
   return sol::make_object(lua, sol::lua_nil);
@@ -74,12 +85,18 @@ sol::object core_syn_report(sol::this_state ts, sol::optional<std::string> dev_i
       throw sol::error("Unknown device id: " + dev_id);
     }
     libevdev_uinput_write_event(it->second, EV_SYN, SYN_REPORT, 0);
+    state.loop_stats.count_output(it->first);
+    TRACE_INSTANT(TraceCategory::Uinput, "syn_report", dev_id);
   } else {
     for (auto &kv : state.uinput_devices) {
       libevdev_uinput_write_event(kv.second, EV_SYN, SYN_REPORT, 0);
+      state.loop_stats.count_output(kv.first);
+      TRACE_INSTANT(TraceCategory::Uinput, "syn_report", kv.first);
     }
   }
 
+  LatencyStats::instance().output_written();
+
   return sol::make_object(lua, sol::lua_nil);
 }
 
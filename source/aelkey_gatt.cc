@@ -1,12 +1,66 @@
 #include "aelkey_gatt.h"
 
+#include <cstdio>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <sol/sol.hpp>
 
 #include "aelkey_state.h"
+#include "callback_stats.h"
 #include "device_backend_gatt.h"
+#include "lua_scripts.h"
+
+namespace {
+
+// Async requests default to this instead of the 25 s D-Bus default
+constexpr int DEFAULT_TIMEOUT_MS = 5000;
+
+// The callback is kept on the main thread; the request may come from a
+// coroutine that is suspended by the time the reply arrives
+GattCompletion lua_completion(
+    const char *name, sol::table &opts, const std::string &dev_id, const std::string &char_path
+) {
+  if (opts["callback"].get_type() != sol::type::function) {
+    throw sol::error(std::string("gatt.") + name + ": callback required");
+  }
+  sol::main_protected_function callback = opts.get<sol::main_protected_function>("callback");
+
+  return [name, callback, dev_id, char_path](const GattResult &r) {
+    sol::state_view lua(AelkeyState::instance().lua_vm);
+
+    sol::table tbl = lua.create_table();
+    tbl["id"] = r.id;
+    tbl["device"] = dev_id;
+    tbl["path"] = char_path;
+    tbl["status"] = r.status;
+    if (!r.error.empty()) {
+      tbl["error"] = r.error;
+    }
+    if (r.status == "ok") {
+      const auto *bytes = reinterpret_cast<const char *>(r.data.data());
+      tbl["data"] = std::string_view(bytes, r.data.size());
+      tbl["size"] = static_cast<int>(r.data.size());
+    }
+
+    CallbackTimer timer(std::string("gatt.") + name);
+    sol::protected_function_result res = callback(tbl);
+    if (!res.valid()) {
+      sol::error err = res;
+      std::fprintf(stderr, "Lua gatt.%s callback error: %s\n", name, err.what());
+    }
+  };
+}
+
+sol::object request_id(sol::state_view &lua, uint64_t id) {
+  if (id == 0) {
+    return sol::make_object(lua, sol::lua_nil);
+  }
+  return sol::make_object(lua, id);
+}
+
+}  // namespace
 
 // gatt.read{ device="id", service=0x0021, characteristic=0x0036 }
 // Returns raw data string
@@ -26,7 +80,8 @@ sol::object gatt_read(sol::this_state ts, sol::table opts) {
   auto &gatt = DeviceBackendGATT::instance();
   std::string char_path = gatt.resolve_char_path(dev_id, service, characteristic);
 
-  std::vector<uint8_t> data;
+  // Reused; Lua copies the value into its string once
+  static std::vector<uint8_t> data;
   bool ok = gatt.read_characteristic(char_path, data);
 
   if (!ok) {
@@ -34,11 +89,12 @@ sol::object gatt_read(sol::this_state ts, sol::table opts) {
   }
 
   return sol::make_object(
-      lua, std::string(reinterpret_cast<const char *>(data.data()), data.size())
+      lua, std::string_view(reinterpret_cast<const char *>(data.data()), data.size())
   );
 }
 
-// gatt.write{ device="id", data="...", response=true, service=0x0021, characteristic=0x0036 }
+// gatt.write{ device="id", data="...", response=true, coalesce=false,
+//             service=0x0021, characteristic=0x0036 }
 // Returns boolean success
 sol::object gatt_write(sol::this_state ts, sol::table opts) {
   lua_State *L = ts;
@@ -47,12 +103,15 @@ sol::object gatt_write(sol::this_state ts, sol::table opts) {
   // device (required)
   std::string dev_id = opts.get<std::string>("device");
 
-  // data (required)
-  std::string bytes = opts.get<std::string>("data");
+  // data (required); viewed in the Lua string, which opts keeps alive
+  std::string_view bytes = opts.get<std::string_view>("data");
 
   // response (optional)
   bool with_resp = opts.get_or("response", false);
 
+  // coalesce (optional): a newer write replaces one still queued
+  bool coalesce = opts.get_or("coalesce", false);
+
   // service (optional)
   int service = opts.get_or("service", -1);
 
@@ -63,12 +122,70 @@ sol::object gatt_write(sol::this_state ts, sol::table opts) {
   std::string char_path = gatt.resolve_char_path(dev_id, service, characteristic);
 
   bool ok = gatt.write_characteristic(
-      char_path, reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(), with_resp
+      char_path,
+      reinterpret_cast<const uint8_t *>(bytes.data()),
+      bytes.size(),
+      with_resp,
+      coalesce
   );
 
   return sol::make_object(lua, ok);
 }
 
+// gatt.read_async{ device="id", service=0x0021, characteristic=0x0036,
+//                  timeout=5000, callback=function(result) ... end }
+// Returns the request id, nil if it could not be sent. Without callback,
+// inside a coroutine: suspends it and returns the result (aelkey_gatt.lua)
+sol::object gatt_read_async(sol::this_state ts, sol::table opts) {
+  sol::state_view lua(ts);
+
+  std::string dev_id = opts.get<std::string>("device");
+  int service = opts.get_or("service", -1);
+  int characteristic = opts.get_or("characteristic", -1);
+  int timeout = opts.get_or("timeout", DEFAULT_TIMEOUT_MS);
+
+  auto &gatt = DeviceBackendGATT::instance();
+  std::string char_path = gatt.resolve_char_path(dev_id, service, characteristic);
+  GattCompletion done = lua_completion("read_async", opts, dev_id, char_path);
+
+  return request_id(lua, gatt.read_async(char_path, timeout, std::move(done)));
+}
+
+// gatt.write_async{ device="id", data="...", response=false,
+//                   service=0x0021, characteristic=0x0036,
+//                   timeout=5000, callback=function(result) ... end }
+// Always a WriteValue call; the callback runs once BlueZ has taken the
+// value (or acknowledged it, with response)
+sol::object gatt_write_async(sol::this_state ts, sol::table opts) {
+  sol::state_view lua(ts);
+
+  std::string dev_id = opts.get<std::string>("device");
+  std::string_view bytes = opts.get<std::string_view>("data");
+  bool with_resp = opts.get_or("response", false);
+  int service = opts.get_or("service", -1);
+  int characteristic = opts.get_or("characteristic", -1);
+  int timeout = opts.get_or("timeout", DEFAULT_TIMEOUT_MS);
+
+  auto &gatt = DeviceBackendGATT::instance();
+  std::string char_path = gatt.resolve_char_path(dev_id, service, characteristic);
+  GattCompletion done = lua_completion("write_async", opts, dev_id, char_path);
+
+  uint64_t id = gatt.write_async(
+      char_path,
+      reinterpret_cast<const uint8_t *>(bytes.data()),
+      bytes.size(),
+      with_resp,
+      timeout,
+      std::move(done)
+  );
+  return request_id(lua, id);
+}
+
+// gatt.cancel(id): the callback of a request in flight is not called
+bool gatt_cancel(uint64_t id) {
+  return DeviceBackendGATT::instance().cancel(id);
+}
+
 extern "C" int luaopen_aelkey_gatt(lua_State *L) {
   sol::state_view lua(L);
 
@@ -76,6 +193,25 @@ extern "C" int luaopen_aelkey_gatt(lua_State *L) {
 
   mod.set_function("read", gatt_read);
   mod.set_function("write", gatt_write);
+  mod.set_function("read_async", gatt_read_async);
+  mod.set_function("write_async", gatt_write_async);
+  mod.set_function("cancel", gatt_cancel);
+
+  // Load script
+  sol::load_result chunk = lua.load(aelkey_gatt_script);
+  if (!chunk.valid()) {
+    throw sol::error(
+        "aelkey.gatt script load error: " + std::string(chunk.get<sol::error>().what())
+    );
+  }
+
+  // Execute script with module table
+  sol::protected_function_result result = chunk(mod);
+  if (!result.valid()) {
+    throw sol::error(
+        "aelkey.gatt script runtime error: " + std::string(result.get<sol::error>().what())
+    );
+  }
 
   return sol::stack::push(L, mod);
 }
@@ -0,0 +1,55 @@
+local M = ...
+
+-- Request id → completion of a suspended coroutine. Weak: once a request
+-- is dropped without completing (the loop ended), C++ no longer holds the
+-- completion and the coroutine is collected.
+local waiting = setmetatable({}, { __mode = "v" })
+
+-- Without a callback, read_async/write_async suspend the calling
+-- coroutine and return the result table once the request completes
+local function awaitable(request)
+  return function(opts)
+    if opts.callback ~= nil then
+      return request(opts)
+    end
+
+    local co, main = coroutine.running()
+    if co == nil or main then
+      error("callback required outside a coroutine", 2)
+    end
+
+    local args = {}
+    for k, v in pairs(opts) do
+      args[k] = v
+    end
+    args.callback = function(result)
+      waiting[result.id] = nil
+      result.device = result.device or opts.device
+      local ok, err = coroutine.resume(co, result)
+      if not ok then
+        io.stderr:write("aelkey.gatt: coroutine error: " .. tostring(err) .. "\n")
+      end
+    end
+
+    local id = request(args)
+    if id == nil then
+      return { device = opts.device, status = "error", error = "request not sent" }
+    end
+    waiting[id] = args.callback
+    return coroutine.yield()
+  end
+end
+
+M.read_async = awaitable(M.read_async)
+M.write_async = awaitable(M.write_async)
+
+-- A coroutine waiting on the request returns { status = "cancelled" }
+local cancel = M.cancel
+M.cancel = function(id)
+  local cancelled = cancel(id)
+  local resume = waiting[id]
+  if cancelled and resume ~= nil then
+    resume({ id = id, status = "cancelled" })
+  end
+  return cancelled
+end
@@ -1,13 +1,18 @@
 #include "aelkey_core.h"
 
+#include <algorithm>
 #include <csignal>
+#include <cstdio>
 #include <cstring>
+#include <iostream>
 #include <string>
 #include <string_view>
+#include <thread>
 
 #include <libevdev/libevdev-uinput.h>
 #include <libudev.h>
 #include <libusb-1.0/libusb.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
@@ -16,11 +21,27 @@
 
 #include "aelkey_device.h"
 #include "aelkey_state.h"
+#include "callback_stats.h"
+#include "device_backend_gatt.h"
 #include "device_declarations.h"
 #include "device_manager.h"
 #include "dispatcher.h"
+#include "dispatcher_control.h"
 #include "dispatcher_udev.h"
+#include "input_log.h"
+#include "io_pool.h"
+#include "latency_stats.h"
+#include "loop_gc.h"
+#include "loop_options.h"
+#include "loop_realtime.h"
+#include "lua_pool.h"
+#include "replay_driver.h"
+#include "tick_scheduler.h"
+#include "trace.h"
+#include "uring_loop.h"
+#include "util/clock.h"
 #include "util/scoped_timer.h"
+#include "util/worker_thread.h"
 
 sol::object loop_stop(sol::this_state ts) {
   sol::state_view lua(ts);
@@ -29,37 +50,265 @@ sol::object loop_stop(sol::this_state ts) {
   return sol::make_object(lua, sol::nil);
 }
 
+static void handle_trace_signal(int) {
+  AelkeyState::instance().trace_dump_requested = 1;
+}
+
 void handle_signal(int sig) {
   auto &state = AelkeyState::instance();
   state.loop_should_stop = true;
   state.sigint = sig;
 }
 
-sol::object loop_start(sol::this_state ts) {
+// Name of the native tick printing latency histograms
+static constexpr const char *LATENCY_DUMP_TICK = "aelkey.latency_dump";
+
+static LoopOptions parse_loop_options(const sol::optional<sol::table> &opts) {
+  LoopOptions options;
+  if (!opts) {
+    return options;
+  }
+
+  options.io_threads = std::max(0, opts->get_or("io_threads", 0));
+  options.io_uring = opts->get_or("io_uring", false);
+  options.busy_poll_ms = std::max(0, opts->get_or("busy_poll", 0));
+  options.latency_dump = std::max(0, opts->get_or("latency_dump", 0));
+  options.latency = opts->get_or("latency", false) || options.latency_dump > 0;
+  options.callback_budget_us = std::max(0, opts->get_or("callback_budget", 0));
+
+  // trace = true | <capacity>
+  sol::object trace = opts->get<sol::object>("trace");
+  if (trace.is<bool>()) {
+    options.trace = trace.as<bool>();
+  } else if (trace.is<int>()) {
+    options.trace = true;
+    options.trace_capacity = static_cast<size_t>(std::max(2, trace.as<int>()));
+  }
+  options.trace_file = opts->get_or("trace_file", options.trace_file);
+  options.control_socket = opts->get_or("control_socket", options.control_socket);
+  options.allocator = opts->get_or("allocator", options.allocator);
+  options.record = opts->get_or("record", options.record);
+  options.replay = opts->get_or("replay", options.replay);
+  options.replay_speed = std::max(0.0, opts->get_or("replay_speed", options.replay_speed));
+  options.replay_stop = opts->get_or("replay_stop", options.replay_stop);
+
+  sol::optional<sol::table> rt = opts->get<sol::optional<sol::table>>("realtime");
+  if (rt) {
+    options.realtime.enabled = true;
+    options.realtime.priority = rt->get_or("priority", 0);
+    options.realtime.cpu = rt->get_or("cpu", -1);
+    options.realtime.lock_memory = rt->get_or("lock_memory", false);
+  }
+
+  // gc = true | { mode, step, pause, stepmul, idle_budget, auto }
+  sol::object gc = opts->get<sol::object>("gc");
+  if (gc.is<bool>()) {
+    options.gc.enabled = gc.as<bool>();
+  } else if (gc.is<sol::table>()) {
+    sol::table t = gc.as<sol::table>();
+    options.gc.enabled = true;
+    options.gc.mode = t.get_or("mode", std::string{});
+    options.gc.step_kb = std::max(0, t.get_or("step", 0));
+    options.gc.pause = std::max(0, t.get_or("pause", 0));
+    options.gc.stepmul = std::max(0, t.get_or("stepmul", 0));
+    options.gc.idle_budget_us = std::max(0, t.get_or("idle_budget", options.gc.idle_budget_us));
+    options.gc.automatic = t.get_or("auto", true);
+  }
+
+  return options;
+}
+
+// Dispatch ready epoll events; timeout_ms as for epoll_wait().
+// Returns the number of events; *input is set when one of them came
+// from an input device.
+static int dispatch_epoll(int epfd, int timeout_ms, bool *input = nullptr) {
+  constexpr int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+
+  int n = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+
+  for (int i = 0; i < n; ++i) {
+    auto *payload = static_cast<EpollPayload *>(events[i].data.ptr);
+    if (payload->dead) {
+      continue;
+    }
+    TRACE_SCOPE(TraceCategory::Loop, payload->dispatcher->type(), "");
+    if (input && payload->dispatcher->input_source()) {
+      *input = true;
+    }
+    payload->dispatcher->handle_event(payload, events[i].events);
+  }
+
+  return n;
+}
+
+sol::object loop_start(sol::this_state ts, sol::optional<sol::table> opts) {
   sol::state_view lua(ts);
 
+  auto &state = AelkeyState::instance();
+  state.loop_options = parse_loop_options(opts);
+
+  // Pool allocator for the Lua state; stays installed after the loop ends
+  if (state.loop_options.allocator == "pool") {
+    if (!LuaPool::install(ts)) {
+      std::fprintf(stderr, "aelkey: pool allocator unavailable, using the default\n");
+    }
+  } else if (!state.loop_options.allocator.empty()) {
+    std::fprintf(
+        stderr, "aelkey: unknown allocator '%s'\n", state.loop_options.allocator.c_str()
+    );
+  }
+
+  // I/O threads must exist before devices are opened
+  if (state.loop_options.io_threads > 0) {
+    if (!IoPool::instance().start(state.loop_options.io_threads)) {
+      std::fprintf(stderr, "aelkey: I/O threads unavailable, reading on the loop thread\n");
+    }
+  }
+
+  // io_uring likewise; without kernel support the loop stays on epoll
+  auto &uring = UringLoop::instance();
+  if (state.loop_options.io_uring && !uring.setup(state.epfd)) {
+    std::fprintf(stderr, "aelkey: io_uring unavailable, using epoll\n");
+  }
+
   // signal handlers
   std::signal(SIGHUP, handle_signal);   // terminal hangup
   std::signal(SIGINT, handle_signal);   // interactive interrupt (Ctrl+C)
   std::signal(SIGTERM, handle_signal);  // termination request (kill, systemd stop)
 
-  // open inputs and outputs tables (open all devices)
-  device_open(ts, sol::optional<std::string>{});  // equivalent to old lua_open_device(L)
+  // Input log; started first so the initial "add" state changes are in it
+  if (!state.loop_options.record.empty() && InputLog::start(state.loop_options.record)) {
+    std::cout << "aelkey: recording input to " << state.loop_options.record << std::endl;
+  }
 
-  // Blocking epoll loop
-  constexpr int MAX_EVENTS = 64;
-  struct epoll_event events[MAX_EVENTS];
+  auto &replay = ReplayDriver::instance();
+  if (!state.loop_options.replay.empty()) {
+    // outputs as usual, inputs come from the log
+    state.parse_outputs_from_lua(ts);
+    state.parse_inputs_from_lua(ts);
+    state.create_outputs_from_decls();
+    if (!replay.start(
+            state.loop_options.replay,
+            state.loop_options.replay_speed,
+            state.loop_options.replay_stop
+        )) {
+      std::fprintf(stderr, "aelkey: replay of %s failed\n", state.loop_options.replay.c_str());
+      state.loop_should_stop = true;
+    }
+  } else {
+    // open inputs and outputs tables (open all devices)
+    device_open(ts, sol::optional<std::string>{});  // equivalent to old lua_open_device(L)
+  }
 
-  auto &state = AelkeyState::instance();
+  // Trace ring; SIGUSR2 dumps it to trace_file
+  if (state.loop_options.trace) {
+    if (state.loop_options.trace_file.empty()) {
+      state.loop_options.trace_file = "/tmp/aelkey-trace-" + std::to_string(getpid()) + ".json";
+    }
+    Trace::start(state.loop_options.trace_capacity);
+    std::signal(SIGUSR2, handle_trace_signal);
+  }
+
+  // Counters and commands for external tools
+  auto &control = DispatcherControl::instance();
+  if (!state.loop_options.control_socket.empty()) {
+    control.start(state.loop_options.control_socket);
+  }
+
+  // Callback budget watchdog
+  CallbackStats::instance().set_budget_ns(
+      static_cast<uint64_t>(state.loop_options.callback_budget_us) * 1000ULL
+  );
+
+  // Latency histograms
+  auto &latency = LatencyStats::instance();
+  latency.set_enabled(state.loop_options.latency);
+  if (state.loop_options.latency_dump > 0) {
+    TickCb dump{};
+    dump.name = LATENCY_DUMP_TICK;
+    dump.native = [] { LatencyStats::instance().dump(); };
+    TickScheduler::instance().schedule(state.loop_options.latency_dump * 1000, dump);
+  }
+
+  // Scheduling policy, affinity, and locked memory for the loop thread;
+  // undone when this function returns
+  LoopRealtime realtime;
+  realtime.apply(state.loop_options.realtime, ts);
+
+  // Lua collector steps while the loop is idle
+  state.loop_stats.gc = {};
+  LoopGc gc;
+  gc.apply(state.loop_options.gc, ts);
+  auto input_pending = [&state, &uring] {
+    struct pollfd pfd{ state.epfd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0 || (uring.active() && uring.has_completions());
+  };
+
+  // Adaptive busy-poll (epoll only)
+  state.loop_stats.busy_poll = {};
+  uint64_t busy_window_ns = static_cast<uint64_t>(state.loop_options.busy_poll_ms) * 1000000ULL;
+  uint64_t spin_until = 0;
+
+  // Blocking event loop
   while (!state.loop_should_stop) {
-    int n = epoll_wait(state.epfd, events, MAX_EVENTS, -1);  // block until event
+    if (uring.active()) {
+      gc.idle(input_pending);
 
-    for (int i = 0; i < n; ++i) {
-      auto *payload = static_cast<EpollPayload *>(events[i].data.ptr);
-      if (payload->dead) {
-        continue;
+      // device reads and ticks complete on the ring; the rest is on epoll
+      if (uring.run_once()) {
+        dispatch_epoll(state.epfd, 0);
       }
-      payload->dispatcher->handle_event(payload, events[i].events);
+      LuaPool::end_frame();
+      gc.activity();
+    } else if (busy_window_ns > 0 && monotonic_ns() < spin_until) {
+      // recent activity: poll without blocking to skip the wakeup latency
+      auto &bp = state.loop_stats.busy_poll;
+      uint64_t t0 = monotonic_ns();
+      uint64_t cpu0 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+      bool input = false;
+      int n = dispatch_epoll(state.epfd, 0, &input);
+      uint64_t t1 = monotonic_ns();
+
+      ++bp.spin_polls;
+      if (n > 0) {
+        ++bp.spin_hits;
+        // only input keeps spinning; ticks alone would never let it block
+        if (input) {
+          spin_until = t1 + busy_window_ns;
+        }
+        LuaPool::end_frame();
+        gc.activity();
+      } else {
+        bp.spin_idle_ns += t1 - t0;
+        bp.spin_cpu_ns += clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu0;
+      }
+    } else {
+      gc.idle(input_pending);
+
+      bool input = false;
+      int n = dispatch_epoll(state.epfd, -1, &input);  // block until event
+      ++state.loop_stats.busy_poll.blocking_waits;
+      if (n > 0) {
+        LuaPool::end_frame();
+        gc.activity();
+      }
+
+      if (input && busy_window_ns > 0) {
+        spin_until = monotonic_ns() + busy_window_ns;
+      }
+    }
+
+    if (state.trace_dump_requested) {
+      state.trace_dump_requested = 0;
+
+      // snapshot here, write the file off the loop thread
+      std::thread([file = state.loop_options.trace_file, events = Trace::snapshot()] {
+        worker_thread_defaults();
+        if (Trace::write(file, events)) {
+          std::cout << "aelkey: trace written to " << file << std::endl;
+        }
+      }).detach();
     }
 
     // for (auto &[type, dispatcher] : dispatcher_registry()) {
@@ -69,6 +318,10 @@ sol::object loop_start(sol::this_state ts) {
 
   // Cleanup all resources
 
+  // Replayed devices were never attached
+  replay.stop();
+  InputLog::stop();
+
   // Detach all devices
   std::vector<std::string> ids;
   ids.reserve(state.input_map.size());
@@ -81,6 +334,30 @@ sol::object loop_start(sol::this_state ts) {
     DeviceManager::instance().detach(id);
   }
 
+  // GATT requests still in flight would complete without a loop
+  DeviceBackendGATT::instance().cancel_all();
+
+  if (state.loop_options.latency_dump > 0) {
+    TickCb dump{};
+    dump.name = LATENCY_DUMP_TICK;
+    TickScheduler::instance().cancel_matching(dump);
+  }
+  latency.set_enabled(false);
+
+  control.stop();
+
+  if (state.loop_options.trace) {
+    std::signal(SIGUSR2, SIG_DFL);
+    Trace::stop();
+  }
+
+  // Join I/O threads once no device is left on them
+  IoPool::instance().stop();
+  uring.teardown();
+  TickScheduler::instance().move_uring_timers();
+  realtime.restore();
+  gc.restore();
+
   // Destroy uinput devices
   for (auto &kv : state.uinput_devices) {
     libevdev_uinput_destroy(kv.second);
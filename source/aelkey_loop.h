@@ -2,5 +2,5 @@
 
 #include <sol/sol.hpp>
 
-sol::object loop_start(sol::this_state ts);
+sol::object loop_start(sol::this_state ts, sol::optional<sol::table> opts);
 sol::object loop_stop(sol::this_state ts);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <csignal>
 #include <map>
 #include <string>
 #include <vector>
@@ -9,6 +10,8 @@
 #include <sol/sol.hpp>
 
 #include "device_declarations.h"
+#include "loop_options.h"
+#include "loop_stats.h"
 #include "singleton.h"
 
 class AelkeyState : public Singleton<AelkeyState> {
@@ -43,8 +46,11 @@ class AelkeyState : public Singleton<AelkeyState> {
   std::map<std::string, InputDecl> input_map;
   std::map<std::string, std::vector<struct input_event>> frames;
 
+  LoopOptions loop_options;
+  LoopStats loop_stats;
   bool loop_should_stop = false;
   int sigint = 0;
+  volatile std::sig_atomic_t trace_dump_requested = 0;
 
   std::vector<InputDecl> input_decls;
   std::vector<OutputDecl> output_decls;
@@ -0,0 +1,212 @@
+#include "aelkey_stats.h"
+
+#include <algorithm>
+#include <string>
+
+#include <sol/sol.hpp>
+#include <unistd.h>
+
+#include "aelkey_state.h"
+#include "callback_stats.h"
+#include "latency_stats.h"
+#include "lua_pool.h"
+#include "trace.h"
+
+// busy_poll() → { window_ms, spin_polls, spin_hits, spin_idle_ms, blocking_waits, cpu_ms }
+sol::object stats_busy_poll(sol::this_state ts) {
+  sol::state_view lua(ts);
+  auto &state = AelkeyState::instance();
+  const auto &bp = state.loop_stats.busy_poll;
+
+  sol::table t = lua.create_table();
+  t["window_ms"] = state.loop_options.busy_poll_ms;
+  t["spin_polls"] = bp.spin_polls;
+  t["spin_hits"] = bp.spin_hits;
+  t["spin_idle_ms"] = static_cast<double>(bp.spin_idle_ns) / 1e6;
+  t["blocking_waits"] = bp.blocking_waits;
+  t["cpu_ms"] = static_cast<double>(bp.spin_cpu_ns) / 1e6;
+
+  return t;
+}
+
+static sol::table histogram_table(sol::state_view lua, const LatencyHistogram &h) {
+  auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+
+  sol::table t = lua.create_table();
+  t["count"] = h.count();
+  t["min"] = us(h.min());
+  t["mean"] = h.mean() / 1000.0;
+  t["p50"] = us(h.percentile(50));
+  t["p90"] = us(h.percentile(90));
+  t["p99"] = us(h.percentile(99));
+  t["p999"] = us(h.percentile(99.9));
+  t["max"] = us(h.max());
+  return t;
+}
+
+static sol::table device_latency_table(sol::state_view lua, const DeviceLatency &lat) {
+  sol::table t = lua.create_table();
+  t["queue"] = histogram_table(lua, lat.queue);
+  t["callback"] = histogram_table(lua, lat.callback);
+  t["output"] = histogram_table(lua, lat.output);
+  return t;
+}
+
+// latency([device]) → { queue = {...}, callback = {...}, output = {...} }
+// Without a device: { [device] = {...}, ... }. Values in microseconds.
+sol::object stats_latency(sol::this_state ts, sol::optional<std::string> device) {
+  sol::state_view lua(ts);
+  auto &stats = LatencyStats::instance();
+
+  if (device) {
+    const DeviceLatency *lat = stats.find(*device);
+    if (!lat) {
+      return sol::make_object(lua, sol::lua_nil);
+    }
+    return device_latency_table(lua, *lat);
+  }
+
+  sol::table all = lua.create_table();
+  for (const auto &[id, lat] : stats.devices()) {
+    all[id] = device_latency_table(lua, lat);
+  }
+  return all;
+}
+
+void stats_latency_reset() {
+  LatencyStats::instance().reset();
+}
+
+static sol::table callback_table(sol::state_view lua, const CallbackTiming &t) {
+  auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+
+  sol::table tbl = lua.create_table();
+  tbl["count"] = t.count;
+  tbl["total_ms"] = static_cast<double>(t.total_ns) / 1e6;
+  tbl["mean"] = t.histogram.mean() / 1000.0;
+  tbl["p99"] = us(t.histogram.percentile(99));
+  tbl["max"] = us(t.max_ns);
+  tbl["over_budget"] = t.over_budget;
+  return tbl;
+}
+
+// callbacks([name]) → { count, total_ms, mean, p99, max, over_budget }
+// Without a name: { [name] = {...}, ... }. Times in microseconds.
+sol::object stats_callbacks(sol::this_state ts, sol::optional<std::string> name) {
+  sol::state_view lua(ts);
+  const auto &callbacks = CallbackStats::instance().callbacks();
+
+  if (name) {
+    auto it = callbacks.find(*name);
+    if (it == callbacks.end()) {
+      return sol::make_object(lua, sol::lua_nil);
+    }
+    return callback_table(lua, it->second);
+  }
+
+  sol::table all = lua.create_table();
+  for (const auto &[cb_name, t] : callbacks) {
+    all[cb_name] = callback_table(lua, t);
+  }
+  return all;
+}
+
+void stats_callbacks_reset() {
+  CallbackStats::instance().reset();
+}
+
+// gc() → { memory_kb, idle_steps, forced_steps, cycles, total_ms, pause = {...} }
+// Step pauses in microseconds.
+sol::object stats_gc(sol::this_state ts) {
+  sol::state_view lua(ts);
+  const auto &gc = AelkeyState::instance().loop_stats.gc;
+
+  sol::table t = lua.create_table();
+  t["memory_kb"] = lua_gc(ts, LUA_GCCOUNT, 0);
+  t["idle_steps"] = gc.idle_steps;
+  t["forced_steps"] = gc.forced_steps;
+  t["cycles"] = gc.cycles;
+  t["total_ms"] = static_cast<double>(gc.total_ns) / 1e6;
+  t["pause"] = histogram_table(lua, gc.pause);
+  return t;
+}
+
+// alloc() → { allocs, frees, reallocs, pool_allocs, fallback_allocs, bytes,
+//            pool_kb, allocs_per_frame = {...}, bytes_per_frame = {...} }
+// nil unless aelkey.start{ allocator = "pool" } installed the pool.
+sol::object stats_alloc(sol::this_state ts) {
+  sol::state_view lua(ts);
+  const LuaPoolStats *s = LuaPool::stats();
+  if (!s) {
+    return sol::make_object(lua, sol::lua_nil);
+  }
+
+  auto counts = [&lua](const LatencyHistogram &h) {
+    sol::table t = lua.create_table();
+    t["count"] = h.count();
+    t["mean"] = h.mean();
+    t["p50"] = h.percentile(50);
+    t["p99"] = h.percentile(99);
+    t["max"] = h.max();
+    return t;
+  };
+
+  sol::table t = lua.create_table();
+  t["allocs"] = s->allocs;
+  t["frees"] = s->frees;
+  t["reallocs"] = s->reallocs;
+  t["pool_allocs"] = s->pool_allocs;
+  t["fallback_allocs"] = s->fallback_allocs;
+  t["bytes"] = s->bytes_allocated;
+  t["pool_kb"] = s->pool_bytes / 1024;
+  t["allocs_per_frame"] = counts(s->allocs_per_frame);
+  t["bytes_per_frame"] = counts(s->bytes_per_frame);
+  return t;
+}
+
+// dump() → print callback and latency summaries to stdout
+void stats_dump() {
+  CallbackStats::instance().dump();
+  LatencyStats::instance().dump();
+}
+
+// trace_start([capacity])
+void stats_trace_start(sol::optional<int> capacity) {
+  Trace::start(
+      capacity ? static_cast<size_t>(std::max(2, *capacity)) : Trace::kDefaultCapacity
+  );
+}
+
+void stats_trace_stop() {
+  Trace::stop();
+}
+
+// trace_dump([path]) → true on success
+bool stats_trace_dump(sol::optional<std::string> path) {
+  auto &state = AelkeyState::instance();
+  std::string file = path.value_or(state.loop_options.trace_file);
+  if (file.empty()) {
+    file = "/tmp/aelkey-trace-" + std::to_string(getpid()) + ".json";
+  }
+  return Trace::dump(file);
+}
+
+extern "C" int luaopen_aelkey_stats(lua_State *L) {
+  sol::state_view lua(L);
+
+  sol::table mod = lua.create_table();
+
+  mod.set_function("busy_poll", stats_busy_poll);
+  mod.set_function("latency", stats_latency);
+  mod.set_function("latency_reset", stats_latency_reset);
+  mod.set_function("callbacks", stats_callbacks);
+  mod.set_function("callbacks_reset", stats_callbacks_reset);
+  mod.set_function("gc", stats_gc);
+  mod.set_function("alloc", stats_alloc);
+  mod.set_function("dump", stats_dump);
+  mod.set_function("trace_start", stats_trace_start);
+  mod.set_function("trace_stop", stats_trace_stop);
+  mod.set_function("trace_dump", stats_trace_dump);
+
+  return sol::stack::push(L, mod);
+}
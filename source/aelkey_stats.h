@@ -0,0 +1,5 @@
+#pragma once
+
+#include <lua.hpp>
+
+extern "C" int luaopen_aelkey_stats(lua_State *L);
@@ -1,7 +1,10 @@
 #include "aelkey_usb.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <map>
+#include <memory>
 #include <string_view>
 #include <vector>
 
@@ -10,9 +13,46 @@
 
 #include "aelkey_hid.h"
 #include "aelkey_state.h"
+#include "callback_stats.h"
 #include "device_backend_libusb.h"
 #include "device_manager.h"
 #include "dispatcher_udev.h"
+#include "input_log.h"
+#include "io_pool.h"
+#include "trace.h"
+
+struct UsbStream;
+
+// transfer->user_data
+struct UsbTransferCtx {
+  std::string device;
+  lua_State *L = nullptr;
+  UsbStream *stream = nullptr;  // owner, for usb.stream transfers
+};
+
+// usb.stream{}: `depth` transfers kept queued on one IN endpoint. The
+// transfers and one buffer for all of them are allocated up front and
+// reused until the stream ends. Completions may be counted on the libusb
+// event thread (see IoPool); the rest is loop thread only.
+struct UsbStream {
+  uint64_t id = 0;
+  std::string device;
+  libusb_device_handle *handle = nullptr;
+  std::vector<libusb_transfer *> transfers;
+  std::vector<uint8_t> buffers;  // depth * size
+  std::vector<uint8_t> data;     // completed payload, so the transfer is queued again first
+  std::vector<libusb_iso_packet_descriptor> packets;  // of data, isochronous streams
+
+  std::atomic<int> in_flight{ 0 };
+  std::atomic<bool> stopping{ false };
+  std::atomic<uint64_t> completed{ 0 };
+  std::atomic<uint64_t> overruns{ 0 };  // completions that left nothing queued
+  size_t released = 0;                  // transfers back for good
+  bool detached = false;                // device detached: stop() and stats() are no-ops
+};
+
+static std::map<uint64_t, std::unique_ptr<UsbStream>> usb_streams;
+static uint64_t next_stream_id = 1;
 
 // Map libusb_transfer_type enum → string
 static const char *transfer_type_to_string(uint8_t type) {
@@ -63,57 +103,249 @@ static void destroy_transfer(libusb_transfer *t) {
   }
 
   if (t->user_data) {
-    delete static_cast<std::pair<InputDecl *, lua_State *> *>(t->user_data);
+    delete static_cast<UsbTransferCtx *>(t->user_data);
     t->user_data = nullptr;
   }
 
   libusb_free_transfer(t);
 }
 
-// libusb async callback → Lua
-static void LIBUSB_CALL dispatch_libusb(libusb_transfer *transfer) {
-  if (!transfer || !transfer->user_data) {
+// Detach a device whose transfer reported it gone
+static void detach_usb_device(const std::string &id) {
+  auto removed = DeviceManager::instance().detach(id);
+  if (removed && !removed->id.empty()) {
+    DispatcherUdev::instance().notify_state_change(*removed, "remove");
+  }
+}
+
+// Statuses after which the endpoint is worth re-arming
+static bool transfer_is_transient(libusb_transfer_status status) {
+  return status == LIBUSB_TRANSFER_COMPLETED || status == LIBUSB_TRANSFER_OVERFLOW ||
+         status == LIBUSB_TRANSFER_TIMED_OUT;
+}
+
+// Bytes per isochronous packet: as requested, else the endpoint's
+// maximum (including additional transactions per microframe). Negative
+// on error.
+static int iso_packet_size(libusb_device_handle *handle, int endpoint, int requested) {
+  if (requested > 0) {
+    return requested;
+  }
+  return libusb_get_max_iso_packet_size(
+      libusb_get_device(handle), static_cast<unsigned char>(endpoint)
+  );
+}
+
+// Free a stream once none of its transfers is queued or awaiting delivery
+static void retire_stream(UsbStream *stream) {
+  for (libusb_transfer *t : stream->transfers) {
+    delete static_cast<UsbTransferCtx *>(t->user_data);
+    libusb_free_transfer(t);  // buffer belongs to the stream
+  }
+  stream->transfers.clear();
+
+  libusb_device_handle *handle = stream->handle;
+  bool detached = stream->detached;
+  usb_streams.erase(stream->id);
+
+  if (detached) {
+    DeviceBackendLibUSB::instance().stream_retired(handle);  // may close the handle
+  }
+}
+
+static void stop_stream(UsbStream *stream) {
+  stream->stopping = true;
+  for (libusb_transfer *t : stream->transfers) {
+    libusb_cancel_transfer(t);  // LIBUSB_ERROR_NOT_FOUND for those already back
+  }
+}
+
+size_t usb_detach_streams(const std::string &device) {
+  size_t pending = 0;
+  for (auto &[_, stream] : usb_streams) {
+    if (stream->device == device && !stream->detached) {
+      stream->detached = true;
+      stop_stream(stream.get());
+      ++pending;
+    }
+  }
+  return pending;
+}
+
+// A stream transfer that will not be queued again
+static void release_stream_transfer(UsbStream *stream, libusb_transfer_status status) {
+  if (status == LIBUSB_TRANSFER_NO_DEVICE && !stream->stopping) {
+    stop_stream(stream);
+    detach_usb_device(stream->device);
+  }
+  if (++stream->released == stream->transfers.size()) {
+    retire_stream(stream);
+  }
+}
+
+// On whichever thread runs libusb events
+static void count_stream_completion(UsbStream *stream) {
+  stream->completed.fetch_add(1, std::memory_order_relaxed);
+  if (stream->in_flight.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    // the endpoint is unarmed until this transfer is queued again
+    stream->overruns.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool usb_resubmit_transfer(libusb_transfer *transfer) {
+  auto *ctx = static_cast<UsbTransferCtx *>(transfer->user_data);
+  UsbStream *stream = ctx ? ctx->stream : nullptr;
+  if (!stream) {
+    return libusb_submit_transfer(transfer) == 0;
+  }
+  if (stream->stopping) {
+    return false;
+  }
+
+  // counted first: the transfer may complete before submit returns
+  stream->in_flight.fetch_add(1, std::memory_order_acq_rel);
+  if (libusb_submit_transfer(transfer) != 0) {
+    stream->in_flight.fetch_sub(1, std::memory_order_acq_rel);
+    return false;
+  }
+
+  // stop_stream() may have run between the check and the submit, and
+  // found nothing to cancel; it comes back as LIBUSB_TRANSFER_CANCELLED
+  if (stream->stopping) {
+    libusb_cancel_transfer(transfer);
+  }
+  return true;
+}
+
+void usb_copy_transfer(
+    const libusb_transfer *transfer,
+    std::vector<uint8_t> &data,
+    std::vector<libusb_iso_packet_descriptor> &packets
+) {
+  packets.clear();
+  if (transfer->type != LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+    data.assign(transfer->buffer, transfer->buffer + std::max(transfer->actual_length, 0));
     return;
   }
 
-  auto *ud = static_cast<std::pair<InputDecl *, lua_State *> *>(transfer->user_data);
-  if (!ud) {
-    destroy_transfer(transfer);
+  // actual_length is not set for isochronous transfers; each packet has
+  // its own slot of `length` bytes in the buffer
+  data.clear();
+  const uint8_t *slot = transfer->buffer;
+  for (int i = 0; i < transfer->num_iso_packets; ++i) {
+    const libusb_iso_packet_descriptor &desc = transfer->iso_packet_desc[i];
+    unsigned int received = std::min(desc.actual_length, desc.length);
+    data.insert(data.end(), slot, slot + received);
+    packets.push_back({ desc.length, received, desc.status });
+    slot += desc.length;
+  }
+}
+
+// Completed transfer → Lua. `data` may be a copy of transfer->buffer.
+void usb_deliver_transfer(
+    libusb_transfer *transfer,
+    const uint8_t *data,
+    int length,
+    libusb_transfer_status status,
+    std::span<const libusb_iso_packet_descriptor> packets
+) {
+  auto *ctx = static_cast<UsbTransferCtx *>(transfer->user_data);
+  if (!ctx) {
     return;
   }
 
-  InputDecl *decl = ud->first;
-  lua_State *L = ud->second;
+  usb_deliver_data(
+      ctx->device, transfer->endpoint, transfer->type, data, length, status, packets
+  );
+}
 
-  sol::state_view lua(L);
+void usb_deliver_data(
+    const std::string &device,
+    uint8_t endpoint,
+    uint8_t type,
+    const uint8_t *data,
+    int length,
+    libusb_transfer_status status,
+    std::span<const libusb_iso_packet_descriptor> packets
+) {
+  auto &state = AelkeyState::instance();
+  state.loop_stats.count_input(device, 1);
+
+  if (InputLog::recording()) {
+    InputLog::record(
+        InputLogKind::Usb,
+        device,
+        data,
+        static_cast<size_t>(std::max(length, 0)),
+        status,
+        endpoint | (static_cast<uint32_t>(type) << 8)
+    );
+  }
 
-  if (!decl->on_event.empty()) {
-    sol::object cb_obj = lua[decl->on_event];
-    if (cb_obj.is<sol::function>()) {
-      sol::function cb = cb_obj.as<sol::function>();
-
-      sol::table ev = lua.create_table();
-
-      ev["device"] = decl->id;
-      ev["data"] = std::string_view(
-          reinterpret_cast<const char *>(transfer->buffer), transfer->actual_length
-      );
-      ev["size"] = static_cast<int>(transfer->actual_length);
-      ev["endpoint"] = static_cast<int>(transfer->endpoint);
-      ev["transfer"] = transfer_type_to_string(transfer->type);
-      ev["status"] = transfer_status_to_string(transfer->status);
-
-      sol::protected_function pcb = cb;
-      sol::protected_function_result r = pcb(ev);
-      if (!r.valid()) {
-        sol::error err = r;
-        std::fprintf(stderr, "Lua libusb callback error: %s\n", err.what());
-      }
+  auto it = state.input_map.find(device);
+  if (it == state.input_map.end() || it->second.on_event.empty()) {
+    return;
+  }
+
+  sol::state_view lua(state.lua_vm);
+
+  sol::object cb_obj = lua[it->second.on_event];
+  if (!cb_obj.is<sol::function>()) {
+    return;
+  }
+  sol::function cb = cb_obj.as<sol::function>();
+
+  sol::table ev = lua.create_table();
+
+  ev["device"] = device;
+  ev["data"] = std::string_view(reinterpret_cast<const char *>(data), length);
+  ev["size"] = length;
+  ev["endpoint"] = static_cast<int>(endpoint);
+  ev["transfer"] = transfer_type_to_string(type);
+  ev["status"] = transfer_status_to_string(status);
+
+  // isochronous: one entry per packet, in order; data above is all of
+  // them back to back
+  if (!packets.empty()) {
+    sol::table list = lua.create_table(static_cast<int>(packets.size()), 0);
+    const char *p = reinterpret_cast<const char *>(data);
+    for (size_t i = 0; i < packets.size(); ++i) {
+      const auto &desc = packets[i];
+      sol::table pkt = lua.create_table(0, 3);
+      pkt["status"] = transfer_status_to_string(desc.status);
+      pkt["size"] = static_cast<int>(desc.actual_length);
+      pkt["data"] = std::string_view(p, desc.actual_length);
+      p += desc.actual_length;
+      list[i + 1] = pkt;
     }
+    ev["packets"] = list;
   }
 
-  // resubmit transfer based on status
-  switch (transfer->status) {
+  CallbackTimer timer(it->second.on_event);
+  TRACE_SCOPE(TraceCategory::Usb, "transfer", device);
+  sol::protected_function pcb = cb;
+  sol::protected_function_result r = pcb(ev);
+  if (!r.valid()) {
+    sol::error err = r;
+    std::fprintf(stderr, "Lua libusb callback error: %s\n", err.what());
+  }
+}
+
+// Resubmit, release, or detach after delivery
+void usb_finish_transfer(libusb_transfer *transfer, libusb_transfer_status status) {
+  auto *ctx = static_cast<UsbTransferCtx *>(transfer->user_data);
+  if (!ctx) {
+    destroy_transfer(transfer);
+    return;
+  }
+
+  if (ctx->stream) {
+    // queued again before delivery if it could be
+    release_stream_transfer(ctx->stream, status);
+    return;
+  }
+
+  switch (status) {
     case LIBUSB_TRANSFER_COMPLETED:
     case LIBUSB_TRANSFER_OVERFLOW:
     case LIBUSB_TRANSFER_TIMED_OUT: {
@@ -125,8 +357,7 @@ static void LIBUSB_CALL dispatch_libusb(libusb_transfer *transfer) {
     }
 
     case LIBUSB_TRANSFER_NO_DEVICE: {
-      auto result = DeviceManager::instance().detach(decl->id);
-      DispatcherUdev::instance().notify_state_change(*result, "remove");
+      detach_usb_device(ctx->device);
       break;
     }
 
@@ -136,7 +367,7 @@ static void LIBUSB_CALL dispatch_libusb(libusb_transfer *transfer) {
       libusb_device_descriptor desc;
 
       auto &backend = DeviceBackendLibUSB::instance();
-      libusb_device_handle *handle = backend.get_handle(decl->id);
+      libusb_device_handle *handle = backend.get_handle(ctx->device);
 
       int rc = -1;
       if (handle) {
@@ -144,8 +375,7 @@ static void LIBUSB_CALL dispatch_libusb(libusb_transfer *transfer) {
       }
       if (rc != 0) {
         // device is gone
-        auto result = DeviceManager::instance().detach(decl->id);
-        DispatcherUdev::instance().notify_state_change(*result, "remove");
+        detach_usb_device(ctx->device);
       } else {
         // fatal or cancelled
         destroy_transfer(transfer);
@@ -155,6 +385,65 @@ static void LIBUSB_CALL dispatch_libusb(libusb_transfer *transfer) {
   }
 }
 
+// libusb async callback → Lua
+static void LIBUSB_CALL dispatch_libusb(libusb_transfer *transfer) {
+  if (!transfer || !transfer->user_data) {
+    return;
+  }
+
+  UsbStream *stream = static_cast<UsbTransferCtx *>(transfer->user_data)->stream;
+  if (stream) {
+    count_stream_completion(stream);
+  }
+
+  // libusb events run on an I/O thread: hand the transfer to the loop
+  auto &pool = IoPool::instance();
+  if (pool.handles_libusb()) {
+    pool.queue_transfer(transfer);
+    return;
+  }
+
+  if (stream) {
+    // copy out so that the transfer is queued again before Lua runs
+    libusb_transfer_status status = transfer->status;
+    usb_copy_transfer(transfer, stream->data, stream->packets);
+    bool resubmitted = transfer_is_transient(status) && usb_resubmit_transfer(transfer);
+
+    usb_deliver_transfer(
+        transfer,
+        stream->data.data(),
+        static_cast<int>(stream->data.size()),
+        status,
+        stream->packets
+    );
+    if (!resubmitted) {
+      usb_finish_transfer(transfer, status);
+    }
+    return;
+  }
+
+  if (transfer->type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+    // packed; loop thread only, so one scratch buffer serves all
+    static std::vector<uint8_t> iso_data;
+    static std::vector<libusb_iso_packet_descriptor> iso_packets;
+    usb_copy_transfer(transfer, iso_data, iso_packets);
+    usb_deliver_transfer(
+        transfer,
+        iso_data.data(),
+        static_cast<int>(iso_data.size()),
+        transfer->status,
+        iso_packets
+    );
+    usb_finish_transfer(transfer, transfer->status);
+    return;
+  }
+
+  usb_deliver_transfer(
+      transfer, transfer->buffer, transfer->actual_length, transfer->status
+  );
+  usb_finish_transfer(transfer, transfer->status);
+}
+
 // bulk_transfer{device, endpoint, size, [timeout]}
 // Returns {device, data, size, status}
 sol::object usb_bulk_transfer(sol::this_state ts, sol::table opts) {
@@ -427,8 +716,6 @@ sol::object usb_submit_transfer(sol::this_state ts, sol::table opts) {
     result["status"] = libusb_error_name(LIBUSB_ERROR_NO_DEVICE);
     return result;
   }
-  InputDecl *decl = &it->second;
-
   // endpoint
   int endpoint = opts.get<int>("endpoint");
 
@@ -443,14 +730,30 @@ sol::object usb_submit_transfer(sol::this_state ts, sol::table opts) {
     type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
   }
 
-  // size
-  int size = opts.get<int>("size");
+  // size; per packet for iso
+  int size = opts.get_or("size", 0);
 
   // timeout (optional)
   unsigned int timeout = static_cast<unsigned int>(opts.get_or("timeout", 0));
 
+  // iso: `packets` packets per transfer (optional, default 8)
+  int packets = 0;
+  if (type == LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+    packets = std::clamp(opts.get_or("packets", 8), 1, 128);
+    size = iso_packet_size(handle, endpoint, size);
+    if (size <= 0) {
+      sol::table result = lua.create_table();
+      result["device"] = dev_id;
+      result["endpoint"] = endpoint;
+      result["transfer"] = sol::lua_nil;
+      result["status"] = libusb_error_name(size < 0 ? size : LIBUSB_ERROR_INVALID_PARAM);
+      return result;
+    }
+  }
+  int length = packets ? size * packets : size;
+
   // allocate transfer + buffer
-  libusb_transfer *xfer = libusb_alloc_transfer(0);
+  libusb_transfer *xfer = libusb_alloc_transfer(packets);
   if (!xfer) {
     sol::table result = lua.create_table();
     result["device"] = dev_id;
@@ -461,7 +764,7 @@ sol::object usb_submit_transfer(sol::this_state ts, sol::table opts) {
   }
 
   unsigned char *buf =
-      static_cast<unsigned char *>(std::malloc(static_cast<std::size_t>(size)));
+      static_cast<unsigned char *>(std::malloc(static_cast<std::size_t>(length)));
   if (!buf) {
     destroy_transfer(xfer);
     sol::table result = lua.create_table();
@@ -478,9 +781,13 @@ sol::object usb_submit_transfer(sol::this_state ts, sol::table opts) {
   xfer->type = static_cast<uint8_t>(type);
   xfer->timeout = timeout;
   xfer->buffer = buf;
-  xfer->length = size;
-  xfer->user_data = new std::pair<InputDecl *, lua_State *>(decl, L);
+  xfer->length = length;
+  xfer->user_data = new UsbTransferCtx{ dev_id, L };
   xfer->callback = dispatch_libusb;
+  xfer->num_iso_packets = packets;
+  if (packets) {
+    libusb_set_iso_packet_lengths(xfer, static_cast<unsigned int>(size));
+  }
 
   int rc = libusb_submit_transfer(xfer);
   if (rc != 0) {
@@ -520,6 +827,134 @@ sol::object usb_submit_transfer(sol::this_state ts, sol::table opts) {
   return sol::make_object(lua, t);
 }
 
+// stream{device, endpoint, size, [depth], [type], [packets], [timeout]}
+// Returns {device, endpoint, depth, status, stop(), stats()}
+sol::object usb_stream(sol::this_state ts, sol::table opts) {
+  lua_State *L = ts;
+  sol::state_view lua(L);
+
+  std::string dev_id = opts.get<std::string>("device");
+  int endpoint = opts.get<int>("endpoint");
+  int size = opts.get_or("size", 0);  // per packet for iso
+  int depth = std::clamp(opts.get_or("depth", 4), 1, 64);
+  std::string type_str = opts.get_or<std::string>("type", "interrupt");
+  unsigned int timeout = static_cast<unsigned int>(opts.get_or("timeout", 0));
+
+  sol::table result = lua.create_table();
+  result["device"] = dev_id;
+  result["endpoint"] = endpoint;
+  result["depth"] = depth;
+
+  auto &backend = DeviceBackendLibUSB::instance();
+  libusb_device_handle *handle = backend.get_handle(dev_id);
+  if (!handle || !AelkeyState::instance().input_map.contains(dev_id)) {
+    result["status"] = libusb_error_name(LIBUSB_ERROR_NO_DEVICE);
+    return result;
+  }
+
+  // input only; interrupt, bulk, or iso
+  uint8_t type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+  int packets = 0;
+  if (type_str == "bulk") {
+    type = LIBUSB_TRANSFER_TYPE_BULK;
+  } else if (type_str == "iso") {
+    type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+    packets = std::clamp(opts.get_or("packets", 8), 1, 128);
+    size = iso_packet_size(handle, endpoint, size);
+  } else if (type_str != "interrupt") {
+    size = 0;
+  }
+  if (!(endpoint & LIBUSB_ENDPOINT_IN) || size <= 0) {
+    result["status"] = libusb_error_name(size < 0 ? size : LIBUSB_ERROR_INVALID_PARAM);
+    return result;
+  }
+  size_t length = static_cast<size_t>(size) * static_cast<size_t>(packets ? packets : 1);
+
+  auto owned = std::make_unique<UsbStream>();
+  UsbStream *stream = owned.get();
+  stream->id = next_stream_id++;
+  stream->device = dev_id;
+  stream->handle = handle;
+  stream->buffers.resize(static_cast<size_t>(depth) * length);
+  stream->data.reserve(length);
+  stream->packets.reserve(static_cast<size_t>(packets));
+
+  for (int i = 0; i < depth; ++i) {
+    libusb_transfer *xfer = libusb_alloc_transfer(packets);
+    if (!xfer) {
+      retire_stream(stream);
+      result["status"] = libusb_error_name(LIBUSB_ERROR_NO_MEM);
+      return result;
+    }
+    xfer->dev_handle = handle;
+    xfer->endpoint = static_cast<uint8_t>(endpoint);
+    xfer->type = type;
+    xfer->timeout = timeout;
+    xfer->buffer = stream->buffers.data() + static_cast<size_t>(i) * length;
+    xfer->length = static_cast<int>(length);
+    xfer->user_data = new UsbTransferCtx{ dev_id, L, stream };
+    xfer->callback = dispatch_libusb;
+    xfer->num_iso_packets = packets;
+    if (packets) {
+      libusb_set_iso_packet_lengths(xfer, static_cast<unsigned int>(size));
+    }
+    stream->transfers.push_back(xfer);
+  }
+  usb_streams[stream->id] = std::move(owned);
+
+  for (size_t i = 0; i < stream->transfers.size(); ++i) {
+    // counted first: with I/O threads it may complete before submit returns
+    stream->in_flight.fetch_add(1, std::memory_order_acq_rel);
+    int rc = libusb_submit_transfer(stream->transfers[i]);
+    if (rc == 0) {
+      continue;
+    }
+    stream->in_flight.fetch_sub(1, std::memory_order_acq_rel);
+
+    // the queued ones come back cancelled and retire the stream
+    result["status"] = libusb_error_name(rc);
+    stop_stream(stream);
+    stream->released += stream->transfers.size() - i;
+    if (stream->released == stream->transfers.size()) {
+      retire_stream(stream);
+    }
+    return result;
+  }
+
+  uint64_t id = stream->id;
+  result["status"] = libusb_error_name(LIBUSB_SUCCESS);
+
+  // stop(): cancel the queued transfers; completions already handed to
+  // the loop are still delivered
+  result.set_function("stop", [id]() {
+    auto it = usb_streams.find(id);
+    if (it == usb_streams.end() || it->second->detached) {
+      return false;
+    }
+    stop_stream(it->second.get());
+    return true;
+  });
+
+  // stats(): nil once the stream has ended or its device was detached
+  result.set_function("stats", [id](sol::this_state s) -> sol::object {
+    auto it = usb_streams.find(id);
+    if (it == usb_streams.end() || it->second->detached) {
+      return sol::lua_nil;
+    }
+    const UsbStream &st = *it->second;
+    sol::state_view view(s);
+    sol::table t = view.create_table();
+    t["depth"] = static_cast<int>(st.transfers.size());
+    t["in_flight"] = st.in_flight.load();
+    t["completed"] = st.completed.load();
+    t["overruns"] = st.overruns.load();
+    t["stopping"] = st.stopping.load();
+    return t;
+  });
+
+  return result;
+}
+
 extern "C" int luaopen_aelkey_usb(lua_State *L) {
   sol::state_view lua(L);
 
@@ -529,6 +964,7 @@ extern "C" int luaopen_aelkey_usb(lua_State *L) {
   mod.set_function("control_transfer", usb_control_transfer);
   mod.set_function("interrupt_transfer", usb_interrupt_transfer);
   mod.set_function("submit_transfer", usb_submit_transfer);
+  mod.set_function("stream", usb_stream);
 
   return sol::stack::push(L, mod);
 }
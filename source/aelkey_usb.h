@@ -1,5 +1,55 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <libusb-1.0/libusb.h>
 #include <lua.hpp>
 
 extern "C" int luaopen_aelkey_usb(lua_State *L);
+
+// Lua delivery and resubmission of a completed async transfer.
+// Split so that IoPool can run libusb events on its own thread.
+// Isochronous transfers come with their packet descriptors (see
+// usb_copy_transfer).
+void usb_deliver_transfer(
+    libusb_transfer *transfer,
+    const uint8_t *data,
+    int length,
+    libusb_transfer_status status,
+    std::span<const libusb_iso_packet_descriptor> packets = {}
+);
+void usb_finish_transfer(libusb_transfer *transfer, libusb_transfer_status status);
+
+// Queue a completed transfer again; false if it failed or belongs to a
+// stopped usb.stream. Safe on the libusb event thread.
+bool usb_resubmit_transfer(libusb_transfer *transfer);
+
+// The device is being detached: stop its usb.streams for good. Returns
+// how many still have transfers out; each tells DeviceBackendLibUSB
+// (stream_retired) once the last one is back.
+size_t usb_detach_streams(const std::string &device);
+
+// Received data of a completed transfer, copied out so that the transfer
+// can be queued again. Isochronous packets are packed back to back, and
+// their descriptors go to packets (actual_length is each one's share of
+// data); packets is left empty for other transfer types.
+void usb_copy_transfer(
+    const libusb_transfer *transfer,
+    std::vector<uint8_t> &data,
+    std::vector<libusb_iso_packet_descriptor> &packets
+);
+
+// Transfer data → the device's Lua callback; also used by replay
+void usb_deliver_data(
+    const std::string &device,
+    uint8_t endpoint,
+    uint8_t type,
+    const uint8_t *data,
+    int length,
+    libusb_transfer_status status,
+    std::span<const libusb_iso_packet_descriptor> packets = {}
+);
@@ -0,0 +1,441 @@
+#include "bluez_object_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "util/clock.h"
+
+namespace {
+
+constexpr const char *BLUEZ_SERVICE = "org.bluez";
+constexpr const char *DEVICE_IFACE = "org.bluez.Device1";
+constexpr const char *SERVICE_IFACE = "org.bluez.GattService1";
+constexpr const char *CHARACTERISTIC_IFACE = "org.bluez.GattCharacteristic1";
+constexpr const char *OBJECT_MANAGER_IFACE = "org.freedesktop.DBus.ObjectManager";
+
+// Bluetooth base UUID, after the 32-bit prefix
+constexpr const char *BASE_UUID_SUFFIX = "-0000-1000-8000-00805f9b34fb";
+
+std::string string_value(DBusMessageIter *value) {
+  if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_STRING) {
+    return {};
+  }
+  const char *s = nullptr;
+  dbus_message_iter_get_basic(value, &s);
+  return s ? s : "";
+}
+
+bool bool_value(DBusMessageIter *value) {
+  if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_BOOLEAN) {
+    return false;
+  }
+  dbus_bool_t b = false;
+  dbus_message_iter_get_basic(value, &b);
+  return b;
+}
+
+std::vector<std::string> string_array(DBusMessageIter *value) {
+  std::vector<std::string> out;
+  if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_ARRAY) {
+    return out;
+  }
+
+  DBusMessageIter array;
+  dbus_message_iter_recurse(value, &array);
+  while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRING) {
+    const char *s = nullptr;
+    dbus_message_iter_get_basic(&array, &s);
+    if (s) {
+      out.emplace_back(s);
+    }
+    dbus_message_iter_next(&array);
+  }
+  return out;
+}
+
+void erase_pair(
+    std::unordered_multimap<std::string, std::string> &index,
+    const std::string &key,
+    const std::string &path
+) {
+  auto [first, last] = index.equal_range(key);
+  for (auto it = first; it != last; ++it) {
+    if (it->second == path) {
+      index.erase(it);
+      return;
+    }
+  }
+}
+
+}  // namespace
+
+void BluezObjectCache::add_matches(DBusConnection *conn) {
+  const char *rules[] = {
+    "type='signal',sender='org.bluez',interface='org.freedesktop.DBus.ObjectManager'",
+    "type='signal',sender='org.bluez',interface='org.freedesktop.DBus.Properties',"
+    "member='PropertiesChanged',arg0='org.bluez.Device1'",
+    "type='signal',sender='org.freedesktop.DBus',interface='org.freedesktop.DBus',"
+    "member='NameOwnerChanged',arg0='org.bluez'",
+  };
+  for (const char *rule : rules) {
+    dbus_bus_add_match(conn, rule, nullptr);
+  }
+}
+
+bool BluezObjectCache::load(DBusConnection *conn) {
+  clear();
+
+  DBusMessage *msg = dbus_message_new_method_call(
+      BLUEZ_SERVICE, "/", OBJECT_MANAGER_IFACE, "GetManagedObjects"
+  );
+  DBusMessage *reply = dbus_connection_send_with_reply_and_block(conn, msg, -1, nullptr);
+  dbus_message_unref(msg);
+
+  if (!reply) {
+    return false;
+  }
+
+  // a{oa{sa{sv}}}
+  DBusMessageIter args;
+  if (dbus_message_iter_init(reply, &args) &&
+      dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_ARRAY) {
+    DBusMessageIter dict;
+    dbus_message_iter_recurse(&args, &dict);
+
+    while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+      DBusMessageIter entry;
+      dbus_message_iter_recurse(&dict, &entry);
+
+      const char *path = nullptr;
+      dbus_message_iter_get_basic(&entry, &path);
+      dbus_message_iter_next(&entry);
+
+      if (path && dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_ARRAY) {
+        add_interfaces(path, &entry);
+      }
+
+      dbus_message_iter_next(&dict);
+    }
+  }
+
+  dbus_message_unref(reply);
+
+  // Connections made before the load have no known start
+  for (auto &[_, obj] : objects_) {
+    obj.connected_ns = 0;
+    obj.resolved_ns = 0;
+  }
+
+  loaded_ = true;
+  return true;
+}
+
+void BluezObjectCache::clear() {
+  objects_.clear();
+  by_address_.clear();
+  by_name_.clear();
+  by_uuid_.clear();
+  loaded_ = false;
+}
+
+bool BluezObjectCache::handle_signal(DBusMessage *msg) {
+  if (dbus_message_is_signal(msg, DBUS_INTERFACE_DBUS, "NameOwnerChanged")) {
+    const char *name = nullptr;
+    const char *old_owner = nullptr;
+    const char *new_owner = nullptr;
+    if (!dbus_message_get_args(
+            msg, nullptr, DBUS_TYPE_STRING, &name, DBUS_TYPE_STRING, &old_owner,
+            DBUS_TYPE_STRING, &new_owner, DBUS_TYPE_INVALID
+        ) ||
+        strcmp(name, BLUEZ_SERVICE) != 0) {
+      return false;
+    }
+    clear();  // bluetoothd restarted or stopped; reload on next use
+    return true;
+  }
+
+  // Until loaded, GetManagedObjects covers everything
+  if (!loaded_) {
+    return false;
+  }
+
+  bool added = dbus_message_is_signal(msg, OBJECT_MANAGER_IFACE, "InterfacesAdded");
+  bool removed = dbus_message_is_signal(msg, OBJECT_MANAGER_IFACE, "InterfacesRemoved");
+
+  if (added || removed) {
+    // o, a{sa{sv}} or o, as
+    DBusMessageIter args;
+    if (!dbus_message_iter_init(msg, &args) ||
+        dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_OBJECT_PATH) {
+      return false;
+    }
+
+    const char *path = nullptr;
+    dbus_message_iter_get_basic(&args, &path);
+    dbus_message_iter_next(&args);
+    if (!path || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) {
+      return false;
+    }
+
+    if (added) {
+      add_interfaces(path, &args);
+    } else {
+      remove_interfaces(path, &args);
+    }
+    return true;
+  }
+
+  if (dbus_message_is_signal(msg, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged")) {
+    const char *path = dbus_message_get_path(msg);
+    if (!path || !objects_.contains(path)) {
+      return false;
+    }
+
+    // s, a{sv}, as; only device properties change after discovery
+    DBusMessageIter args;
+    if (!dbus_message_iter_init(msg, &args) ||
+        dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_STRING) {
+      return false;
+    }
+    const char *iface = nullptr;
+    dbus_message_iter_get_basic(&args, &iface);
+    if (!iface || strcmp(iface, DEVICE_IFACE) != 0) {
+      return false;
+    }
+    change_properties(path, &args);
+    return true;
+  }
+
+  return false;
+}
+
+void BluezObjectCache::add_interfaces(const std::string &path, DBusMessageIter *ifaces) {
+  auto it = objects_.try_emplace(path).first;
+  BluezObject &obj = it->second;
+  unindex(path, obj);
+
+  DBusMessageIter dict;
+  dbus_message_iter_recurse(ifaces, &dict);
+
+  while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+    DBusMessageIter entry;
+    dbus_message_iter_recurse(&dict, &entry);
+
+    const char *iface = nullptr;
+    dbus_message_iter_get_basic(&entry, &iface);
+    dbus_message_iter_next(&entry);
+
+    if (iface && dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_ARRAY) {
+      if (strcmp(iface, DEVICE_IFACE) == 0) {
+        obj.device = true;
+      } else if (strcmp(iface, SERVICE_IFACE) == 0) {
+        obj.service = true;
+      } else if (strcmp(iface, CHARACTERISTIC_IFACE) == 0) {
+        obj.characteristic = true;
+      }
+      apply_properties(obj, iface, &entry);
+    }
+
+    dbus_message_iter_next(&dict);
+  }
+
+  // adapters, descriptors, and the like are not kept
+  if (obj.empty()) {
+    objects_.erase(it);
+    return;
+  }
+  index(path, obj);
+}
+
+void BluezObjectCache::remove_interfaces(const std::string &path, DBusMessageIter *names) {
+  auto it = objects_.find(path);
+  if (it == objects_.end()) {
+    return;
+  }
+  BluezObject &obj = it->second;
+  unindex(path, obj);
+
+  for (const auto &iface : string_array(names)) {
+    if (iface == DEVICE_IFACE) {
+      obj.device = false;
+    } else if (iface == SERVICE_IFACE) {
+      obj.service = false;
+    } else if (iface == CHARACTERISTIC_IFACE) {
+      obj.characteristic = false;
+    }
+  }
+
+  if (obj.empty()) {
+    objects_.erase(it);
+    return;
+  }
+  index(path, obj);
+}
+
+void BluezObjectCache::change_properties(const std::string &path, DBusMessageIter *args) {
+  const char *iface = nullptr;
+  dbus_message_iter_get_basic(args, &iface);
+  dbus_message_iter_next(args);
+  if (!iface || dbus_message_iter_get_arg_type(args) != DBUS_TYPE_ARRAY) {
+    return;
+  }
+
+  BluezObject &obj = objects_[path];
+  unindex(path, obj);
+  apply_properties(obj, iface, args);
+  index(path, obj);
+}
+
+void BluezObjectCache::apply_properties(
+    BluezObject &obj, const char *iface, DBusMessageIter *props
+) {
+  bool device = strcmp(iface, DEVICE_IFACE) == 0;
+  bool characteristic = strcmp(iface, CHARACTERISTIC_IFACE) == 0;
+  if (!device && !characteristic && strcmp(iface, SERVICE_IFACE) != 0) {
+    return;
+  }
+
+  DBusMessageIter dict;
+  dbus_message_iter_recurse(props, &dict);
+
+  while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+    DBusMessageIter entry;
+    dbus_message_iter_recurse(&dict, &entry);
+
+    const char *key = nullptr;
+    if (dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_STRING) {
+      dbus_message_iter_get_basic(&entry, &key);
+    }
+    dbus_message_iter_next(&entry);
+
+    if (key && dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_VARIANT) {
+      DBusMessageIter value;
+      dbus_message_iter_recurse(&entry, &value);
+
+      if (device) {
+        if (strcmp(key, "Address") == 0) {
+          obj.address = string_value(&value);
+        } else if (strcmp(key, "Name") == 0) {
+          obj.name = string_value(&value);
+        } else if (strcmp(key, "Alias") == 0) {
+          obj.alias = string_value(&value);
+        } else if (strcmp(key, "Connected") == 0) {
+          bool connected = bool_value(&value);
+          if (connected && !obj.connected) {
+            obj.connected_ns = monotonic_ns();
+          }
+          obj.connected = connected;
+        } else if (strcmp(key, "ServicesResolved") == 0) {
+          bool resolved = bool_value(&value);
+          if (resolved && !obj.services_resolved) {
+            obj.resolved_ns = monotonic_ns();
+          }
+          obj.services_resolved = resolved;
+        }
+      } else if (strcmp(key, "UUID") == 0) {
+        obj.uuid = normalize_uuid(string_value(&value));
+      } else if (characteristic && strcmp(key, "Flags") == 0) {
+        obj.flags = string_array(&value);
+      }
+    }
+
+    dbus_message_iter_next(&dict);
+  }
+}
+
+void BluezObjectCache::index(const std::string &path, const BluezObject &obj) {
+  if (obj.device) {
+    if (!obj.address.empty()) {
+      by_address_.emplace(obj.address, path);
+    }
+    if (!obj.name.empty()) {
+      by_name_.emplace(obj.name, path);
+    }
+    if (!obj.alias.empty() && obj.alias != obj.name) {
+      by_name_.emplace(obj.alias, path);
+    }
+  }
+  if ((obj.service || obj.characteristic) && !obj.uuid.empty()) {
+    by_uuid_.emplace(obj.uuid, path);
+  }
+}
+
+void BluezObjectCache::unindex(const std::string &path, const BluezObject &obj) {
+  erase_pair(by_address_, obj.address, path);
+  erase_pair(by_name_, obj.name, path);
+  erase_pair(by_name_, obj.alias, path);
+  erase_pair(by_uuid_, obj.uuid, path);
+}
+
+const BluezObject *BluezObjectCache::find(const std::string &path) const {
+  auto it = objects_.find(path);
+  return it != objects_.end() ? &it->second : nullptr;
+}
+
+std::vector<std::string> BluezObjectCache::lookup(const Index &index, const std::string &key) {
+  std::vector<std::string> out;
+  auto [first, last] = index.equal_range(key);
+  for (auto it = first; it != last; ++it) {
+    out.push_back(it->second);
+  }
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+  return out;
+}
+
+std::vector<std::string>
+BluezObjectCache::devices_by_address(const std::string &address) const {
+  return lookup(by_address_, address);
+}
+
+std::vector<std::string> BluezObjectCache::devices_by_name(const std::string &name) const {
+  return lookup(by_name_, name);
+}
+
+std::vector<std::string> BluezObjectCache::by_uuid(const std::string &uuid) const {
+  return lookup(by_uuid_, normalize_uuid(uuid));
+}
+
+std::vector<std::string>
+BluezObjectCache::children(const std::string &parent, bool BluezObject::*kind) const {
+  std::vector<std::string> out;
+  std::string prefix = parent + "/";
+
+  for (auto it = objects_.lower_bound(prefix);
+       it != objects_.end() && it->first.starts_with(prefix); ++it) {
+    bool direct = it->first.find('/', prefix.size()) == std::string::npos;
+    if (direct && it->second.*kind) {
+      out.push_back(it->first);
+    }
+  }
+  return out;
+}
+
+std::vector<std::string> BluezObjectCache::services_of(const std::string &device_path) const {
+  return children(device_path, &BluezObject::service);
+}
+
+std::vector<std::string>
+BluezObjectCache::characteristics_of(const std::string &service_path) const {
+  return children(service_path, &BluezObject::characteristic);
+}
+
+std::string BluezObjectCache::normalize_uuid(std::string_view uuid) {
+  if (uuid.starts_with("0x") || uuid.starts_with("0X")) {
+    uuid.remove_prefix(2);
+  }
+
+  std::string out(uuid);
+  std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+
+  if (out.size() == 4) {
+    return "0000" + out + BASE_UUID_SUFFIX;
+  }
+  if (out.size() == 8) {
+    return out + BASE_UUID_SUFFIX;
+  }
+  return out;
+}
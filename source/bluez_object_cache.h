@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <dbus/dbus.h>
+
+// One object of the BlueZ tree, with the properties matching needs
+struct BluezObject {
+  bool device = false;          // org.bluez.Device1
+  bool service = false;         // org.bluez.GattService1
+  bool characteristic = false;  // org.bluez.GattCharacteristic1
+
+  // Device1
+  std::string address;
+  std::string name;
+  std::string alias;
+  bool connected = false;
+  bool services_resolved = false;
+  uint64_t connected_ns = 0;  // when seen connecting; 0 if connected at load
+  uint64_t resolved_ns = 0;
+
+  // GattService1, GattCharacteristic1
+  std::string uuid;  // lower case
+  std::vector<std::string> flags;
+
+  bool empty() const {
+    return !device && !service && !characteristic;
+  }
+};
+
+// Mirror of the org.bluez object tree. Loaded with one GetManagedObjects
+// call, then kept current from InterfacesAdded, InterfacesRemoved, and
+// Device1 PropertiesChanged signals; cleared when bluetoothd goes away
+// and loaded again on next use.
+//
+// Paths are ordered, so the services of a device and the characteristics
+// of a service are one range of the map.
+class BluezObjectCache {
+ public:
+  // Subscribe to the signals the cache follows; before load(), so that
+  // no change falls between the two
+  static void add_matches(DBusConnection *conn);
+
+  bool load(DBusConnection *conn);
+  void clear();
+
+  bool loaded() const {
+    return loaded_;
+  }
+
+  // Bus signal; true if it changed the tree
+  bool handle_signal(DBusMessage *msg);
+
+  const BluezObject *find(const std::string &path) const;
+
+  const std::map<std::string, BluezObject> &objects() const {
+    return objects_;
+  }
+
+  // Exact lookups; paths in order
+  std::vector<std::string> devices_by_address(const std::string &address) const;
+  std::vector<std::string> devices_by_name(const std::string &name) const;  // or alias
+  std::vector<std::string> by_uuid(const std::string &uuid) const;
+
+  // Services (or characteristics) directly under parent
+  std::vector<std::string> services_of(const std::string &device_path) const;
+  std::vector<std::string> characteristics_of(const std::string &service_path) const;
+
+  // Lower case 128-bit form; 16- and 32-bit UUIDs are expanded with the
+  // Bluetooth base UUID
+  static std::string normalize_uuid(std::string_view uuid);
+
+ private:
+  using Index = std::unordered_multimap<std::string, std::string>;
+
+  void add_interfaces(const std::string &path, DBusMessageIter *ifaces);
+  void remove_interfaces(const std::string &path, DBusMessageIter *names);
+  void change_properties(const std::string &path, DBusMessageIter *args);
+
+  static void apply_properties(BluezObject &obj, const char *iface, DBusMessageIter *props);
+
+  void index(const std::string &path, const BluezObject &obj);
+  void unindex(const std::string &path, const BluezObject &obj);
+
+  std::vector<std::string>
+  children(const std::string &parent, bool BluezObject::*kind) const;
+  static std::vector<std::string> lookup(const Index &index, const std::string &key);
+
+  std::map<std::string, BluezObject> objects_;
+  Index by_address_;
+  Index by_name_;
+  Index by_uuid_;
+  bool loaded_ = false;
+};
@@ -0,0 +1,69 @@
+#include "callback_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+CallbackStats::Map::value_type &CallbackStats::entry(std::string_view name) {
+  auto it = callbacks_.find(name);
+  if (it == callbacks_.end()) {
+    it = callbacks_.emplace(std::string(name), CallbackTiming{}).first;
+  }
+  return *it;
+}
+
+void CallbackStats::record(Map::value_type &entry, uint64_t elapsed_ns) {
+  const std::string &name = entry.first;
+  CallbackTiming &t = entry.second;
+
+  ++t.count;
+  t.total_ns += elapsed_ns;
+  t.max_ns = std::max(t.max_ns, elapsed_ns);
+  t.histogram.record(elapsed_ns);
+
+  if (budget_ns_ == 0 || elapsed_ns <= budget_ns_) {
+    return;
+  }
+
+  ++t.over_budget;
+
+  uint64_t now = monotonic_ns();
+  if (t.last_warning_ns != 0 && now - t.last_warning_ns < 1000000000ULL) {
+    ++t.suppressed;
+    return;
+  }
+
+  std::fprintf(
+      stderr,
+      "aelkey: callback '%s' took %.0f us (budget %.0f us)",
+      name.c_str(),
+      static_cast<double>(elapsed_ns) / 1000.0,
+      static_cast<double>(budget_ns_) / 1000.0
+  );
+  if (t.suppressed > 0) {
+    std::fprintf(
+        stderr, ", %llu more since last report", static_cast<unsigned long long>(t.suppressed)
+    );
+  }
+  std::fprintf(stderr, "\n");
+
+  t.last_warning_ns = now;
+  t.suppressed = 0;
+}
+
+void CallbackStats::dump() const {
+  auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+
+  for (const auto &[name, t] : callbacks_) {
+    std::printf(
+        "callback %s: n=%llu total=%.1fms mean=%.0fus p99=%.0fus max=%.0fus over_budget=%llu\n",
+        name.c_str(),
+        static_cast<unsigned long long>(t.count),
+        static_cast<double>(t.total_ns) / 1e6,
+        t.histogram.mean() / 1000.0,
+        us(t.histogram.percentile(99)),
+        us(t.max_ns),
+        static_cast<unsigned long long>(t.over_budget)
+    );
+  }
+  std::fflush(stdout);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "singleton.h"
+#include "util/clock.h"
+#include "util/latency_histogram.h"
+
+// Accumulated run time of one Lua callback, keyed by callback name.
+struct CallbackTiming {
+  uint64_t count = 0;
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+  uint64_t over_budget = 0;
+  LatencyHistogram histogram;
+
+  // budget warnings are rate-limited per callback
+  uint64_t last_warning_ns = 0;
+  uint64_t suppressed = 0;
+};
+
+// Times every Lua callback invocation (event, state, tick, haptics).
+// With a budget set, callbacks that exceed it are logged to stderr, at
+// most once per second per callback.
+class CallbackStats : public Singleton<CallbackStats> {
+  friend class Singleton<CallbackStats>;
+
+ protected:
+  CallbackStats() = default;
+  ~CallbackStats() = default;
+
+ public:
+  // 0 disables budget warnings
+  void set_budget_ns(uint64_t budget_ns) {
+    budget_ns_ = budget_ns;
+  }
+
+  uint64_t budget_ns() const {
+    return budget_ns_;
+  }
+
+  using Map = std::map<std::string, CallbackTiming, std::less<>>;
+
+  // Entry for name, created on first use; valid until reset()
+  Map::value_type &entry(std::string_view name);
+
+  void record(Map::value_type &entry, uint64_t elapsed_ns);
+
+  const Map &callbacks() const {
+    return callbacks_;
+  }
+
+  void reset() {
+    callbacks_.clear();
+    ++generation_;
+  }
+
+  // Changes on every reset(), when all entries are gone
+  uint64_t generation() const {
+    return generation_;
+  }
+
+  // Print a one-line summary per callback to stdout
+  void dump() const;
+
+ private:
+  uint64_t budget_ns_ = 0;
+  uint64_t generation_ = 0;
+  Map callbacks_;
+};
+
+// Times one callback invocation from construction to destruction.
+// The entry is looked up up front: the callback may free the string
+// name points into.
+class CallbackTimer {
+ public:
+  explicit CallbackTimer(std::string_view name)
+      : entry_(&CallbackStats::instance().entry(name)),
+        generation_(CallbackStats::instance().generation()),
+        start_(monotonic_ns()) {}
+
+  ~CallbackTimer() {
+    auto &stats = CallbackStats::instance();
+    if (stats.generation() == generation_) {  // else reset() by the callback
+      stats.record(*entry_, monotonic_ns() - start_);
+    }
+  }
+
+  CallbackTimer(const CallbackTimer &) = delete;
+  CallbackTimer &operator=(const CallbackTimer &) = delete;
+
+ private:
+  CallbackStats::Map::value_type *entry_;
+  uint64_t generation_;
+  uint64_t start_;
+};
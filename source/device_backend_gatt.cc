@@ -1,18 +1,58 @@
 #include "device_backend_gatt.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <span>
 #include <string>
 #include <string_view>
 
 #include <dbus/dbus.h>
+#include <fcntl.h>
 #include <sol/sol.hpp>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include "aelkey_state.h"
-#include "device_backend_gatt.h"
+#include "callback_stats.h"
 #include "device_helpers.h"
+#include "device_manager.h"
 #include "dispatcher_gatt.h"
+#include "dispatcher_udev.h"
+#include "input_log.h"
+#include "trace.h"
+#include "util/clock.h"
+#include "util/dbus_bytes.h"
+
+namespace {
+
+// Largest ATT value (512) plus headroom
+constexpr size_t MAX_NOTIFY_SIZE = 1024;
+
+// a{sv} with no entries, as taken by most GattCharacteristic1 methods
+void append_empty_options(DBusMessage *msg) {
+  DBusMessageIter args;
+  dbus_message_iter_init_append(msg, &args);
+  DBusMessageIter dict;
+  dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "{sv}", &dict);
+  dbus_message_iter_close_container(&args, &dict);
+}
+
+const std::string &route_callback(const InputDecl &decl, int characteristic) {
+  auto it = decl.on_notify.find(characteristic);
+  return it != decl.on_notify.end() ? it->second : decl.on_event;
+}
+
+std::string notify_match_rule(const std::string &char_path) {
+  return "type='signal',interface='org.freedesktop.DBus.Properties',"
+         "member='PropertiesChanged',path='" +
+         char_path + "'";
+}
+
+}  // namespace
 
 bool DeviceBackendGATT::on_init() {
   if (conn_) {
@@ -32,6 +72,32 @@ bool DeviceBackendGATT::on_init() {
     return false;
   }
 
+  // Signals reach the object cache and process_one_message through the
+  // filter; replies to async requests complete their pending calls
+  // during dispatch
+  dbus_connection_add_filter(conn_, filter_message, this, nullptr);
+  BluezObjectCache::add_matches(conn_);
+
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    perror("GATT: timerfd_create");
+  } else {
+    dbus_connection_set_timeout_functions(
+        conn_, add_timeout, remove_timeout, toggle_timeout, this, nullptr
+    );
+  }
+
+  // Blocking calls and read_write() can leave messages queued in the
+  // connection with the socket already drained; the bus fd then never
+  // wakes the loop for them, so libdbus reports queued data here
+  dispatch_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (dispatch_fd_ < 0) {
+    perror("GATT: eventfd");
+  } else {
+    dbus_connection_set_dispatch_status_function(conn_, dispatch_status, this, nullptr);
+    dispatch_status(conn_, dbus_connection_get_dispatch_status(conn_), this);
+  }
+
   return DispatcherGATT::instance().lazy_init();
 }
 
@@ -41,31 +107,42 @@ void DeviceBackendGATT::pump_messages() {
     return;
   }
 
-  // Non-blocking read
+  // Non-blocking read, and write whatever is queued
   dbus_connection_read_write(conn_, 0);
 
   // Process ALL pending messages
-  while (true) {
-    DBusMessage *msg = dbus_connection_pop_message(conn_);
-    if (!msg) {
-      break;
-    }
+  while (dbus_connection_dispatch(conn_) == DBUS_DISPATCH_DATA_REMAINS) {
+  }
 
-    process_one_message(msg);
-    dbus_message_unref(msg);
+  // Outside of dispatch: attaching makes blocking calls and runs Lua
+  if (connections_dirty_) {
+    update_connections();
   }
 }
 
-void DeviceBackendGATT::process_one_message(DBusMessage *msg) {
-  sol::state_view lua(AelkeyState::instance().lua_vm);
+DBusHandlerResult
+DeviceBackendGATT::filter_message(DBusConnection *, DBusMessage *msg, void *data) {
+  if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_SIGNAL) {
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+
+  auto *self = static_cast<DeviceBackendGATT *>(data);
+  if (self->objects_.handle_signal(msg)) {
+    self->connections_dirty_ = true;
+  }
 
+  if (dbus_message_is_signal(msg, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged")) {
+    self->process_one_message(msg);
+  }
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+void DeviceBackendGATT::process_one_message(DBusMessage *msg) {
   const char *path = dbus_message_get_path(msg);
   if (!path) {
     return;
   }
 
-  std::vector<uint8_t> bytes;
-
   DBusMessageIter args;
   dbus_message_iter_init(msg, &args);
 
@@ -90,286 +167,561 @@ void DeviceBackendGATT::process_one_message(DBusMessage *msg) {
     }
 
     dbus_message_iter_next(&entry);
-    if (dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_VARIANT) {
+    if (key && strcmp(key, "Value") == 0 &&
+        dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_VARIANT) {
       DBusMessageIter variant;
       dbus_message_iter_recurse(&entry, &variant);
 
-      if (key && strcmp(key, "Value") == 0) {
-        if (dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_ARRAY) {
-          DBusMessageIter array;
-          dbus_message_iter_recurse(&variant, &array);
-
-          while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_BYTE) {
-            uint8_t b;
-            dbus_message_iter_get_basic(&array, &b);
-            bytes.push_back(b);
-            dbus_message_iter_next(&array);
-          }
-        }
-      }
+      // delivered straight from the message
+      std::span<const uint8_t> value = dbus_byte_array(&variant);
+      deliver_notification(path, value.data(), value.size());
+      return;
     }
 
     dbus_message_iter_next(&dict);
   }
+}
+
+void DeviceBackendGATT::deliver_notification(
+    const std::string &path, const uint8_t *data, size_t size
+) {
+  if (InputLog::recording()) {
+    InputLog::record(InputLogKind::Gatt, path, data, size);
+  }
+
+  auto it = routes_.find(path);
+  if (it == routes_.end()) {
+    return;  // not subscribed by any input
+  }
+  const GattRoute &route = it->second;
 
   auto &state = AelkeyState::instance();
-  for (auto &[_, decl] : state.input_map) {
-    if (decl.type != "gatt") {
-      continue;
-    }
+  state.loop_stats.count_input(route.id, 1);
 
-    if (!decl.on_event.empty()) {
-      sol::object obj = lua[decl.on_event];
-      if (!obj.is<sol::function>()) {
-        continue;
-      }
+  if (!first_event_.empty()) {
+    note_first_event(route.id);
+  }
 
-      sol::function cb = obj.as<sol::function>();
-
-      sol::table tbl = lua.create_table();
-      tbl["device"] = decl.id;
-      tbl["path"] = path;
-      tbl["data"] =
-          std::string_view(reinterpret_cast<const char *>(bytes.data()), bytes.size());
-      tbl["size"] = static_cast<int>(bytes.size());
-      tbl["status"] = "ok";
-
-      sol::protected_function pf = cb;
-      sol::protected_function_result res = pf(tbl);
-      if (!res.valid()) {
-        sol::error err = res;
-        std::fprintf(stderr, "Lua gatt_callback error: %s\n", err.what());
-      }
-    }
+  if (route.on_event.empty()) {
+    return;
+  }
 
-    break;
+  sol::state_view lua(state.lua_vm);
+  sol::object obj = lua[route.on_event];
+  if (!obj.is<sol::function>()) {
+    return;
+  }
+
+  sol::table tbl = lua.create_table();
+  tbl["device"] = route.id;
+  tbl["path"] = path;
+  tbl["characteristic"] = route.characteristic;
+  tbl["data"] = std::string_view(reinterpret_cast<const char *>(data), size);
+  tbl["size"] = static_cast<int>(size);
+  tbl["status"] = "ok";
+
+  CallbackTimer timer(route.on_event);
+  TRACE_SCOPE(TraceCategory::Gatt, "notify", route.id);
+  sol::protected_function pf = obj.as<sol::function>();
+  sol::protected_function_result res = pf(tbl);
+  if (!res.valid()) {
+    sol::error err = res;
+    std::fprintf(stderr, "Lua gatt_callback error: %s\n", err.what());
   }
 }
 
-void DeviceBackendGATT::start_notify(const std::string &char_path) {
-  DBusMessage *msg = dbus_message_new_method_call(
-      "org.bluez", char_path.c_str(), "org.bluez.GattCharacteristic1", "StartNotify"
-  );
+bool DeviceBackendGATT::add_route(const std::string &char_path, const InputDecl &decl) {
+  auto it = routes_.find(char_path);
+  if (it != routes_.end() && it->second.id != decl.id) {
+    std::fprintf(
+        stderr,
+        "GATT: %s: %s is already subscribed by %s\n",
+        decl.id.c_str(),
+        char_path.c_str(),
+        it->second.id.c_str()
+    );
+    return false;
+  }
 
-  DBusMessage *reply = dbus_connection_send_with_reply_and_block(conn_, msg, -1, nullptr);
-  dbus_message_unref(msg);
-  if (reply) {
-    dbus_message_unref(reply);
+  GattRoute route;
+  route.id = decl.id;
+  route.characteristic = characteristic_handle(char_path);
+  route.on_event = route_callback(decl, route.characteristic);
+
+  routes_[char_path] = std::move(route);
+  return true;
+}
+
+void DeviceBackendGATT::refresh_routes(const InputDecl &decl) {
+  for (auto &[_, route] : routes_) {
+    if (route.id == decl.id) {
+      route.on_event = route_callback(decl, route.characteristic);
+    }
   }
 }
 
-void DeviceBackendGATT::stop_notify(const std::string &char_path) {
-  DBusMessage *msg = dbus_message_new_method_call(
-      "org.bluez", char_path.c_str(), "org.bluez.GattCharacteristic1", "StopNotify"
-  );
+std::vector<std::string> DeviceBackendGATT::remove_routes(const std::string &id) {
+  std::vector<std::string> removed;
+  for (auto it = routes_.begin(); it != routes_.end();) {
+    if (it->second.id == id) {
+      removed.push_back(it->first);
+      it = routes_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return removed;
+}
 
-  DBusMessage *reply = dbus_connection_send_with_reply_and_block(conn_, msg, -1, nullptr);
-  dbus_message_unref(msg);
-  if (reply) {
-    dbus_message_unref(reply);
+bool DeviceBackendGATT::device_ready(const std::string &path) {
+  if (!ensure_objects()) {
+    return false;
   }
+  const BluezObject *obj = objects_.find(device_path_of(path));
+  return obj && obj->device && obj->connected && obj->services_resolved;
 }
 
-GattPathType DeviceBackendGATT::classify_gatt_path(const std::string &path) {
-  if (path.find("/char") != std::string::npos) {
-    return GattPathType::Characteristic;
+void DeviceBackendGATT::update_connections() {
+  connections_dirty_ = false;
+  ensure_objects();
+
+  std::unordered_set<std::string> ready = ready_devices();
+
+  auto &state = AelkeyState::instance();
+  auto &manager = DeviceManager::instance();
+  auto &udev = DispatcherUdev::instance();
+
+  // Attached inputs whose device dropped
+  std::vector<std::string> dropped;
+  for (const auto &[id, gatt_path] : gatt_paths_) {
+    if (!ready.contains(device_path_of(gatt_path))) {
+      dropped.push_back(id);
+    }
   }
-  if (path.find("/service") != std::string::npos) {
-    return GattPathType::Service;
+
+  for (const auto &id : dropped) {
+    GattReconnect cached;
+    if (auto it = state.input_map.find(id); it != state.input_map.end()) {
+      cached.devnode = it->second.devnode;
+    }
+    for (const auto &[path, route] : routes_) {
+      if (route.id == id) {
+        cached.char_paths.push_back(path);
+      }
+    }
+
+    auto removed = manager.detach(id);
+    if (!removed || removed->id.empty()) {
+      continue;
+    }
+    reconnects_[id] = std::move(cached);
+    first_event_.erase(id);
+
+    std::fprintf(stderr, "GATT: %s disconnected\n", id.c_str());
+    udev.notify_state_change(*removed, "remove");
   }
-  return GattPathType::Device;
+
+  // Declared inputs whose device is newly ready; one that was ready
+  // before and is not attached was closed by the script
+  for (auto &decl : state.input_decls) {
+    if (decl.type != "gatt" || state.input_map.contains(decl.id)) {
+      continue;
+    }
+
+    std::string devnode;
+    if (!match(decl, devnode)) {
+      continue;
+    }
+    std::string dev_path = device_path_of(devnode);
+    if (ready_devices_.contains(dev_path) || !manager.attach(devnode, decl)) {
+      continue;
+    }
+    decl.devnode = devnode;
+
+    const BluezObject *obj = objects_.find(dev_path);
+    if (obj && obj->connected_ns && obj->resolved_ns >= obj->connected_ns) {
+      uint64_t now = monotonic_ns();
+      std::fprintf(
+          stderr,
+          "GATT: %s connected: services resolved in %.1f ms, subscribing after %.1f ms\n",
+          decl.id.c_str(),
+          static_cast<double>(obj->resolved_ns - obj->connected_ns) / 1e6,
+          static_cast<double>(now - obj->connected_ns) / 1e6
+      );
+      first_event_[decl.id] = obj->connected_ns;
+    }
+
+    udev.notify_state_change(decl, "add");
+  }
+
+  // Write sockets and AcquireWrite refusals do not survive a reconnect
+  for (const auto &dev_path : ready_devices_) {
+    if (!ready.contains(dev_path)) {
+      release_writers(dev_path);
+    }
+  }
+  for (const auto &dev_path : ready) {
+    if (!ready_devices_.contains(dev_path)) {
+      release_writers(dev_path);
+    }
+  }
+
+  ready_devices_ = std::move(ready);
 }
 
-std::string DeviceBackendGATT::derive_device_path_from_char_path(const std::string &char_path) {
-  std::string prefix = "/service";
-  size_t pos = char_path.find(prefix);
-  if (pos == std::string::npos) {
-    return {};
+bool DeviceBackendGATT::resubscribe(const InputDecl &decl, const std::string &devnode) {
+  auto it = reconnects_.find(decl.id);
+  if (it == reconnects_.end()) {
+    return false;
   }
-  return char_path.substr(0, pos);
+  GattReconnect cached = std::move(it->second);
+  reconnects_.erase(it);
+
+  if (cached.devnode != devnode || cached.char_paths.empty()) {
+    return false;
+  }
+
+  // The device's database changed; match it again
+  for (const auto &char_path : cached.char_paths) {
+    const BluezObject *obj = objects_.find(char_path);
+    if (!obj || !obj->characteristic) {
+      return false;
+    }
+  }
+
+  for (const auto &char_path : cached.char_paths) {
+    subscribe(decl, char_path);
+  }
+  return true;
 }
 
-DBusMessage *DeviceBackendGATT::get_managed_objects() {
-  DBusMessage *msg = dbus_message_new_method_call(
-      "org.bluez", "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects"
+void DeviceBackendGATT::note_first_event(const std::string &id) {
+  auto it = first_event_.find(id);
+  if (it == first_event_.end()) {
+    return;
+  }
+
+  double ms = static_cast<double>(monotonic_ns() - it->second) / 1e6;
+  std::fprintf(
+      stderr, "GATT: %s first notification %.1f ms after connecting\n", id.c_str(), ms
   );
+  first_event_.erase(it);
+}
 
-  DBusMessage *resp = dbus_connection_send_with_reply_and_block(conn_, msg, -1, nullptr);
-  dbus_message_unref(msg);
-  return resp;
+int DeviceBackendGATT::service_handle(const std::string &path) {
+  size_t pos = path.rfind("/service");
+  if (pos == std::string::npos) {
+    return 0;
+  }
+  return static_cast<int>(strtoul(path.c_str() + pos + 8, nullptr, 16));
 }
 
-std::string DeviceBackendGATT::get_characteristic_uuid(const std::string &path) {
-  DBusMessage *msg = get_managed_objects();
-  if (!msg) {
-    return "";
+int DeviceBackendGATT::characteristic_handle(const std::string &char_path) {
+  size_t pos = char_path.rfind("/char");
+  if (pos == std::string::npos) {
+    return 0;
   }
+  return static_cast<int>(strtoul(char_path.c_str() + pos + 5, nullptr, 16));
+}
 
-  DBusMessageIter it;
-  dbus_message_iter_init(msg, &it);
+void DeviceBackendGATT::subscribe(const InputDecl &decl, const std::string &char_path) {
+  if (!add_route(char_path, decl)) {
+    return;  // another input's; detaching this one must not unsubscribe it
+  }
 
-  if (dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_ARRAY) {
-    dbus_message_unref(msg);
-    return "";
+  // answered through the loop; a refusal falls back to StartNotify
+  if (!send_acquire(char_path, true)) {
+    start_notify(char_path);
   }
+}
 
-  DBusMessageIter dict;
-  dbus_message_iter_recurse(&it, &dict);
+void DeviceBackendGATT::unsubscribe(const std::string &char_path) {
+  for (const auto &[fd, path] : notify_fds_) {
+    if (path == char_path) {
+      release_notify_fd(fd);  // closing the socket ends the notifications
+      return;
+    }
+  }
 
-  while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
-    DBusMessageIter entry;
-    dbus_message_iter_recurse(&dict, &entry);
+  // AcquireNotify not answered yet: nothing was subscribed
+  for (auto it = acquiring_.begin(); it != acquiring_.end(); ++it) {
+    if (it->second.notify && it->second.char_path == char_path) {
+      dbus_pending_call_cancel(it->second.call);
+      dbus_pending_call_unref(it->second.call);
+      acquiring_.erase(it);
+      return;
+    }
+  }
 
-    const char *object_path = nullptr;
-    dbus_message_iter_get_basic(&entry, &object_path);
+  stop_notify(char_path);
+}
 
-    dbus_message_iter_next(&entry);
+DBusMessage *DeviceBackendGATT::new_acquire_message(
+    const char *method, const std::string &char_path
+) {
+  DBusMessage *msg = dbus_message_new_method_call(
+      "org.bluez", char_path.c_str(), "org.bluez.GattCharacteristic1", method
+  );
+  append_empty_options(msg);
+  return msg;
+}
 
-    if (dbus_message_iter_get_arg_type(&entry) != DBUS_TYPE_ARRAY) {
-      dbus_message_iter_next(&dict);
-      continue;
+int DeviceBackendGATT::acquired_socket(
+    const char *method, const std::string &char_path, DBusMessage *reply, DBusError &err,
+    uint16_t &mtu
+) {
+  // reply is (h fd, q mtu)
+  int fd = -1;
+  if (reply && !dbus_set_error_from_message(&err, reply)) {
+    if (!dbus_message_get_args(
+            reply, &err, DBUS_TYPE_UNIX_FD, &fd, DBUS_TYPE_UINT16, &mtu, DBUS_TYPE_INVALID
+        )) {
+      fd = -1;
     }
+  }
 
-    DBusMessageIter iface_dict;
-    dbus_message_iter_recurse(&entry, &iface_dict);
+  if (fd < 0) {
+    // older BlueZ, missing flag, or already acquired by another client
+    std::fprintf(
+        stderr,
+        "GATT: %s %s: %s, using D-Bus\n",
+        method,
+        char_path.c_str(),
+        dbus_error_is_set(&err) ? err.message : "no socket"
+    );
+    dbus_error_free(&err);
+    return -1;
+  }
 
-    if (object_path && path == object_path) {
-      while (dbus_message_iter_get_arg_type(&iface_dict) == DBUS_TYPE_DICT_ENTRY) {
-        DBusMessageIter iface_entry;
-        dbus_message_iter_recurse(&iface_dict, &iface_entry);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
 
-        const char *iface_name = nullptr;
-        dbus_message_iter_get_basic(&iface_entry, &iface_name);
+bool DeviceBackendGATT::send_acquire(const std::string &char_path, bool notify) {
+  if (!dbus_connection_can_send_type(conn_, DBUS_TYPE_UNIX_FD)) {
+    return false;
+  }
 
-        dbus_message_iter_next(&iface_entry);
+  const char *method = notify ? "AcquireNotify" : "AcquireWrite";
+  DBusMessage *msg = new_acquire_message(method, char_path);
+  DBusPendingCall *call = nullptr;
+  bool sent = dbus_connection_send_with_reply(conn_, msg, &call, -1);
+  dbus_message_unref(msg);
+  if (!sent || !call) {
+    return false;
+  }
 
-        if (!iface_name || strcmp(iface_name, "org.bluez.GattCharacteristic1") != 0) {
-          dbus_message_iter_next(&iface_dict);
-          continue;
-        }
+  uint64_t id = next_request_++;
+  auto *key = reinterpret_cast<void *>(static_cast<uintptr_t>(id));
+  if (!dbus_pending_call_set_notify(call, on_acquired, key, nullptr)) {
+    dbus_pending_call_cancel(call);
+    dbus_pending_call_unref(call);
+    return false;
+  }
+  acquiring_[id] = GattAcquire{ char_path, call, notify };
 
-        if (dbus_message_iter_get_arg_type(&iface_entry) != DBUS_TYPE_ARRAY) {
-          dbus_message_iter_next(&iface_dict);
-          continue;
-        }
+  if (dbus_pending_call_get_completed(call)) {
+    acquired(id);
+  }
+  return true;
+}
+
+void DeviceBackendGATT::on_acquired(DBusPendingCall *, void *data) {
+  instance().acquired(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(data)));
+}
+
+void DeviceBackendGATT::acquired(uint64_t id) {
+  auto it = acquiring_.find(id);
+  if (it == acquiring_.end()) {
+    return;
+  }
+  GattAcquire acquire = std::move(it->second);
+  acquiring_.erase(it);
 
-        DBusMessageIter props_dict;
-        dbus_message_iter_recurse(&iface_entry, &props_dict);
+  DBusMessage *reply = dbus_pending_call_steal_reply(acquire.call);
+  dbus_pending_call_unref(acquire.call);
 
-        while (dbus_message_iter_get_arg_type(&props_dict) == DBUS_TYPE_DICT_ENTRY) {
-          DBusMessageIter prop_entry;
-          dbus_message_iter_recurse(&props_dict, &prop_entry);
+  DBusError err;
+  dbus_error_init(&err);
+  uint16_t mtu = 0;
+  const char *method = acquire.notify ? "AcquireNotify" : "AcquireWrite";
+  int fd = acquired_socket(method, acquire.char_path, reply, err, mtu);
+  if (reply) {
+    dbus_message_unref(reply);
+  }
 
-          const char *prop_name = nullptr;
-          dbus_message_iter_get_basic(&prop_entry, &prop_name);
+  if (acquire.notify) {
+    notify_acquired(acquire.char_path, fd);
+  } else {
+    writer_acquired(acquire.char_path, fd, mtu);
+  }
+}
 
-          dbus_message_iter_next(&prop_entry);
+void DeviceBackendGATT::notify_acquired(const std::string &char_path, int fd) {
+  if (fd < 0) {
+    start_notify(char_path);  // refused: PropertiesChanged signals instead
+    return;
+  }
 
-          if (!prop_name || strcmp(prop_name, "UUID") != 0) {
-            dbus_message_iter_next(&props_dict);
-            continue;
-          }
+  notify_fds_[fd] = char_path;
+  DispatcherGATT::instance().register_fd(fd, EPOLLIN);
+}
 
-          if (dbus_message_iter_get_arg_type(&prop_entry) != DBUS_TYPE_VARIANT) {
-            dbus_message_iter_next(&props_dict);
-            continue;
-          }
+void DeviceBackendGATT::release_notify_fd(int fd) {
+  DispatcherGATT::instance().unregister_fd(fd);
+  close(fd);
+  notify_fds_.erase(fd);
+}
 
-          DBusMessageIter variant;
-          dbus_message_iter_recurse(&prop_entry, &variant);
+void DeviceBackendGATT::dispatch_status(
+    DBusConnection *, DBusDispatchStatus status, void *data
+) {
+  // must not dispatch from here; the loop does it when the fd is ready
+  auto *self = static_cast<DeviceBackendGATT *>(data);
+  if (status == DBUS_DISPATCH_DATA_REMAINS && self->dispatch_fd_ >= 0) {
+    uint64_t one = 1;
+    if (write(self->dispatch_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+      perror("GATT: write eventfd");
+    }
+  }
+}
 
-          const char *uuid = nullptr;
-          dbus_message_iter_get_basic(&variant, &uuid);
+void DeviceBackendGATT::handle_socket(int fd, uint32_t events) {
+  if (fd == timer_fd_) {
+    handle_timeouts();
+  } else if (fd == dispatch_fd_) {
+    uint64_t count;
+    if (read(dispatch_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+      perror("GATT: read eventfd");
+    }
+    pump_messages();
+  } else if (notify_fds_.contains(fd)) {
+    read_notify_fd(fd, events);
+  } else if (writers_.contains(fd)) {
+    drain_writes(fd, events);
+  }
+}
 
-          std::string result = uuid ? uuid : "";
-          dbus_message_unref(msg);
-          return result;
+void DeviceBackendGATT::read_notify_fd(int fd, uint32_t events) {
+  auto it = notify_fds_.find(fd);
+  if (it == notify_fds_.end()) {
+    return;
+  }
+  std::string path = it->second;  // a callback may detach the input
+
+  if (events & EPOLLIN) {
+    // one notification per read (SOCK_SEQPACKET)
+    uint8_t buf[MAX_NOTIFY_SIZE];
+    for (;;) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        deliver_notification(path, buf, static_cast<size_t>(n));
+        if (!notify_fds_.contains(fd)) {
+          return;
         }
-
-        dbus_message_iter_next(&iface_dict);
+        continue;
       }
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+      }
+      break;  // closed by BlueZ
     }
-
-    dbus_message_iter_next(&dict);
+  } else if (!(events & (EPOLLHUP | EPOLLERR))) {
+    return;
   }
 
-  dbus_message_unref(msg);
-  return "";
+  std::fprintf(stderr, "GATT: notifications for %s ended\n", path.c_str());
+  release_notify_fd(fd);
 }
 
-std::vector<std::string> DeviceBackendGATT::get_characteristic_flags(const std::string &path) {
-  std::vector<std::string> out;
+void DeviceBackendGATT::start_notify(const std::string &char_path) {
+  std::string rule = notify_match_rule(char_path);
+  dbus_bus_add_match(conn_, rule.c_str(), nullptr);  // no error: not waited for
+  notify_call("StartNotify", char_path);
+}
+
+void DeviceBackendGATT::stop_notify(const std::string &char_path) {
+  notify_call("StopNotify", char_path);
+  std::string rule = notify_match_rule(char_path);
+  dbus_bus_remove_match(conn_, rule.c_str(), nullptr);
+}
 
-  DBusMessage *msg = get_managed_objects();
-  if (!msg) {
-    return out;
+void DeviceBackendGATT::notify_call(const char *method, const std::string &char_path) {
+  DBusMessage *msg = dbus_message_new_method_call(
+      "org.bluez", char_path.c_str(), "org.bluez.GattCharacteristic1", method
+  );
+
+  // the reply only matters when it is an error
+  GattCompletion done = [method, path = char_path](const GattResult &result) {
+    if (result.status != "ok") {
+      std::fprintf(stderr, "GATT: %s %s: %s\n", method, path.c_str(), result.error.c_str());
+    }
+  };
+  send_async(msg, false, DBUS_TIMEOUT_USE_DEFAULT, std::move(done));
+}
+
+GattPathType DeviceBackendGATT::classify_gatt_path(const std::string &path) {
+  if (path.find("/char") != std::string::npos) {
+    return GattPathType::Characteristic;
   }
+  if (path.find("/service") != std::string::npos) {
+    return GattPathType::Service;
+  }
+  return GattPathType::Device;
+}
 
-  DBusMessageIter it, dict;
-  dbus_message_iter_init(msg, &it);
-  dbus_message_iter_recurse(&it, &dict);
+std::string DeviceBackendGATT::device_path_of(const std::string &path) {
+  std::string device_path = derive_device_path_from_char_path(path);
+  return device_path.empty() ? path : device_path;
+}
 
-  while (dbus_message_iter_get_arg_type(&dict) != DBUS_TYPE_INVALID) {
-    DBusMessageIter entry, iface_dict;
-    const char *object_path = nullptr;
+std::string DeviceBackendGATT::derive_device_path_from_char_path(const std::string &char_path) {
+  std::string prefix = "/service";
+  size_t pos = char_path.find(prefix);
+  if (pos == std::string::npos) {
+    return {};
+  }
+  return char_path.substr(0, pos);
+}
 
-    dbus_message_iter_recurse(&dict, &entry);
-    dbus_message_iter_get_basic(&entry, &object_path);
-    dbus_message_iter_next(&entry);
-    dbus_message_iter_recurse(&entry, &iface_dict);
-
-    if (object_path && path == object_path) {
-      while (dbus_message_iter_get_arg_type(&iface_dict) != DBUS_TYPE_INVALID) {
-        DBusMessageIter props_dict;
-        const char *iface_name = nullptr;
-
-        dbus_message_iter_recurse(&iface_dict, &props_dict);
-        dbus_message_iter_get_basic(&props_dict, &iface_name);
-        dbus_message_iter_next(&props_dict);
-
-        if (iface_name && strcmp(iface_name, "org.bluez.GattCharacteristic1") == 0) {
-          DBusMessageIter prop_entry;
-          dbus_message_iter_recurse(&props_dict, &prop_entry);
-
-          while (dbus_message_iter_get_arg_type(&prop_entry) != DBUS_TYPE_INVALID) {
-            DBusMessageIter prop, variant;
-            const char *prop_name = nullptr;
-
-            dbus_message_iter_recurse(&prop_entry, &prop);
-            dbus_message_iter_get_basic(&prop, &prop_name);
-            dbus_message_iter_next(&prop);
-            dbus_message_iter_recurse(&prop, &variant);
-
-            if (prop_name && strcmp(prop_name, "Flags") == 0) {
-              DBusMessageIter array;
-              dbus_message_iter_recurse(&variant, &array);
-
-              while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRING) {
-                const char *flag = nullptr;
-                dbus_message_iter_get_basic(&array, &flag);
-                if (flag) {
-                  out.emplace_back(flag);
-                }
-                dbus_message_iter_next(&array);
-              }
-
-              dbus_message_unref(msg);
-              return out;
-            }
-
-            dbus_message_iter_next(&prop_entry);
-          }
-        }
+bool DeviceBackendGATT::ensure_objects() {
+  if (objects_.loaded()) {
+    return true;
+  }
+  if (!objects_.load(conn_)) {
+    return false;
+  }
 
-        dbus_message_iter_next(&iface_dict);
-      }
-    }
+  // Devices ready at load are not newly ready: the first update must
+  // not reattach inputs the script closed before any Device1 signal
+  ready_devices_ = ready_devices();
+  return true;
+}
 
-    dbus_message_iter_next(&dict);
+std::unordered_set<std::string> DeviceBackendGATT::ready_devices() const {
+  std::unordered_set<std::string> ready;
+  for (const auto &[path, obj] : objects_.objects()) {
+    if (obj.device && obj.connected && obj.services_resolved) {
+      ready.insert(path);
+    }
   }
+  return ready;
+}
 
-  dbus_message_unref(msg);
-  return out;
+std::string DeviceBackendGATT::get_characteristic_uuid(const std::string &path) {
+  ensure_objects();
+  const BluezObject *obj = objects_.find(path);
+  return obj ? obj->uuid : "";
+}
+
+std::vector<std::string> DeviceBackendGATT::get_characteristic_flags(const std::string &path) {
+  ensure_objects();
+  const BluezObject *obj = objects_.find(path);
+  return obj ? obj->flags : std::vector<std::string>{};
 }
 
 void DeviceBackendGATT::print_characteristic_inspect_line(const std::string &ch) {
@@ -413,102 +765,49 @@ void DeviceBackendGATT::print_characteristic_inspect_line(const std::string &ch)
 }
 
 bool DeviceBackendGATT::characteristic_supports_notify(const std::string &char_path) {
-  DBusMessage *msg;
-  DBusMessage *reply;
-  DBusMessageIter args;
-
-  msg = dbus_message_new_method_call(
-      "org.bluez", char_path.c_str(), "org.freedesktop.DBus.Properties", "Get"
-  );
-
-  const char *iface = "org.bluez.GattCharacteristic1";
-  const char *prop = "Flags";
-
-  dbus_message_append_args(
-      msg, DBUS_TYPE_STRING, &iface, DBUS_TYPE_STRING, &prop, DBUS_TYPE_INVALID
-  );
-
-  reply = dbus_connection_send_with_reply_and_block(conn_, msg, -1, nullptr);
-  dbus_message_unref(msg);
-
-  if (!reply) {
-    return false;
-  }
-
-  dbus_message_iter_init(reply, &args);
-
-  // Flags is an array of strings
-  DBusMessageIter variant, array;
-  dbus_message_iter_recurse(&args, &variant);
-  dbus_message_iter_recurse(&variant, &array);
-
-  bool supports = false;
-
-  while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRING) {
-    const char *flag;
-    dbus_message_iter_get_basic(&array, &flag);
-
-    if (strcmp(flag, "notify") == 0) {
-      supports = true;
-      break;
-    }
-
-    dbus_message_iter_next(&array);
-  }
-
-  dbus_message_unref(reply);
-  return supports;
+  auto flags = get_characteristic_flags(char_path);
+  return std::find(flags.begin(), flags.end(), "notify") != flags.end();
 }
 
 std::string DeviceBackendGATT::resolve_gatt_paths(
     const InputDecl &decl,
     std::vector<std::string> *found_characteristics
 ) {
-  DBusMessage *resp = get_managed_objects();
-  if (!resp) {
+  if (!ensure_objects()) {
     return {};
   }
 
-  DBusMessageIter iter, dict;
+  // A UUID selects characteristics, as a handle does
+  bool by_uuid = !decl.uuid.empty();
 
-  dbus_message_iter_init(resp, &iter);
-  dbus_message_iter_recurse(&iter, &dict);
-
-  auto devices = get_matching_devices(decl, dict);
+  auto devices = get_matching_devices(decl);
   if (devices.empty()) {
-    dbus_message_unref(resp);
     return {};
   }
 
-  if (!decl.service && !found_characteristics) {
-    dbus_message_unref(resp);
+  if (!decl.service && !by_uuid && !found_characteristics) {
     return devices[0];
   }
 
-  dbus_message_iter_init(resp, &iter);
-  dbus_message_iter_recurse(&iter, &dict);
-
-  auto services = get_matching_services(decl, devices, dict);
+  auto services = get_matching_services(decl, devices);
   if (services.empty()) {
-    dbus_message_unref(resp);
     return {};
   }
 
-  if (!decl.characteristic && !found_characteristics) {
-    dbus_message_unref(resp);
+  if (!decl.characteristic && !by_uuid && !found_characteristics) {
     return services[0];
   }
 
-  dbus_message_iter_init(resp, &iter);
-  dbus_message_iter_recurse(&iter, &dict);
-
-  auto characteristics = get_matching_characteristics(decl, services, dict);
+  auto characteristics = get_matching_characteristics(decl, services);
 
   if (found_characteristics) {
     *found_characteristics = characteristics;
   }
 
-  dbus_message_unref(resp);
+  if (by_uuid && characteristics.empty()) {
+    std::fprintf(stderr, "GATT match: no characteristic with uuid %s\n", decl.uuid.c_str());
+    return {};
+  }
 
   if (!decl.service) {
     return devices[0];
@@ -526,88 +825,48 @@ std::string DeviceBackendGATT::resolve_gatt_paths(
   return characteristics[0];
 }
 
-std::vector<std::string>
-DeviceBackendGATT::get_matching_devices(const InputDecl &decl, DBusMessageIter &array) {
+std::vector<std::string> DeviceBackendGATT::get_matching_devices(const InputDecl &decl) {
   std::vector<std::string> result;
 
-  DBusMessageIter it = array;
-
-  while (dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_INVALID) {
-    DBusMessageIter entry, iface_dict;
-    const char *object_path = nullptr;
+  // Exact uniq (Bluetooth MAC address) and name are index lookups;
+  // patterns are tried against every device
+  if (!decl.uniq.empty() && !looks_like_regex(decl.uniq) &&
+      (decl.name.empty() || !looks_like_regex(decl.name))) {
+    result = objects_.devices_by_address(decl.uniq);
+    if (!decl.name.empty()) {
+      auto named = objects_.devices_by_name(decl.name);
+      result.insert(result.end(), named.begin(), named.end());
+      std::sort(result.begin(), result.end());
+      result.erase(std::unique(result.begin(), result.end()), result.end());
+    }
+    return result;
+  }
 
-    dbus_message_iter_recurse(&it, &entry);
-    dbus_message_iter_get_basic(&entry, &object_path);
-    dbus_message_iter_next(&entry);
-    dbus_message_iter_recurse(&entry, &iface_dict);
-
-    bool is_device = false;
-    std::string name, alias, address;
-
-    while (dbus_message_iter_get_arg_type(&iface_dict) != DBUS_TYPE_INVALID) {
-      DBusMessageIter props;
-      const char *iface_name = nullptr;
-
-      dbus_message_iter_recurse(&iface_dict, &props);
-      dbus_message_iter_get_basic(&props, &iface_name);
-      dbus_message_iter_next(&props);
-
-      if (iface_name && strcmp(iface_name, "org.bluez.Device1") == 0) {
-        is_device = true;
-
-        DBusMessageIter prop_dict;
-        dbus_message_iter_recurse(&props, &prop_dict);
-
-        while (dbus_message_iter_get_arg_type(&prop_dict) != DBUS_TYPE_INVALID) {
-          DBusMessageIter prop_entry, var;
-          const char *key = nullptr;
-
-          dbus_message_iter_recurse(&prop_dict, &prop_entry);
-          dbus_message_iter_get_basic(&prop_entry, &key);
-          dbus_message_iter_next(&prop_entry);
-          dbus_message_iter_recurse(&prop_entry, &var);
-
-          if (strcmp(key, "Name") == 0) {
-            const char *v = nullptr;
-            dbus_message_iter_get_basic(&var, &v);
-            name = v ? v : "";
-          } else if (strcmp(key, "Alias") == 0) {
-            const char *v = nullptr;
-            dbus_message_iter_get_basic(&var, &v);
-            alias = v ? v : "";
-          } else if (strcmp(key, "Address") == 0) {
-            const char *v = nullptr;
-            dbus_message_iter_get_basic(&var, &v);
-            address = v ? v : "";
-          }
-
-          dbus_message_iter_next(&prop_dict);
-        }
-      }
+  if (decl.uniq.empty() && !decl.name.empty() && !looks_like_regex(decl.name)) {
+    return objects_.devices_by_name(decl.name);
+  }
 
-      dbus_message_iter_next(&iface_dict);
+  for (const auto &[path, obj] : objects_.objects()) {
+    if (!obj.device) {
+      continue;
     }
 
-    if (is_device) {
-      bool match = false;
+    bool match = false;
 
-      // Match uniq (Bluetooth MAC address)
-      if (!decl.uniq.empty() && match_string(decl.uniq, address)) {
-        match = true;
-      }
-
-      // Match name or alias
-      if (!match && !decl.name.empty() &&
-          (match_string(decl.name, name) || match_string(decl.name, alias))) {
-        match = true;
-      }
+    // Match uniq (Bluetooth MAC address)
+    if (!decl.uniq.empty() && match_string(decl.uniq, obj.address)) {
+      match = true;
+    }
 
-      if (match) {
-        result.push_back(object_path);
-      }
+    // Match name or alias
+    if (!match && !decl.name.empty() &&
+        (match_string(decl.name, obj.name) || match_string(decl.name, obj.alias))) {
+      match = true;
     }
 
-    dbus_message_iter_next(&it);
+    if (match) {
+      result.push_back(path);
+    }
   }
 
   return result;
@@ -615,52 +874,16 @@ DeviceBackendGATT::get_matching_devices(const InputDecl &decl, DBusMessageIter &
 
 std::vector<std::string> DeviceBackendGATT::get_matching_services(
     const InputDecl &decl,
-    const std::vector<std::string> &candidate_devices,
-    DBusMessageIter &array
+    const std::vector<std::string> &candidate_devices
 ) {
   std::vector<std::string> result;
 
   for (const auto &dev_path : candidate_devices) {
-    DBusMessageIter it = array;
-
-    while (dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_INVALID) {
-      DBusMessageIter entry, iface_dict;
-      const char *object_path = nullptr;
-
-      dbus_message_iter_recurse(&it, &entry);
-      dbus_message_iter_get_basic(&entry, &object_path);
-      dbus_message_iter_next(&entry);
-      dbus_message_iter_recurse(&entry, &iface_dict);
-
-      while (dbus_message_iter_get_arg_type(&iface_dict) != DBUS_TYPE_INVALID) {
-        DBusMessageIter props;
-        const char *iface_name = nullptr;
-
-        dbus_message_iter_recurse(&iface_dict, &props);
-        dbus_message_iter_get_basic(&props, &iface_name);
-        dbus_message_iter_next(&props);
-
-        if (iface_name && strcmp(iface_name, "org.bluez.GattService1") == 0 &&
-            strstr(object_path, dev_path.c_str()) == object_path) {
-          const char *p = strstr(object_path, "service");
-          if (p) {
-            int handle = strtoul(p + 7, nullptr, 16);
-            if (decl.service == 0) {
-              // No specific service requested → return all services under the device
-              result.push_back(object_path);
-            } else {
-              // Match specific service handle
-              if (handle == decl.service) {
-                result.push_back(object_path);
-              }
-            }
-          }
-        }
-
-        dbus_message_iter_next(&iface_dict);
+    for (auto &svc_path : objects_.services_of(dev_path)) {
+      // No specific service requested → all services under the device
+      if (decl.service == 0 || service_handle(svc_path) == decl.service) {
+        result.push_back(std::move(svc_path));
       }
-
-      dbus_message_iter_next(&it);
     }
   }
 
@@ -669,51 +892,32 @@ std::vector<std::string> DeviceBackendGATT::get_matching_services(
 
 std::vector<std::string> DeviceBackendGATT::get_matching_characteristics(
     const InputDecl &decl,
-    const std::vector<std::string> &candidate_services,
-    DBusMessageIter &array
+    const std::vector<std::string> &candidate_services
 ) {
   std::vector<std::string> result;
 
-  for (const auto &svc_path : candidate_services) {
-    DBusMessageIter it = array;  // fresh scan for each service
-
-    while (dbus_message_iter_get_arg_type(&it) != DBUS_TYPE_INVALID) {
-      DBusMessageIter entry, iface_dict;
-      const char *object_path = nullptr;
-
-      dbus_message_iter_recurse(&it, &entry);
-      dbus_message_iter_get_basic(&entry, &object_path);
-      dbus_message_iter_next(&entry);
-      dbus_message_iter_recurse(&entry, &iface_dict);
-
-      while (dbus_message_iter_get_arg_type(&iface_dict) != DBUS_TYPE_INVALID) {
-        DBusMessageIter props;
-        const char *iface_name = nullptr;
-
-        dbus_message_iter_recurse(&iface_dict, &props);
-        dbus_message_iter_get_basic(&props, &iface_name);
-        dbus_message_iter_next(&props);
-
-        if (iface_name && strcmp(iface_name, "org.bluez.GattCharacteristic1") == 0 &&
-            strstr(object_path, svc_path.c_str()) == object_path) {
-          const char *p = strstr(object_path, "char");
-          if (p) {
-            int handle = strtoul(p + 4, nullptr, 16);
-            if (decl.characteristic == 0) {
-              // No specific characteristic requested → collect all
-              result.push_back(object_path);
-            } else {
-              if (handle == decl.characteristic) {
-                result.push_back(object_path);
-              }
-            }
-          }
-        }
-
-        dbus_message_iter_next(&iface_dict);
+  if (!decl.uuid.empty()) {
+    for (auto &char_path : objects_.by_uuid(decl.uuid)) {
+      const BluezObject *obj = objects_.find(char_path);
+      std::string svc_path = char_path.substr(0, char_path.rfind('/'));
+      if (!obj || !obj->characteristic ||
+          std::find(candidate_services.begin(), candidate_services.end(), svc_path) ==
+              candidate_services.end()) {
+        continue;
+      }
+      if (decl.characteristic == 0 || characteristic_handle(char_path) == decl.characteristic) {
+        result.push_back(std::move(char_path));
       }
+    }
+    return result;
+  }
 
-      dbus_message_iter_next(&it);
+  for (const auto &svc_path : candidate_services) {
+    for (auto &char_path : objects_.characteristics_of(svc_path)) {
+      // No specific characteristic requested → collect all
+      if (decl.characteristic == 0 || characteristic_handle(char_path) == decl.characteristic) {
+        result.push_back(std::move(char_path));
+      }
     }
   }
 
@@ -731,17 +935,7 @@ bool DeviceBackendGATT::read_characteristic(
     return false;
   }
 
-  DBusMessage *msg = dbus_message_new_method_call(
-      "org.bluez", char_path.c_str(), "org.bluez.GattCharacteristic1", "ReadValue"
-  );
-
-  // Append empty a{sv} options
-  DBusMessageIter args;
-  dbus_message_iter_init_append(msg, &args);
-  DBusMessageIter dict;
-  dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "{sv}", &dict);
-  dbus_message_iter_close_container(&args, &dict);
-
+  DBusMessage *msg = new_read_message(char_path);
   DBusMessage *reply = dbus_connection_send_with_reply_and_block(conn_, msg, -1, nullptr);
   dbus_message_unref(msg);
 
@@ -749,37 +943,204 @@ bool DeviceBackendGATT::read_characteristic(
     return false;
   }
 
-  DBusMessageIter iter;
-  dbus_message_iter_init(reply, &iter);
+  std::span<const uint8_t> value = dbus_byte_array(reply);
+  out_data.assign(value.begin(), value.end());
+  dbus_message_unref(reply);
+  return true;
+}
+
+int DeviceBackendGATT::writer_fd(const std::string &char_path) {
+  auto it = writer_paths_.find(char_path);
+  if (it != writer_paths_.end()) {
+    return it->second;
+  }
+
+  // asked without waiting; writes use WriteValue until the socket is in
+  writer_paths_[char_path] = -1;
+  send_acquire(char_path, false);
+  return -1;
+}
+
+void DeviceBackendGATT::writer_acquired(const std::string &char_path, int fd, uint16_t mtu) {
+  if (fd < 0) {
+    return;  // refused: WriteValue until the device reconnects
+  }
+
+  auto path = writer_paths_.find(char_path);
+  if (path == writer_paths_.end() || path->second >= 0) {
+    close(fd);  // released meanwhile
+    return;
+  }
+  path->second = fd;
 
-  // Reply is: ay
-  if (dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY) {
-    DBusMessageIter array;
-    dbus_message_iter_recurse(&iter, &array);
+  GattWriter &writer = writers_[fd];
+  writer.char_path = char_path;
+  writer.max_size = mtu > 3 ? mtu - 3u : 0;
 
-    while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_BYTE) {
-      uint8_t b;
-      dbus_message_iter_get_basic(&array, &b);
-      out_data.push_back(b);
-      dbus_message_iter_next(&array);
+  // only hangups until a write has to wait
+  DispatcherGATT::instance().register_fd(fd, 0);
+}
+
+bool DeviceBackendGATT::queue_write(int fd, const uint8_t *data, size_t len, bool coalesce) {
+  GattWriter &writer = writers_[fd];
+  if (len > writer.max_size) {
+    return false;  // does not fit one packet
+  }
+
+  if (writer.queue.empty()) {
+    ssize_t n;
+    do {
+      n = write(fd, data, len);
+    } while (n < 0 && errno == EINTR);
+
+    if (n >= 0) {
+      return true;  // one packet, never partial
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      std::fprintf(stderr, "GATT: write %s: %s\n", writer.char_path.c_str(), strerror(errno));
+      release_writer(fd);
+      return false;
     }
   }
 
-  dbus_message_unref(reply);
+  if (coalesce) {
+    writer.queue.clear();  // superseded by this value
+  } else if (writer.queue.size() >= MAX_WRITE_QUEUE) {
+    return false;
+  }
+
+  bool was_empty = writer.queue.empty();
+  writer.queue.emplace_back(data, data + len);
+  if (was_empty) {
+    DispatcherGATT::instance().modify_fd(fd, EPOLLOUT);
+  }
   return true;
 }
 
+void DeviceBackendGATT::drain_writes(int fd, uint32_t events) {
+  GattWriter &writer = writers_[fd];
+
+  if (events & EPOLLOUT) {
+    while (!writer.queue.empty()) {
+      const auto &packet = writer.queue.front();
+      ssize_t n = write(fd, packet.data(), packet.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+      }
+      if (n < 0) {
+        events |= EPOLLERR;
+        break;
+      }
+      writer.queue.pop_front();
+    }
+
+    if (writer.queue.empty()) {
+      DispatcherGATT::instance().modify_fd(fd, 0);
+    }
+  }
+
+  if (events & (EPOLLHUP | EPOLLERR)) {
+    // disconnected; the next write acquires a new socket
+    std::fprintf(stderr, "GATT: write socket for %s closed\n", writer.char_path.c_str());
+    release_writer(fd);
+  }
+}
+
+void DeviceBackendGATT::release_writer(int fd) {
+  auto it = writers_.find(fd);
+  if (it == writers_.end()) {
+    return;
+  }
+
+  DispatcherGATT::instance().unregister_fd(fd);
+  close(fd);
+  writer_paths_.erase(it->second.char_path);
+  writers_.erase(it);
+}
+
+void DeviceBackendGATT::release_writers(const std::string &device_path) {
+  if (device_path.empty()) {
+    return;
+  }
+  std::string prefix = device_path + "/";
+
+  std::vector<int> fds;
+  for (const auto &[fd, writer] : writers_) {
+    if (writer.char_path.starts_with(prefix)) {
+      fds.push_back(fd);
+    }
+  }
+  for (int fd : fds) {
+    release_writer(fd);
+  }
+
+  // refusals and requests in flight: ask again on the next write
+  std::erase_if(writer_paths_, [&](const auto &kv) { return kv.first.starts_with(prefix); });
+  for (auto it = acquiring_.begin(); it != acquiring_.end();) {
+    if (!it->second.notify && it->second.char_path.starts_with(prefix)) {
+      dbus_pending_call_cancel(it->second.call);
+      dbus_pending_call_unref(it->second.call);
+      it = acquiring_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 bool DeviceBackendGATT::write_characteristic(
     const std::string &char_path,
     const uint8_t *data,
     size_t len,
-    bool with_resp
+    bool with_resp,
+    bool coalesce
 ) {
   lazy_init();
   if (!conn_) {
     return false;
   }
 
+  if (!with_resp) {
+    int fd = writer_fd(char_path);
+    if (fd >= 0 && queue_write(fd, data, len, coalesce)) {
+      return true;
+    }
+  }
+
+  // WriteValue without waiting: before the socket arrives, after a
+  // refusal, over the MTU, or behind a full queue
+  DBusMessage *msg = new_write_message(char_path, data, len, with_resp);
+
+  if (!with_resp) {
+    dbus_message_set_no_reply(msg, TRUE);  // nobody waits for the answer
+    bool sent = dbus_connection_send(conn_, msg, nullptr);
+    dbus_message_unref(msg);
+    dbus_connection_read_write(conn_, 0);  // the rest goes with the next read_write
+    return sent;
+  }
+
+  // with response, a failure can only be logged; write_async reports it
+  GattCompletion done = [path = char_path](const GattResult &result) {
+    if (result.status != "ok") {
+      std::fprintf(stderr, "GATT: write %s: %s\n", path.c_str(), result.error.c_str());
+    }
+  };
+  return send_async(msg, false, DBUS_TIMEOUT_USE_DEFAULT, std::move(done)) != 0;
+}
+
+DBusMessage *DeviceBackendGATT::new_read_message(const std::string &char_path) {
+  DBusMessage *msg = dbus_message_new_method_call(
+      "org.bluez", char_path.c_str(), "org.bluez.GattCharacteristic1", "ReadValue"
+  );
+  append_empty_options(msg);
+  return msg;
+}
+
+DBusMessage *DeviceBackendGATT::new_write_message(
+    const std::string &char_path, const uint8_t *data, size_t len, bool with_resp
+) {
   DBusMessage *msg = dbus_message_new_method_call(
       "org.bluez", char_path.c_str(), "org.bluez.GattCharacteristic1", "WriteValue"
   );
@@ -788,13 +1149,7 @@ bool DeviceBackendGATT::write_characteristic(
   dbus_message_iter_init_append(msg, &args);
 
   // First argument: ay (byte array)
-  DBusMessageIter array;
-  dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "y", &array);
-  for (size_t i = 0; i < len; ++i) {
-    uint8_t b = data[i];
-    dbus_message_iter_append_basic(&array, DBUS_TYPE_BYTE, &b);
-  }
-  dbus_message_iter_close_container(&args, &array);
+  dbus_append_byte_array(&args, data, len);
 
   // Second argument: a{sv} options
   DBusMessageIter opts;
@@ -820,13 +1175,220 @@ bool DeviceBackendGATT::write_characteristic(
 
   dbus_message_iter_close_container(&args, &opts);
 
-  DBusMessage *reply = dbus_connection_send_with_reply_and_block(conn_, msg, -1, nullptr);
+  return msg;
+}
+
+uint64_t DeviceBackendGATT::read_async(
+    const std::string &char_path, int timeout_ms, GattCompletion done
+) {
+  lazy_init();
+  if (!conn_ || char_path.empty()) {
+    return 0;
+  }
+  return send_async(new_read_message(char_path), true, timeout_ms, std::move(done));
+}
+
+uint64_t DeviceBackendGATT::write_async(
+    const std::string &char_path,
+    const uint8_t *data,
+    size_t len,
+    bool with_resp,
+    int timeout_ms,
+    GattCompletion done
+) {
+  lazy_init();
+  if (!conn_ || char_path.empty()) {
+    return 0;
+  }
+  DBusMessage *msg = new_write_message(char_path, data, len, with_resp);
+  return send_async(msg, false, timeout_ms, std::move(done));
+}
+
+uint64_t DeviceBackendGATT::send_async(
+    DBusMessage *msg, bool read, int timeout_ms, GattCompletion done
+) {
+  DBusPendingCall *call = nullptr;
+  bool sent = dbus_connection_send_with_reply(conn_, msg, &call, timeout_ms);
   dbus_message_unref(msg);
 
+  // call is null once the connection is gone
+  if (!sent || !call) {
+    std::fprintf(stderr, "GATT: failed to send request\n");
+    return 0;
+  }
+
+  uint64_t id = next_request_++;
+  auto *key = reinterpret_cast<void *>(static_cast<uintptr_t>(id));
+  if (!dbus_pending_call_set_notify(call, on_reply, key, nullptr)) {
+    dbus_pending_call_cancel(call);
+    dbus_pending_call_unref(call);
+    return 0;
+  }
+
+  requests_[id] = GattRequest{ read, call, std::move(done) };
+
+  // Writes out what the socket takes; the rest goes with the next read_write
+  dbus_connection_read_write(conn_, 0);
+
+  // Completed already (disconnected); callers only hear of requests
+  // that were sent, and never from inside read_async/write_async
+  if (dbus_pending_call_get_completed(call)) {
+    cancel(id);
+    return 0;
+  }
+  return id;
+}
+
+void DeviceBackendGATT::on_reply(DBusPendingCall *, void *data) {
+  instance().complete(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(data)));
+}
+
+void DeviceBackendGATT::complete(uint64_t id) {
+  auto it = requests_.find(id);
+  if (it == requests_.end()) {
+    return;
+  }
+
+  GattRequest req = std::move(it->second);
+  requests_.erase(it);  // the completion may start new requests
+
+  GattResult result;
+  result.id = id;
+
+  DBusMessage *reply = dbus_pending_call_steal_reply(req.call);
+  dbus_pending_call_unref(req.call);
+
   if (!reply) {
+    result.status = "error";
+    result.error = "no reply";
+  } else if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+    const char *name = dbus_message_get_error_name(reply);
+    result.status = name && strcmp(name, DBUS_ERROR_NO_REPLY) == 0 ? "timeout" : "error";
+
+    DBusError err;
+    dbus_error_init(&err);
+    dbus_set_error_from_message(&err, reply);
+    result.error = err.message ? err.message : (name ? name : "error");
+    dbus_error_free(&err);
+  } else {
+    result.status = "ok";
+    if (req.read) {
+      result.data = dbus_byte_array(reply);
+    }
+  }
+
+  if (req.done) {
+    TRACE_SCOPE(TraceCategory::Gatt, req.read ? "read_async" : "write_async", result.status);
+    req.done(result);
+  }
+
+  if (reply) {
+    dbus_message_unref(reply);  // after the completion; data points into it
+  }
+}
+
+bool DeviceBackendGATT::cancel(uint64_t id) {
+  auto it = requests_.find(id);
+  if (it == requests_.end()) {
     return false;
   }
 
-  dbus_message_unref(reply);
+  dbus_pending_call_cancel(it->second.call);
+  dbus_pending_call_unref(it->second.call);
+  requests_.erase(it);
+  return true;
+}
+
+void DeviceBackendGATT::cancel_all() {
+  for (auto &[_, req] : requests_) {
+    dbus_pending_call_cancel(req.call);
+    dbus_pending_call_unref(req.call);
+  }
+  requests_.clear();
+
+  for (auto &[_, acquire] : acquiring_) {
+    if (!acquire.notify) {
+      writer_paths_.erase(acquire.char_path);
+    }
+    dbus_pending_call_cancel(acquire.call);
+    dbus_pending_call_unref(acquire.call);
+  }
+  acquiring_.clear();
+}
+
+dbus_bool_t DeviceBackendGATT::add_timeout(DBusTimeout *timeout, void *data) {
+  auto *self = static_cast<DeviceBackendGATT *>(data);
+  if (dbus_timeout_get_enabled(timeout)) {
+    uint64_t interval = static_cast<uint64_t>(dbus_timeout_get_interval(timeout));
+    self->timeouts_[timeout] = monotonic_ns() + interval * 1000000ULL;
+  } else {
+    self->timeouts_.erase(timeout);
+  }
+  self->arm_timeouts();
   return true;
 }
+
+void DeviceBackendGATT::remove_timeout(DBusTimeout *timeout, void *data) {
+  auto *self = static_cast<DeviceBackendGATT *>(data);
+  self->timeouts_.erase(timeout);
+  self->arm_timeouts();
+}
+
+void DeviceBackendGATT::toggle_timeout(DBusTimeout *timeout, void *data) {
+  add_timeout(timeout, data);
+}
+
+void DeviceBackendGATT::arm_timeouts() {
+  if (timer_fd_ < 0) {
+    return;
+  }
+
+  uint64_t due = 0;
+  for (const auto &[_, deadline] : timeouts_) {
+    if (due == 0 || deadline < due) {
+      due = deadline;
+    }
+  }
+
+  // 0 disarms a timerfd; anything in the past fires immediately
+  struct itimerspec its{};
+  if (due > 0) {
+    its.it_value.tv_sec = static_cast<time_t>(due / 1000000000ULL);
+    its.it_value.tv_nsec = static_cast<long>(due % 1000000000ULL);
+  }
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr) < 0) {
+    perror("GATT: timerfd_settime");
+  }
+}
+
+void DeviceBackendGATT::handle_timeouts() {
+  uint64_t expirations;
+  if (read(timer_fd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+    perror("GATT: read timerfd");
+  }
+
+  uint64_t now = monotonic_ns();
+  std::vector<DBusTimeout *> due;
+  for (const auto &[timeout, deadline] : timeouts_) {
+    if (deadline <= now) {
+      due.push_back(timeout);
+    }
+  }
+
+  for (DBusTimeout *timeout : due) {
+    auto it = timeouts_.find(timeout);
+    if (it == timeouts_.end()) {
+      continue;  // removed by an earlier handler
+    }
+
+    // DBusTimeout repeats until removed
+    uint64_t interval = static_cast<uint64_t>(dbus_timeout_get_interval(timeout));
+    it->second = now + interval * 1000000ULL;
+    dbus_timeout_handle(timeout);
+  }
+
+  arm_timeouts();
+
+  // Expired calls complete with a NoReply error during dispatch
+  pump_messages();
+}
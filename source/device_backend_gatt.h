@@ -1,25 +1,56 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <format>
+#include <functional>
 #include <map>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <dbus/dbus.h>
+#include <unistd.h>
 
 #include "aelkey_state.h"
+#include "bluez_object_cache.h"
 #include "device_backend.h"
 #include "device_declarations.h"
 #include "singleton.h"
 
 enum class GattPathType { Device, Service, Characteristic };
 
+// Outcome of read_async/write_async
+struct GattResult {
+  uint64_t id = 0;
+  std::string status;         // "ok", "timeout", "error", "cancelled"
+  std::string error;          // D-Bus error message
+  std::span<const uint8_t> data;  // ReadValue; points into the reply, valid during completion
+};
+
+using GattCompletion = std::function<void(const GattResult &)>;
+
 class DeviceBackendGATT : public DeviceBackend, public Singleton<DeviceBackendGATT> {
   friend class Singleton<DeviceBackendGATT>;
 
  protected:
   DeviceBackendGATT() = default;
   ~DeviceBackendGATT() {
+    cancel_all();
+    if (timer_fd_ >= 0) {
+      close(timer_fd_);
+    }
+    if (dispatch_fd_ >= 0) {
+      close(dispatch_fd_);
+    }
+    for (const auto &[fd, _] : notify_fds_) {
+      close(fd);
+    }
+    for (const auto &[fd, _] : writers_) {
+      close(fd);
+    }
     if (conn_) {
       dbus_connection_unref(conn_);
       conn_ = nullptr;
@@ -43,7 +74,7 @@ class DeviceBackendGATT : public DeviceBackend, public Singleton<DeviceBackendGA
     }
 
     std::string out = resolve_gatt_paths(decl, nullptr);
-    if (out.empty()) {
+    if (out.empty() || !device_ready(out)) {
       return false;
     }
     devnode_out = out;
@@ -73,7 +104,9 @@ class DeviceBackendGATT : public DeviceBackend, public Singleton<DeviceBackendGA
       gatt_path = devnode;
     }
 
-    if (type != GattPathType::Characteristic) {
+    if (resubscribe(decl, devnode)) {
+      // reconnected; the characteristics from before
+    } else if (type != GattPathType::Characteristic) {
       std::vector<std::string> found_characteristics;
       resolve_gatt_paths(decl, &found_characteristics);
 
@@ -81,31 +114,16 @@ class DeviceBackendGATT : public DeviceBackend, public Singleton<DeviceBackendGA
         print_characteristic_inspect_line(ch);
 
         if (characteristic_supports_notify(ch)) {
-          std::string rule =
-              "type='signal',interface='org.freedesktop.DBus.Properties',"
-              "member='PropertiesChanged',path='" +
-              ch + "'";
-
-          dbus_bus_add_match(conn_, rule.c_str(), nullptr);
-          start_notify(ch);
+          subscribe(decl, ch);
         }
       }
-
-      dbus_connection_flush(conn_);
     } else {
       print_characteristic_inspect_line(devnode);
-
-      std::string rule =
-          "type='signal',interface='org.freedesktop.DBus.Properties',"
-          "member='PropertiesChanged',path='" +
-          devnode + "'";
-
-      dbus_bus_add_match(conn_, rule.c_str(), nullptr);
-      dbus_connection_flush(conn_);
-
-      start_notify(devnode);
+      subscribe(decl, devnode);
     }
 
+    dbus_connection_flush(conn_);
+
     gatt_paths_[decl.id] = gatt_path;
 
     decl.devnode = devnode;
@@ -124,25 +142,53 @@ class DeviceBackendGATT : public DeviceBackend, public Singleton<DeviceBackendGA
       return false;
     }
 
-    InputDecl &decl = it->second;
-    if (!decl.devnode.empty()) {
-      stop_notify(decl.devnode);
+    for (const auto &char_path : remove_routes(id)) {
+      unsubscribe(char_path);
     }
+    release_writers(get_gatt_path(id));
+    dbus_connection_flush(conn_);
 
     gatt_paths_.erase(id);
 
     return true;
   }
 
-  // Public API used by Lua wrappers
+  // Public API used by Lua wrappers; out_data keeps its capacity
   bool read_characteristic(const std::string &char_path, std::vector<uint8_t> &out_data);
+  // Never blocks. Without response, writes go through an AcquireWrite
+  // socket when BlueZ grants one, otherwise a WriteValue whose reply is
+  // not asked for; with coalesce, a write still queued behind a full
+  // socket is replaced by the newer one. With response, true means the
+  // WriteValue was sent; a failure is logged.
   bool write_characteristic(
       const std::string &char_path,
       const uint8_t *data,
       size_t len,
-      bool with_resp
+      bool with_resp,
+      bool coalesce = false
+  );
+
+  // ReadValue/WriteValue without waiting: the reply, an error, or the
+  // timeout completes the request from the event loop. Returns the
+  // request id, 0 if nothing was sent.
+  uint64_t read_async(const std::string &char_path, int timeout_ms, GattCompletion done);
+  uint64_t write_async(
+      const std::string &char_path,
+      const uint8_t *data,
+      size_t len,
+      bool with_resp,
+      int timeout_ms,
+      GattCompletion done
   );
 
+  // Drop a request; its completion is not called
+  bool cancel(uint64_t id);
+  void cancel_all();
+
+  size_t requests_in_flight() const {
+    return requests_.size();
+  }
+
   std::string get_gatt_path(const std::string &id) const {
     auto it = gatt_paths_.find(id);
     if (it == gatt_paths_.end()) {
@@ -182,23 +228,166 @@ class DeviceBackendGATT : public DeviceBackend, public Singleton<DeviceBackendGA
   // --- message dispatch ---
   void pump_messages();
 
+  // AcquireNotify / AcquireWrite socket, the D-Bus timeout timer, or
+  // the dispatch eventfd ready
+  void handle_socket(int fd, uint32_t events);
+
+  // timerfd for D-Bus timeouts, registered with DispatcherGATT
+  int timer_fd() const {
+    return timer_fd_;
+  }
+
+  // eventfd signalled while messages wait in the connection's queue,
+  // registered with DispatcherGATT
+  int dispatch_fd() const {
+    return dispatch_fd_;
+  }
+
+  // Characteristic value → the callback routed for its path; also used by replay
+  void deliver_notification(const std::string &path, const uint8_t *data, size_t size);
+
+  // --- notification routing ---
+  // Subscribed characteristic path → input. Built at attach; replay adds
+  // routes for recorded paths without subscribing.
+  struct GattRoute {
+    std::string id;
+    std::string on_event;    // on_notify[characteristic] or on_event
+    int characteristic = 0;  // handle from the path
+  };
+
+  bool has_route(const std::string &char_path) const {
+    return routes_.contains(char_path);
+  }
+  // false if another input already routes char_path
+  bool add_route(const std::string &char_path, const InputDecl &decl);
+
+  // Drop the routes of an input; returns their paths
+  std::vector<std::string> remove_routes(const std::string &id);
+
+  // Re-read the callbacks of an input's routes after decl changed
+  void refresh_routes(const InputDecl &decl);
+
+  // --- connection tracking ---
+  // A gatt input is present while its device is connected with services
+  // resolved: attached when the device gets there, detached when it
+  // drops, with on_state "add"/"remove" as for udev devices
+  bool device_ready(const std::string &path);
+
+  // Handles of ".../serviceXXXX/charYYYY", 0 if the path has none
+  static int service_handle(const std::string &path);
+  static int characteristic_handle(const std::string &char_path);
+
  private:
   // --- state ---
   DBusConnection *conn_ = nullptr;
 
   // --- message dispatch ---
   void process_one_message(DBusMessage *msg);
+  static DBusHandlerResult filter_message(DBusConnection *, DBusMessage *msg, void *data);
+
+  // --- async requests ---
+  struct GattRequest {
+    bool read = false;
+    DBusPendingCall *call = nullptr;
+    GattCompletion done;
+  };
+
+  static DBusMessage *new_read_message(const std::string &char_path);
+  static DBusMessage *new_write_message(
+      const std::string &char_path, const uint8_t *data, size_t len, bool with_resp
+  );
+
+  uint64_t send_async(DBusMessage *msg, bool read, int timeout_ms, GattCompletion done);
+  static void on_reply(DBusPendingCall *call, void *data);
+  void complete(uint64_t id);
+
+  // --- D-Bus timeouts ---
+  // libdbus expires pending calls through DBusTimeout; the enabled ones
+  // are kept with their deadlines and the timerfd armed for the earliest
+  static dbus_bool_t add_timeout(DBusTimeout *timeout, void *data);
+  static void remove_timeout(DBusTimeout *timeout, void *data);
+  static void toggle_timeout(DBusTimeout *timeout, void *data);
+  void arm_timeouts();
+  void handle_timeouts();
+
+  static void dispatch_status(DBusConnection *conn, DBusDispatchStatus status, void *data);
 
   // --- notify helpers ---
+  // PropertiesChanged match and StartNotify, or the reverse; the replies
+  // are not waited for, errors are logged
   void start_notify(const std::string &char_path);
   void stop_notify(const std::string &char_path);
+  void notify_call(const char *method, const std::string &char_path);
+
+  // Route, then AcquireNotify, or StartNotify once it is refused
+  void subscribe(const InputDecl &decl, const std::string &char_path);
+  void unsubscribe(const std::string &char_path);
+
+  // AcquireNotify or AcquireWrite without waiting; answered through the
+  // loop. false if not sent.
+  static DBusMessage *new_acquire_message(const char *method, const std::string &char_path);
+  bool send_acquire(const std::string &char_path, bool notify);
+  static void on_acquired(DBusPendingCall *call, void *data);
+  void acquired(uint64_t id);
+  // The socket of an Acquire* reply; -1 and a message if refused
+  static int acquired_socket(
+      const char *method, const std::string &char_path, DBusMessage *reply, DBusError &err,
+      uint16_t &mtu
+  );
+
+  // Notification socket registered with DispatcherGATT; StartNotify if refused
+  void notify_acquired(const std::string &char_path, int fd);
+  void release_notify_fd(int fd);
+  void read_notify_fd(int fd, uint32_t events);
+
+  // --- write helpers ---
+  // Queued writes of one AcquireWrite socket; the socket is polled for
+  // EPOLLOUT only while the queue is not empty
+  struct GattWriter {
+    std::string char_path;
+    size_t max_size = 0;  // ATT MTU - 3
+    std::deque<std::vector<uint8_t>> queue;
+  };
+
+  static constexpr size_t MAX_WRITE_QUEUE = 256;
+
+  // AcquireNotify or AcquireWrite in flight for a characteristic
+  struct GattAcquire {
+    std::string char_path;
+    DBusPendingCall *call = nullptr;
+    bool notify = false;
+  };
+
+  // The socket, or -1 while AcquireWrite is asked (sent on the first
+  // write, answered through the loop) or after it was refused
+  int writer_fd(const std::string &char_path);
+  void writer_acquired(const std::string &char_path, int fd, uint16_t mtu);
+  bool queue_write(int fd, const uint8_t *data, size_t len, bool coalesce);
+  void drain_writes(int fd, uint32_t events);
+  void release_writer(int fd);
+  void release_writers(const std::string &device_path);
+
+  // --- connection tracking ---
+  // Subscriptions of a disconnected input, taken up again as they were
+  // when its device is back; no matching, flag, or UUID lookups
+  struct GattReconnect {
+    std::string devnode;
+    std::vector<std::string> char_paths;
+  };
+
+  void update_connections();
+  bool resubscribe(const InputDecl &decl, const std::string &devnode);
+  void note_first_event(const std::string &id);
 
   // --- path helpers ---
   static GattPathType classify_gatt_path(const std::string &path);
+  static std::string device_path_of(const std::string &path);
   static std::string derive_device_path_from_char_path(const std::string &char_path);
 
   // --- D-Bus helpers ---
-  DBusMessage *get_managed_objects();
+  // The object tree, loaded on first use
+  bool ensure_objects();
+  std::unordered_set<std::string> ready_devices() const;  // connected, services resolved
 
   std::string get_characteristic_uuid(const std::string &path);
   std::vector<std::string> get_characteristic_flags(const std::string &path);
@@ -210,19 +399,50 @@ class DeviceBackendGATT : public DeviceBackend, public Singleton<DeviceBackendGA
   std::string
   resolve_gatt_paths(const InputDecl &decl, std::vector<std::string> *found_characteristics);
 
-  std::vector<std::string> get_matching_devices(const InputDecl &decl, DBusMessageIter &array);
+  std::vector<std::string> get_matching_devices(const InputDecl &decl);
   std::vector<std::string> get_matching_services(
       const InputDecl &decl,
-      const std::vector<std::string> &candidate_devices,
-      DBusMessageIter &array
+      const std::vector<std::string> &candidate_devices
   );
   std::vector<std::string> get_matching_characteristics(
       const InputDecl &decl,
-      const std::vector<std::string> &candidate_services,
-      DBusMessageIter &array
+      const std::vector<std::string> &candidate_services
   );
 
  private:
+  // Mirror of the BlueZ objects; matching never walks the bus
+  BluezObjectCache objects_;
+  bool connections_dirty_ = false;  // device objects changed since the last update
+
+  // Devices connected with services resolved, as of the last update
+  std::unordered_set<std::string> ready_devices_;
+
+  // dev_id -> subscriptions to restore; dev_id -> connect time, until
+  // the first notification after a reconnect
+  std::unordered_map<std::string, GattReconnect> reconnects_;
+  std::unordered_map<std::string, uint64_t> first_event_;
+
   // dev_id -> gatt_path, /org/bluez/hci0/dev_XX_XX_XX_XX_XX_XX
   std::map<std::string, std::string> gatt_paths_;
+
+  // char_path -> route, one lookup per notification
+  std::unordered_map<std::string, GattRoute> routes_;
+
+  // AcquireNotify socket -> char_path
+  std::unordered_map<int, std::string> notify_fds_;
+
+  // AcquireWrite socket -> writer; char_path -> socket, -1 while asked
+  // or once refused (until the device reconnects)
+  std::unordered_map<int, GattWriter> writers_;
+  std::unordered_map<std::string, int> writer_paths_;
+  std::unordered_map<uint64_t, GattAcquire> acquiring_;  // request id -> Acquire*
+
+  // request id -> in-flight ReadValue/WriteValue
+  std::unordered_map<uint64_t, GattRequest> requests_;
+  uint64_t next_request_ = 1;
+
+  // enabled DBusTimeout -> deadline (CLOCK_MONOTONIC ns)
+  std::unordered_map<DBusTimeout *, uint64_t> timeouts_;
+  int timer_fd_ = -1;
+  int dispatch_fd_ = -1;
 };
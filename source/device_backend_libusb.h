@@ -7,6 +7,7 @@
 
 #include <libusb-1.0/libusb.h>
 
+#include "aelkey_usb.h"
 #include "device_backend.h"
 #include "singleton.h"
 
@@ -16,6 +17,9 @@ class DeviceBackendLibUSB : public DeviceBackend, public Singleton<DeviceBackend
  protected:
   DeviceBackendLibUSB() = default;
   ~DeviceBackendLibUSB() {
+    for (const auto &[handle, _] : closing_) {
+      close_handle(handle);
+    }
     if (libusb_) {
       libusb_exit(libusb_);
       libusb_ = nullptr;
@@ -63,13 +67,29 @@ class DeviceBackendLibUSB : public DeviceBackend, public Singleton<DeviceBackend
     }
 
     libusb_device_handle *handle = it->second;
-    libusb_release_interface(handle, 0);
-    libusb_close(handle);
-
     devices_.erase(it);
+
+    // stream transfers still out use the handle: closed once they are back
+    size_t streams = usb_detach_streams(id);
+    if (streams > 0) {
+      closing_[handle] = streams;
+      return true;
+    }
+
+    close_handle(handle);
     return true;
   }
 
+  // A stream of a detached device has all its transfers back
+  void stream_retired(libusb_device_handle *handle) {
+    auto it = closing_.find(handle);
+    if (it == closing_.end() || --it->second > 0) {
+      return;
+    }
+    closing_.erase(it);
+    close_handle(handle);
+  }
+
   int fd() const override {
     // DispatcherLibUSB manages event integration
     return -1;
@@ -126,6 +146,14 @@ class DeviceBackendLibUSB : public DeviceBackend, public Singleton<DeviceBackend
   }
 
  private:
+  static void close_handle(libusb_device_handle *handle) {
+    libusb_release_interface(handle, 0);
+    libusb_close(handle);
+  }
+
   libusb_context *libusb_ = nullptr;
   std::map<std::string, libusb_device_handle *> devices_;
+
+  // detached handle → its streams not yet retired
+  std::map<libusb_device_handle *, size_t> closing_;
 };
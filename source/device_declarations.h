@@ -1,5 +1,6 @@
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -15,10 +16,14 @@ struct InputDecl {
   std::string uniq;
 
   bool grab = false;
+  bool batch = false;     // deliver all pending reports in one callback
+  bool threaded = false;  // read on a dedicated thread (hidraw)
   std::vector<std::pair<int, int>> capabilities;
 
   int service = 0;
   int characteristic = 0;
+  std::string uuid;  // characteristic UUID (gatt)
+  std::map<int, std::string> on_notify;  // characteristic handle -> callback (gatt)
 
   std::string devnode;
 
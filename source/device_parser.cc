@@ -41,6 +41,16 @@ InputDecl parse_input(sol::table tbl) {
     decl.grab = v.as<bool>();
   }
 
+  // batch
+  if (sol::object v = tbl["batch"]; v.valid() && v.is<bool>()) {
+    decl.batch = v.as<bool>();
+  }
+
+  // threaded
+  if (sol::object v = tbl["threaded"]; v.valid() && v.is<bool>()) {
+    decl.threaded = v.as<bool>();
+  }
+
   // vendor
   if (sol::object v = tbl["vendor"]; v.valid() && v.is<int>()) {
     decl.vendor = v.as<int>();
@@ -123,6 +133,20 @@ InputDecl parse_input(sol::table tbl) {
     decl.characteristic = v.as<int>();
   }
 
+  // uuid: characteristic UUID (gatt)
+  if (sol::object v = tbl["uuid"]; v.valid() && v.is<std::string>()) {
+    decl.uuid = v.as<std::string>();
+  }
+
+  // on_notify: { [characteristic handle] = "callback" } (gatt)
+  if (sol::object v = tbl["on_notify"]; v.valid() && v.is<sol::table>()) {
+    v.as<sol::table>().for_each([&](sol::object k, sol::object cb) {
+      if (k.is<int>() && cb.is<std::string>()) {
+        decl.on_notify[k.as<int>()] = cb.as<std::string>();
+      }
+    });
+  }
+
   // on_event callback
   if (sol::object v = tbl["on_event"]; v.valid() && v.is<std::string>()) {
     decl.on_event = v.as<std::string>();
@@ -20,6 +20,9 @@ void DispatcherBase::register_fd(int fd, uint32_t events) {
 
   EpollPayload payload{ this, fd };
   auto [it, inserted] = pollfds_.emplace(fd, payload);
+  if (!inserted) {
+    it->second = payload;  // fd number reused after unregister_fd()
+  }
 
   struct epoll_event ev{};
   ev.events = events;
@@ -32,6 +35,21 @@ void DispatcherBase::register_fd(int fd, uint32_t events) {
   }
 }
 
+void DispatcherBase::modify_fd(int fd, uint32_t events) {
+  EpollPayload *payload = get_payload(fd);
+  if (!payload || payload->dead) {
+    return;
+  }
+
+  struct epoll_event ev{};
+  ev.events = events;
+  ev.data.ptr = payload;
+
+  if (epoll_ctl(AelkeyState::instance().epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+    perror("epoll_ctl MOD");
+  }
+}
+
 void DispatcherBase::unregister_fd(int fd) {
   auto &state = AelkeyState::instance();
 
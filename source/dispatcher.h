@@ -26,9 +26,15 @@ class DispatcherBase {
   virtual void handle_event(EpollPayload *payload, uint32_t events) {}
   virtual const char *type() const = 0;
 
+  // Its events are device input (they keep the busy-poll window open)
+  virtual bool input_source() const {
+    return false;
+  }
+
   EpollPayload *get_payload(int fd) const;
 
   virtual void register_fd(int fd, uint32_t events);
+  void modify_fd(int fd, uint32_t events);  // change the events of a registered fd
   virtual void on_unregister(int fd) {}
   virtual void unregister_fd(int fd);
   virtual void cleanup_fds();
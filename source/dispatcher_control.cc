@@ -0,0 +1,642 @@
+#include "dispatcher_control.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sol/sol.hpp>
+
+#include "aelkey_state.h"
+#include "callback_stats.h"
+#include "device_backend_gatt.h"
+#include "device_declarations.h"
+#include "dispatcher_hidraw.h"
+#include "io_pool.h"
+#include "lua_pool.h"
+#include "tick_scheduler.h"
+#include "trace.h"
+#include "util/worker_thread.h"
+
+namespace {
+
+constexpr int MAX_CLIENTS = 8;
+constexpr size_t MAX_LINE = 4096;      // longer input drops the client
+constexpr size_t MAX_PENDING = 1 << 20;  // unsent reply bytes before dropping the client
+
+const char *const HELP_TEXT =
+    "metrics                      counters in Prometheus text format\n"
+    "devices                      attached devices\n"
+    "log <level>                  set the aelkey.log level\n"
+    "trace [path]                 write the trace ring as Chrome trace JSON\n"
+    "rebind <device> <callback>   change a device's event callback\n"
+    "quit                         close the connection\n";
+
+// Label values: backslash, double quote, and newline are escaped
+std::string label(const std::string &value) {
+  std::string out;
+  out.reserve(value.size() + 2);
+  out += '"';
+  for (char c : value) {
+    switch (c) {
+      case '\\':
+        out += "\\\\";
+        break;
+      case '"':
+        out += "\\\"";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      default:
+        out += c;
+    }
+  }
+  out += '"';
+  return out;
+}
+
+void header(std::ostringstream &os, const char *name, const char *type, const char *help) {
+  os << "# HELP " << name << ' ' << help << '\n';
+  os << "# TYPE " << name << ' ' << type << '\n';
+}
+
+double seconds(uint64_t ns) {
+  return static_cast<double>(ns) / 1e9;
+}
+
+std::vector<std::string> split_words(const std::string &line) {
+  std::vector<std::string> words;
+  std::istringstream is(line);
+  std::string word;
+  while (is >> word) {
+    words.push_back(word);
+  }
+  return words;
+}
+
+}  // namespace
+
+bool DispatcherControl::start(const std::string &path) {
+  if (running()) {
+    return true;
+  }
+
+  struct sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    std::fprintf(stderr, "control socket: invalid path '%s'\n", path.c_str());
+    return false;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("control socket");
+    return false;
+  }
+
+  // a socket left behind by a previous run
+  struct stat st{};
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+    std::fprintf(stderr, "control socket: bind %s: %s\n", path.c_str(), std::strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  chmod(path.c_str(), 0600);
+
+  if (listen(fd, MAX_CLIENTS) < 0) {
+    perror("control socket: listen");
+    close(fd);
+    unlink(path.c_str());
+    return false;
+  }
+
+  listen_fd_ = fd;
+  path_ = path;
+  register_fd(listen_fd_, EPOLLIN);
+  return true;
+}
+
+void DispatcherControl::stop() {
+  while (!clients_.empty()) {
+    close_client(clients_.begin()->first);
+  }
+
+  if (trace_writes_) {
+    // writes still running finish into the released TraceWrites
+    unregister_fd(trace_writes_->event_fd);
+    trace_writes_.reset();
+  }
+
+  if (listen_fd_ >= 0) {
+    unregister_fd(listen_fd_);
+    close(listen_fd_);
+    listen_fd_ = -1;
+    unlink(path_.c_str());
+    path_.clear();
+  }
+}
+
+void DispatcherControl::handle_event(EpollPayload *payload, uint32_t events) {
+  int fd = payload->fd;
+
+  if (fd == listen_fd_) {
+    accept_clients();
+    return;
+  }
+  if (trace_writes_ && fd == trace_writes_->event_fd) {
+    finish_trace_writes();
+    return;
+  }
+
+  auto it = clients_.find(fd);
+  if (it == clients_.end()) {
+    return;
+  }
+  Client &client = it->second;
+
+  if ((events & EPOLLOUT) && !flush_client(fd, client)) {
+    return;
+  }
+
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    read_client(fd, client);
+  }
+}
+
+void DispatcherControl::accept_clients() {
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("control socket: accept");
+      }
+      return;
+    }
+
+    if (clients_.size() >= MAX_CLIENTS) {
+      close(fd);
+      continue;
+    }
+
+    clients_[fd] = Client{ .serial = ++next_serial_ };
+    register_fd(fd, EPOLLIN);
+    if (!get_payload(fd)) {
+      clients_.erase(fd);
+      close(fd);
+    }
+  }
+}
+
+void DispatcherControl::read_client(int fd, Client &client) {
+  // One read per wakeup: a chatty client cannot hold up input devices,
+  // the rest is picked up on the next loop iteration.
+  char buf[MAX_LINE];
+  ssize_t r = ::read(fd, buf, sizeof(buf));
+  if (r < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      close_client(fd);
+    }
+    return;
+  }
+  if (r == 0) {
+    close_client(fd);
+    return;
+  }
+
+  if (client.closing) {
+    return;  // discard input after quit or an HTTP request
+  }
+
+  client.in.append(buf, static_cast<size_t>(r));
+
+  if (client.in.rfind("GET ", 0) == 0) {
+    // HTTP: answer once the request headers are complete
+    size_t end = client.in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      end = client.in.find("\n\n");
+    }
+    if (end == std::string::npos) {
+      if (client.in.size() > MAX_LINE) {
+        close_client(fd);
+      }
+      return;
+    }
+
+    std::string target = client.in.substr(4, client.in.find_first_of(" \r\n", 4) - 4);
+    std::string body;
+    std::string status = "200 OK";
+    if (target == "/metrics" || target == "/") {
+      body = metrics();
+    } else {
+      status = "404 Not Found";
+      body = "not found\n";
+    }
+
+    client.out += "HTTP/1.0 " + status + "\r\n";
+    client.out += "Content-Type: text/plain; version=0.0.4\r\n";
+    client.out += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    client.out += "Connection: close\r\n\r\n";
+    client.out += body;
+    client.in.clear();
+    client.closing = true;
+    flush_client(fd, client);
+    return;
+  }
+
+  run_lines(fd, client);
+}
+
+// Runs the complete lines in `in`, up to a command whose reply is not
+// ready yet
+void DispatcherControl::run_lines(int fd, Client &client) {
+  size_t pos;
+  while (!client.waiting && (pos = client.in.find('\n')) != std::string::npos) {
+    std::string line = client.in.substr(0, pos);
+    client.in.erase(0, pos + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    client.out += run_command(line, client);
+    if (client.closing) {
+      client.in.clear();
+      break;
+    }
+  }
+
+  if (client.in.size() > MAX_LINE) {
+    close_client(fd);
+    return;
+  }
+
+  flush_client(fd, client);
+}
+
+// Returns false when the client was closed
+bool DispatcherControl::flush_client(int fd, Client &client) {
+  while (!client.out.empty()) {
+    ssize_t w = ::send(fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      close_client(fd);
+      return false;
+    }
+    client.out.erase(0, static_cast<size_t>(w));
+  }
+
+  if (client.out.empty() && client.closing) {
+    close_client(fd);
+    return false;
+  }
+
+  if (client.out.size() > MAX_PENDING) {
+    close_client(fd);  // not reading its replies
+    return false;
+  }
+
+  // wait for EPOLLOUT only while something is pending
+  modify_fd(fd, client.out.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT));
+  return true;
+}
+
+void DispatcherControl::close_client(int fd) {
+  unregister_fd(fd);
+  close(fd);
+  clients_.erase(fd);
+}
+
+std::string DispatcherControl::run_command(const std::string &line, Client &client) {
+  std::vector<std::string> args = split_words(line);
+  if (args.empty()) {
+    return "";
+  }
+
+  const std::string &cmd = args[0];
+
+  if (cmd == "metrics") {
+    return metrics();
+  }
+  if (cmd == "devices") {
+    return devices();
+  }
+  if (cmd == "log") {
+    if (args.size() != 2) {
+      return "error: usage: log <level>\n";
+    }
+    return set_log_level(args[1]);
+  }
+  if (cmd == "trace") {
+    auto &state = AelkeyState::instance();
+    std::string file = args.size() > 1 ? args[1] : state.loop_options.trace_file;
+    if (file.empty()) {
+      file = "/tmp/aelkey-trace-" + std::to_string(getpid()) + ".json";
+    }
+    return write_trace(file, client);
+  }
+  if (cmd == "rebind") {
+    if (args.size() != 3) {
+      return "error: usage: rebind <device> <callback>\n";
+    }
+    return rebind(args[1], args[2]);
+  }
+  if (cmd == "help") {
+    return HELP_TEXT;
+  }
+  if (cmd == "quit") {
+    client.closing = true;
+    return "";
+  }
+
+  return "error: unknown command '" + cmd + "'\n";
+}
+
+DispatcherControl::TraceWrites::~TraceWrites() {
+  if (event_fd >= 0) {
+    close(event_fd);
+  }
+}
+
+// Snapshots the ring and writes it on a worker thread; the reply follows
+// from finish_trace_writes()
+std::string DispatcherControl::write_trace(const std::string &file, Client &client) {
+  if (!trace_writes_) {
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0) {
+      perror("control socket: eventfd");
+      return "error: trace not written\n";
+    }
+    trace_writes_ = std::make_shared<TraceWrites>();
+    trace_writes_->event_fd = efd;
+    register_fd(efd, EPOLLIN);
+  }
+
+  uint64_t serial = client.serial;
+  std::thread([writes = trace_writes_, serial, file, events = Trace::snapshot()] {
+    worker_thread_defaults();
+
+    std::string reply = Trace::write(file, events)
+                            ? "ok " + file + "\n"
+                            : "error: trace not written (is tracing enabled?)\n";
+    {
+      std::lock_guard lock(writes->mutex);
+      writes->done.push_back({ serial, std::move(reply) });
+    }
+    uint64_t one = 1;
+    ssize_t w = ::write(writes->event_fd, &one, sizeof(one));
+    (void)w;
+  }).detach();
+
+  client.waiting = true;
+  return "";
+}
+
+void DispatcherControl::finish_trace_writes() {
+  uint64_t count;
+  ssize_t r = ::read(trace_writes_->event_fd, &count, sizeof(count));
+  (void)r;
+
+  std::vector<TraceWrites::Result> done;
+  {
+    std::lock_guard lock(trace_writes_->mutex);
+    done.swap(trace_writes_->done);
+  }
+
+  for (auto &result : done) {
+    auto it = std::find_if(clients_.begin(), clients_.end(), [&](const auto &entry) {
+      return entry.second.serial == result.serial;
+    });
+    if (it == clients_.end()) {
+      continue;  // disconnected meanwhile
+    }
+
+    Client &client = it->second;
+    client.out += result.reply;
+    client.waiting = false;
+    run_lines(it->first, client);  // commands sent behind the trace
+  }
+}
+
+std::string DispatcherControl::metrics() const {
+  auto &state = AelkeyState::instance();
+  const LoopStats &stats = state.loop_stats;
+  std::ostringstream os;
+
+  header(os, "aelkey_input_events_total", "counter", "Input events received per device.");
+  for (const auto &[id, c] : stats.inputs) {
+    os << "aelkey_input_events_total{device=" << label(id) << "} " << c.events << '\n';
+  }
+
+  header(
+      os, "aelkey_input_dropped_total", "counter", "Input frames or reports lost per device."
+  );
+  for (const auto &[id, c] : stats.inputs) {
+    os << "aelkey_input_dropped_total{device=" << label(id) << "} " << c.dropped << '\n';
+  }
+
+  header(
+      os,
+      "aelkey_usb_overruns_total",
+      "counter",
+      "USB transfers lost to a full I/O thread ring."
+  );
+  os << "aelkey_usb_overruns_total " << IoPool::instance().usb_overruns() << '\n';
+
+  header(os, "aelkey_output_events_total", "counter", "Events written per uinput device.");
+  for (const auto &[id, n] : stats.outputs) {
+    os << "aelkey_output_events_total{device=" << label(id) << "} " << n << '\n';
+  }
+
+  const auto &callbacks = CallbackStats::instance().callbacks();
+
+  header(os, "aelkey_callback_calls_total", "counter", "Lua callback invocations.");
+  for (const auto &[name, t] : callbacks) {
+    os << "aelkey_callback_calls_total{callback=" << label(name) << "} " << t.count << '\n';
+  }
+
+  header(os, "aelkey_callback_seconds_total", "counter", "Time spent in Lua callbacks.");
+  for (const auto &[name, t] : callbacks) {
+    os << "aelkey_callback_seconds_total{callback=" << label(name) << "} "
+       << seconds(t.total_ns) << '\n';
+  }
+
+  header(os, "aelkey_callback_max_seconds", "gauge", "Longest Lua callback invocation.");
+  for (const auto &[name, t] : callbacks) {
+    os << "aelkey_callback_max_seconds{callback=" << label(name) << "} " << seconds(t.max_ns)
+       << '\n';
+  }
+
+  header(os, "aelkey_callback_p99_seconds", "gauge", "99th percentile Lua callback time.");
+  for (const auto &[name, t] : callbacks) {
+    os << "aelkey_callback_p99_seconds{callback=" << label(name) << "} "
+       << seconds(t.histogram.percentile(99)) << '\n';
+  }
+
+  header(
+      os,
+      "aelkey_callback_over_budget_total",
+      "counter",
+      "Lua callback invocations over the callback budget."
+  );
+  for (const auto &[name, t] : callbacks) {
+    os << "aelkey_callback_over_budget_total{callback=" << label(name) << "} "
+       << t.over_budget << '\n';
+  }
+
+  header(os, "aelkey_timers", "gauge", "Scheduled ticks.");
+  os << "aelkey_timers " << TickScheduler::instance().timer_count() << '\n';
+
+  if (state.lua_vm) {
+    int kb = lua_gc(state.lua_vm, LUA_GCCOUNT, 0);
+    int b = lua_gc(state.lua_vm, LUA_GCCOUNTB, 0);
+    header(os, "aelkey_lua_memory_bytes", "gauge", "Memory in use by the Lua state.");
+    os << "aelkey_lua_memory_bytes " << (static_cast<uint64_t>(kb) * 1024 + b) << '\n';
+  }
+
+  const GcStats &gc = stats.gc;
+  header(os, "aelkey_gc_steps_total", "counter", "Lua collector steps run by the loop.");
+  os << "aelkey_gc_steps_total{kind=\"idle\"} " << gc.idle_steps << '\n';
+  os << "aelkey_gc_steps_total{kind=\"forced\"} " << gc.forced_steps << '\n';
+  header(os, "aelkey_gc_cycles_total", "counter", "Collection cycles finished by loop steps.");
+  os << "aelkey_gc_cycles_total " << gc.cycles << '\n';
+  header(os, "aelkey_gc_seconds_total", "counter", "Time spent in loop collector steps.");
+  os << "aelkey_gc_seconds_total " << seconds(gc.total_ns) << '\n';
+  header(os, "aelkey_gc_max_pause_seconds", "gauge", "Longest loop collector step.");
+  os << "aelkey_gc_max_pause_seconds " << seconds(gc.pause.max()) << '\n';
+  header(os, "aelkey_gc_p99_pause_seconds", "gauge", "99th percentile loop collector step.");
+  os << "aelkey_gc_p99_pause_seconds " << seconds(gc.pause.percentile(99)) << '\n';
+
+  if (const LuaPoolStats *pool = LuaPool::stats()) {
+    header(os, "aelkey_lua_allocs_total", "counter", "Lua allocations, by source.");
+    os << "aelkey_lua_allocs_total{source=\"pool\"} " << pool->pool_allocs << '\n';
+    os << "aelkey_lua_allocs_total{source=\"fallback\"} " << pool->fallback_allocs << '\n';
+    header(os, "aelkey_lua_alloc_bytes_total", "counter", "Bytes requested by Lua.");
+    os << "aelkey_lua_alloc_bytes_total " << pool->bytes_allocated << '\n';
+    header(os, "aelkey_lua_pool_bytes", "gauge", "Memory held by the Lua pool allocator.");
+    os << "aelkey_lua_pool_bytes " << pool->pool_bytes << '\n';
+    header(
+        os,
+        "aelkey_lua_allocs_per_frame_p99",
+        "gauge",
+        "99th percentile Lua allocations per frame."
+    );
+    os << "aelkey_lua_allocs_per_frame_p99 " << pool->allocs_per_frame.percentile(99) << '\n';
+  }
+
+  header(os, "aelkey_devices_attached", "gauge", "Attached input devices.");
+  os << "aelkey_devices_attached " << state.input_map.size() << '\n';
+
+  header(os, "aelkey_device_info", "gauge", "Attached input device, by id and type.");
+  for (const auto &[id, decl] : state.input_map) {
+    os << "aelkey_device_info{device=" << label(id) << ",type=" << label(decl.type) << "} 1\n";
+  }
+
+  const BusyPollStats &bp = stats.busy_poll;
+  header(os, "aelkey_busy_poll_spins_total", "counter", "Zero-timeout epoll_wait calls.");
+  os << "aelkey_busy_poll_spins_total " << bp.spin_polls << '\n';
+  header(os, "aelkey_busy_poll_hits_total", "counter", "Zero-timeout polls that found events.");
+  os << "aelkey_busy_poll_hits_total " << bp.spin_hits << '\n';
+  header(os, "aelkey_busy_poll_idle_seconds_total", "counter", "Time spent in empty polls.");
+  os << "aelkey_busy_poll_idle_seconds_total " << seconds(bp.spin_idle_ns) << '\n';
+  header(os, "aelkey_busy_poll_cpu_seconds_total", "counter", "CPU time used by empty polls.");
+  os << "aelkey_busy_poll_cpu_seconds_total " << seconds(bp.spin_cpu_ns) << '\n';
+  header(os, "aelkey_blocking_waits_total", "counter", "Blocking epoll_wait calls.");
+  os << "aelkey_blocking_waits_total " << bp.blocking_waits << '\n';
+
+  return os.str();
+}
+
+std::string DispatcherControl::devices() const {
+  auto &state = AelkeyState::instance();
+  std::string out;
+  for (const auto &[id, decl] : state.input_map) {
+    out += id + " " + decl.type + " " + (decl.on_event.empty() ? "-" : decl.on_event) + "\n";
+  }
+  return out;
+}
+
+std::string DispatcherControl::set_log_level(const std::string &level) {
+  static const char *const levels[] = { "none",  "error", "warn", "info",
+                                        "debug", "trace", "spam", "all" };
+
+  bool known = false;
+  for (const char *l : levels) {
+    known = known || level == l;
+  }
+  if (!known) {
+    return "error: unknown log level '" + level + "'\n";
+  }
+
+  sol::state_view lua(AelkeyState::instance().lua_vm);
+  sol::optional<sol::table> aelkey = lua["aelkey"];
+  sol::optional<sol::table> log = aelkey ? aelkey->get<sol::optional<sol::table>>("log")
+                                         : sol::optional<sol::table>{};
+  if (!log) {
+    return "error: aelkey.log is not loaded\n";
+  }
+
+  sol::protected_function set_level = (*log)["set_level"];
+  sol::protected_function_result res = set_level(level);
+  if (!res.valid()) {
+    sol::error err = res;
+    return std::string("error: ") + err.what() + "\n";
+  }
+  return "ok\n";
+}
+
+std::string DispatcherControl::rebind(const std::string &device, const std::string &callback) {
+  auto &state = AelkeyState::instance();
+
+  auto it = state.input_map.find(device);
+  if (it == state.input_map.end()) {
+    return "error: unknown device '" + device + "'\n";
+  }
+
+  sol::state_view lua(state.lua_vm);
+  sol::object obj = lua[callback];
+  if (!obj.is<sol::function>()) {
+    return "error: '" + callback + "' is not a global function\n";
+  }
+
+  InputDecl &decl = it->second;
+  if (decl.type == "hidraw") {
+    if (decl.on_event.empty()) {
+      // opened without a callback, the fd is not being read
+      return "error: device was opened without an event callback\n";
+    }
+    DispatcherHidraw::instance().set_callback(device, callback);
+  }
+  decl.on_event = callback;
+
+  if (decl.type == "gatt") {
+    DeviceBackendGATT::instance().refresh_routes(decl);
+  }
+
+  return "ok\n";
+}
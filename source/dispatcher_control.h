@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dispatcher.h"
+#include "singleton.h"
+
+// Unix-domain control socket, served from the main loop.
+//
+// Line protocol, one command per line:
+//   metrics                      counters in Prometheus text format
+//   devices                      attached devices
+//   log <level>                  aelkey.log.set_level(level)
+//   trace [path]                 write the trace ring (Chrome JSON)
+//   rebind <device> <callback>   change a device's event callback
+//   help, quit
+//
+// "GET /metrics" as the first line gets an HTTP/1.0 response, so the
+// socket can be scraped with `curl --unix-socket`.
+//
+// All I/O is non-blocking. Replies that do not fit the socket buffer are
+// kept and sent on EPOLLOUT; clients that send too much are dropped.
+// `trace` snapshots the ring on the loop and writes the file on a worker
+// thread; the client's later commands wait for its reply.
+class DispatcherControl : public Dispatcher<DispatcherControl> {
+  friend class Singleton<DispatcherControl>;
+  friend class Dispatcher<DispatcherControl>;
+
+ protected:
+  DispatcherControl() = default;
+  ~DispatcherControl() {
+    stop();
+  }
+
+ public:
+  const char *type() const override {
+    return "control";
+  }
+
+  bool start(const std::string &path);
+  void stop();
+
+  bool running() const {
+    return listen_fd_ >= 0;
+  }
+
+  void handle_event(EpollPayload *payload, uint32_t events) override;
+
+  // Prometheus text exposition of the loop counters
+  std::string metrics() const;
+
+ private:
+  struct Client {
+    std::string in;
+    std::string out;
+    uint64_t serial = 0;   // tells the client apart from a later one on the same fd
+    bool closing = false;  // close once `out` is flushed
+    bool waiting = false;  // a trace is being written; later commands wait
+  };
+
+  // Replies of trace writes, handed back by the worker threads
+  struct TraceWrites {
+    struct Result {
+      uint64_t serial;
+      std::string reply;
+    };
+
+    ~TraceWrites();
+
+    std::mutex mutex;
+    std::vector<Result> done;
+    int event_fd = -1;  // signalled after each result
+  };
+
+  void accept_clients();
+  void read_client(int fd, Client &client);
+  void run_lines(int fd, Client &client);
+  bool flush_client(int fd, Client &client);
+  void close_client(int fd);
+
+  std::string run_command(const std::string &line, Client &client);
+  std::string write_trace(const std::string &file, Client &client);
+  void finish_trace_writes();
+  std::string devices() const;
+  std::string set_log_level(const std::string &level);
+  std::string rebind(const std::string &device, const std::string &callback);
+
+  int listen_fd_ = -1;
+  std::string path_;
+  std::map<int, Client> clients_;
+  uint64_t next_serial_ = 0;
+
+  // shared with the worker threads, which may outlive stop()
+  std::shared_ptr<TraceWrites> trace_writes_;
+};
+
+template class Dispatcher<DispatcherControl>;
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstring>
 #include <iostream>
 #include <map>
+#include <vector>
 
 #include <fcntl.h>
 #include <libevdev/libevdev.h>
@@ -14,7 +16,14 @@
 #include "dispatcher.h"
 #include "dispatcher_haptics.h"
 #include "dispatcher_udev.h"
+#include "evdev_key_state.h"
+#include "input_log.h"
+#include "io_pool.h"
+#include "callback_stats.h"
+#include "latency_stats.h"
 #include "singleton.h"
+#include "trace.h"
+#include "uring_loop.h"
 
 class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
   friend class Singleton<DispatcherEvdev>;
@@ -29,6 +38,10 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
     return "evdev";
   }
 
+  bool input_source() const override {
+    return true;
+  }
+
   bool open_device(const std::string &devnode, InputDecl &decl) {
     // Open evdev node
     decl.fd = open(devnode.c_str(), O_RDWR | O_NONBLOCK);
@@ -64,8 +77,20 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
       try_evdev_grab(decl);
     }
 
-    // Register FD with epoll
-    register_fd(decl.fd, EPOLLIN | EPOLLHUP | EPOLLERR);
+    // Register FD with epoll, or hand it to an I/O thread or io_uring
+    int fd = decl.fd;
+    auto &pool = IoPool::instance();
+    auto &uring = UringLoop::instance();
+    if (pool.running() && pool.add_evdev(decl.id, fd)) {
+      // read on an I/O thread
+    } else if (uring.active() &&
+               uring.add_read(fd, [this, fd](const uint8_t *data, int res) {
+                 handle_records(fd, data, res);
+               })) {
+      // multishot read
+    } else {
+      register_fd(fd, EPOLLIN | EPOLLHUP | EPOLLERR);
+    }
 
     // store stable device ID
     devices_[decl.fd] = decl.id;
@@ -76,9 +101,16 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
   void close_device(InputDecl &decl) {
     // Unregister from epoll
     if (decl.fd >= 0) {
-      unregister_fd(decl.fd);
+      if (get_payload(decl.fd)) {
+        unregister_fd(decl.fd);
+      } else {
+        IoPool::instance().remove(decl.fd);
+        UringLoop::instance().remove_read(decl.fd);
+      }
       devices_.erase(decl.fd);
       grab_needed_.erase(decl.fd);
+      syncing_.erase(decl.fd);
+      key_states_.erase(decl.fd);
     }
 
     // Free libevdev
@@ -115,10 +147,7 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
 
     // HUP/ERR → detach device
     if (events & (EPOLLHUP | EPOLLERR)) {
-      auto removed = DeviceManager::instance().detach(decl.id);
-      if (removed && !removed->id.empty()) {
-        DispatcherUdev::instance().notify_state_change(*removed, "remove");
-      }
+      handle_hangup(decl.id);
       return;
     }
 
@@ -129,6 +158,104 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
     dispatch_evdev_logic(decl);
   }
 
+  // Frame read on an I/O thread (see IoPool)
+  void deliver_frame(const std::string &id, const struct input_event *events, size_t count) {
+    auto &state = AelkeyState::instance();
+
+    auto decl_it = state.input_map.find(id);
+    if (decl_it == state.input_map.end()) {
+      return;  // device already detached
+    }
+
+    call_frame_callback(decl_it->second, events, count);
+  }
+
+  // Raw input_event records from an io_uring read
+  void handle_records(int fd, const uint8_t *data, int res) {
+    auto it = devices_.find(fd);
+    if (it == devices_.end()) {
+      return;
+    }
+    std::string id = it->second;
+
+    if (!data) {
+      handle_hangup(id);
+      return;
+    }
+
+    auto &state = AelkeyState::instance();
+    auto decl_it = state.input_map.find(id);
+    auto fit = state.frames.find(id);
+    if (decl_it == state.input_map.end() || fit == state.frames.end()) {
+      return;
+    }
+
+    size_t count = static_cast<size_t>(res) / sizeof(struct input_event);
+    for (size_t i = 0; i < count; ++i) {
+      struct input_event ev;
+      std::memcpy(&ev, data + i * sizeof(ev), sizeof(ev));
+
+      if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+        // kernel queue overflowed: discard until the next full frame
+        fit->second.clear();
+        syncing_[fd] = true;
+        state.loop_stats.count_input(id, 0, 1);
+        continue;
+      }
+
+      if (syncing_[fd]) {
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+          syncing_[fd] = false;
+
+          // keys released (or pressed) while events were lost
+          struct input_event sync[KEY_CNT + 1];
+          size_t n = key_states_[fd].resync(fd, ev.time, sync, KEY_CNT + 1);
+          if (n > 0) {
+            key_states_[fd].track(sync, n);
+            call_frame_callback(decl_it->second, sync, n);
+            if (!devices_.contains(fd)) {
+              return;
+            }
+            decl_it = state.input_map.find(id);
+            fit = state.frames.find(id);
+            if (decl_it == state.input_map.end() || fit == state.frames.end()) {
+              return;
+            }
+          }
+        }
+        continue;
+      }
+
+      fit->second.push_back(ev);
+
+      if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+        std::vector<struct input_event> frame;
+        frame.swap(fit->second);
+        key_states_[fd].track(frame.data(), frame.size());
+        call_frame_callback(decl_it->second, frame.data(), frame.size());
+
+        // the callback may have closed the device
+        if (!devices_.contains(fd)) {
+          return;
+        }
+        decl_it = state.input_map.find(id);
+        fit = state.frames.find(id);
+        if (decl_it == state.input_map.end() || fit == state.frames.end()) {
+          return;
+        }
+        frame.clear();
+        fit->second.swap(frame);  // keep the capacity
+      }
+    }
+  }
+
+  void handle_hangup(const std::string &id) {
+    auto removed = DeviceManager::instance().detach(id);
+    if (removed && !removed->id.empty()) {
+      DispatcherUdev::instance().notify_state_change(*removed, "remove");
+    }
+  }
+
  private:
   // --- libevdev helpers ---
   // Retrieve libevdev* for a given fd, or nullptr if not found.
@@ -165,8 +292,6 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
     }
     auto &frame = fit->second;
 
-    sol::state_view lua(state.lua_vm);
-
     struct input_event ev;
     while (true) {
       int rc = libevdev_next_event(idev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
@@ -174,43 +299,13 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
         frame.push_back(ev);
 
         if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
-          if (!decl.on_event.empty()) {
-            sol::object obj = lua[decl.on_event];
-            if (obj.is<sol::function>()) {
-              sol::function cb = obj.as<sol::function>();
-
-              sol::table events_tbl = lua.create_table();
-              int idx = 1;
-              for (const auto &e : frame) {
-                sol::table evt = lua.create_table();
-
-                evt["device"] = decl.id;
-
-                const char *tname = libevdev_event_type_get_name(e.type);
-                const char *cname = libevdev_event_code_get_name(e.type, e.code);
-
-                evt["type"] = tname ? tname : "";
-                evt["code"] = cname ? cname : "";
-                evt["value"] = e.value;
-                evt["sec"] = static_cast<int>(e.time.tv_sec);
-                evt["usec"] = static_cast<int>(e.time.tv_usec);
-
-                events_tbl[idx++] = evt;
-              }
-
-              sol::protected_function pf = cb;
-              sol::protected_function_result res = pf(events_tbl);
-              if (!res.valid()) {
-                sol::error err = res;
-                std::fprintf(stderr, "Lua event callback error: %s\n", err.what());
-              }
-            }
-          }
+          call_frame_callback(decl, frame.data(), frame.size());
           frame.clear();
         }
       } else if (rc == -EAGAIN) {
         break;
       } else if (rc == LIBEVDEV_READ_STATUS_SYNC) {
+        state.loop_stats.count_input(decl.id, 0, 1);
         break;
       } else {
         break;
@@ -218,6 +313,67 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
     }
   }
 
+  void call_frame_callback(
+      const InputDecl &decl, const struct input_event *events, size_t count
+  ) {
+    auto &state = AelkeyState::instance();
+    state.loop_stats.count_input(decl.id, count);
+
+    if (InputLog::recording()) {
+      InputLog::record(InputLogKind::Evdev, decl.id, events, count * sizeof(*events));
+    }
+
+    if (decl.on_event.empty()) {
+      return;
+    }
+
+    sol::state_view lua(state.lua_vm);
+
+    sol::object obj = lua[decl.on_event];
+    if (!obj.is<sol::function>()) {
+      return;
+    }
+    sol::function cb = obj.as<sol::function>();
+
+    // the callback may detach this device
+    std::string device_id = decl.id;
+
+    sol::table events_tbl = lua.create_table();
+    for (size_t i = 0; i < count; ++i) {
+      const auto &e = events[i];
+      sol::table evt = lua.create_table();
+
+      evt["device"] = device_id;
+
+      const char *tname = libevdev_event_type_get_name(e.type);
+      const char *cname = libevdev_event_code_get_name(e.type, e.code);
+
+      evt["type"] = tname ? tname : "";
+      evt["code"] = cname ? cname : "";
+      evt["value"] = e.value;
+      evt["sec"] = static_cast<int>(e.time.tv_sec);
+      evt["usec"] = static_cast<int>(e.time.tv_usec);
+
+      events_tbl[i + 1] = evt;
+    }
+
+    // SYN_REPORT carries the frame's kernel timestamp
+    uint64_t event_ns = 0;
+    if (count > 0 && LatencyStats::instance().enabled()) {
+      event_ns = evdev_time_to_monotonic_ns(events[count - 1].time);
+    }
+    LatencyScope latency(device_id, event_ns);
+    CallbackTimer timer(decl.on_event);
+    TRACE_SCOPE(TraceCategory::Evdev, "frame", device_id);
+
+    sol::protected_function pf = cb;
+    sol::protected_function_result res = pf(events_tbl);
+    if (!res.valid()) {
+      sol::error err = res;
+      std::fprintf(stderr, "Lua event callback error: %s\n", err.what());
+    }
+  }
+
   bool try_evdev_grab(InputDecl &decl) {
     auto it = grab_needed_.find(decl.fd);
     if (it == grab_needed_.end() || !it->second) {
@@ -266,6 +422,12 @@ class DispatcherEvdev : public Dispatcher<DispatcherEvdev> {
 
   // fd → flag
   std::map<int, bool> grab_needed_;
+
+  // fd → discarding input after SYN_DROPPED
+  std::map<int, bool> syncing_;
+
+  // fd → keys delivered to Lua from io_uring reads
+  std::map<int, EvdevKeyState> key_states_;
 };
 
 template class Dispatcher<DispatcherEvdev>;
@@ -12,9 +12,22 @@ class DispatcherGATT : public Dispatcher<DispatcherGATT> {
     return "gatt";
   }
 
-  void handle_event(EpollPayload *, uint32_t events) override {
+  bool input_source() const override {
+    return true;
+  }
+
+  void handle_event(EpollPayload *payload, uint32_t events) override {
+    auto &gatt = DeviceBackendGATT::instance();
+
+    // AcquireNotify/AcquireWrite sockets, the D-Bus timeout timer, and
+    // the dispatch eventfd; everything else arrives on the bus
+    if (payload && payload->fd != gatt.fd()) {
+      gatt.handle_socket(payload->fd, events);
+      return;
+    }
+
     if (events & EPOLLIN) {
-      DeviceBackendGATT::instance().pump_messages();
+      gatt.pump_messages();
     }
   }
 
@@ -25,6 +38,16 @@ class DispatcherGATT : public Dispatcher<DispatcherGATT> {
       return false;
     }
     register_fd(fd, EPOLLIN);
+
+    int timer_fd = DeviceBackendGATT::instance().timer_fd();
+    if (timer_fd >= 0) {
+      register_fd(timer_fd, EPOLLIN);
+    }
+
+    int dispatch_fd = DeviceBackendGATT::instance().dispatch_fd();
+    if (dispatch_fd >= 0) {
+      register_fd(dispatch_fd, EPOLLIN);
+    }
     return true;
   }
 };
@@ -7,6 +7,7 @@
 #include <unistd.h>
 
 #include "aelkey_state.h"
+#include "callback_stats.h"
 
 void DispatcherHaptics::cleanup_sources() {
   for (auto &[id, src] : sources_) {
@@ -431,6 +432,7 @@ void DispatcherHaptics::handle_play(
     ev["effect"] = haptics_effect_to_lua(lua, it->second);
   }
 
+  CallbackTimer timer(src.callback);
   sol::protected_function pf = f;
   sol::protected_function_result res = pf(ev);
   if (!res.valid()) {
@@ -458,6 +460,7 @@ void DispatcherHaptics::handle_stop(sol::this_state ts, HapticsSourceCtx &src, i
   ev["type"] = "stop";
   ev["id"] = virt_id;
 
+  CallbackTimer timer(src.callback);
   sol::protected_function pf = f;
   sol::protected_function_result res = pf(ev);
   if (!res.valid()) {
@@ -1,17 +1,41 @@
 #pragma once
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <map>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <fcntl.h>
 #include <sol/sol.hpp>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 #include "aelkey_state.h"
 #include "device_declarations.h"
 #include "device_helpers.h"
 #include "dispatcher.h"
+#include "hidraw_reader.h"
+#include "callback_stats.h"
+#include "input_log.h"
+#include "io_pool.h"
+#include "trace.h"
+#include "latency_stats.h"
+#include "uring_loop.h"
+#include "util/clock.h"
+
+// One report as handed to the Lua delivery path.
+// result > 0: report size, 0: disconnect, < 0: -errno
+struct HidrawReportView {
+  const uint8_t *data = nullptr;
+  ssize_t result = 0;
+  uint64_t time_ns = 0;
+  uint32_t dropped = 0;
+};
 
 class DispatcherHidraw : public Dispatcher<DispatcherHidraw> {
   friend class Singleton<DispatcherHidraw>;
@@ -19,13 +43,23 @@ class DispatcherHidraw : public Dispatcher<DispatcherHidraw> {
 
  protected:
   DispatcherHidraw() = default;
-  ~DispatcherHidraw() = default;
+  ~DispatcherHidraw() {
+    readers_.clear();
+    if (notify_fd_ >= 0) {
+      close(notify_fd_);
+      notify_fd_ = -1;
+    }
+  }
 
  public:
   const char *type() const override {
     return "hidraw";
   }
 
+  bool input_source() const override {
+    return true;
+  }
+
   void on_unregister(int fd) override {
     close(fd);
   }
@@ -44,8 +78,27 @@ class DispatcherHidraw : public Dispatcher<DispatcherHidraw> {
       }
     }
 
-    // Register with dispatcher (creates EpollPayload)
-    register_fd(fd, EPOLLIN);
+    // Without a callback nobody consumes reports, so keep the fd out of
+    // epoll instead of waking up just to read and discard them.
+    // hid.read_input_report() can still read it directly.
+    if (!decl.on_event.empty()) {
+      if (decl.grab || decl.threaded) {
+        // Blocking reads happen on a reader thread, never in the loop
+        if (!start_reader(fd)) {
+          close(fd);
+          return -1;
+        }
+      } else if (IoPool::instance().running() && IoPool::instance().add_hidraw(decl.id, fd)) {
+        // read on an I/O thread
+      } else if (UringLoop::instance().active() &&
+                 UringLoop::instance().add_read(fd, [this, fd](const uint8_t *data, int res) {
+                   handle_uring_report(fd, data, res);
+                 })) {
+        // multishot read: one report per completion
+      } else {
+        register_fd(fd, EPOLLIN);
+      }
+    }
 
     // Store InputDecl by FD
     devices_[fd] = decl;
@@ -57,17 +110,43 @@ class DispatcherHidraw : public Dispatcher<DispatcherHidraw> {
     for (auto it = devices_.begin(); it != devices_.end(); ++it) {
       if (it->second.id == id) {
         int fd = it->first;
-        unregister_fd(fd);
+        if (auto rit = readers_.find(fd); rit != readers_.end()) {
+          // may run inside this reader's callback; destroy the ring later
+          rit->second->stop();
+          retired_readers_.push_back(std::move(rit->second));
+          readers_.erase(rit);
+          close(fd);
+        } else if (get_payload(fd)) {
+          unregister_fd(fd);
+        } else {
+          IoPool::instance().remove(fd);
+          UringLoop::instance().remove_read(fd);
+          close(fd);
+        }
         devices_.erase(it);
         return;
       }
     }
   }
 
+  // Change the event callback of an attached device
+  void set_callback(const std::string &id, const std::string &callback) {
+    for (auto &[fd, decl] : devices_) {
+      if (decl.id == id) {
+        decl.on_event = callback;
+      }
+    }
+  }
+
   // Called by epoll loop
   void handle_event(EpollPayload *payload, uint32_t events) override {
     int fd = payload->fd;
 
+    if (fd == notify_fd_) {
+      handle_reader_notify();
+      return;
+    }
+
     auto it = devices_.find(fd);
     if (it == devices_.end()) {
       return;
@@ -76,20 +155,31 @@ class DispatcherHidraw : public Dispatcher<DispatcherHidraw> {
     handle_hidraw_event(fd, it->second, events);
   }
 
- private:
-  void handle_hidraw_event(int fd, const InputDecl &decl, uint32_t events) {
-    if (!(events & EPOLLIN)) {
-      return;
+  // Deliver reports to the device callback, either one call per report
+  // or, with decl.batch, a single call with an array of report tables.
+  void deliver_reports(const InputDecl &decl, const HidrawReportView *reports, size_t count) {
+    auto &state = AelkeyState::instance();
+
+    uint64_t dropped = 0;
+    for (size_t i = 0; i < count; ++i) {
+      dropped += reports[i].dropped;
     }
+    state.loop_stats.count_input(decl.id, count, dropped);
 
-    uint8_t buf[4096];
-    ssize_t r = ::read(fd, buf, sizeof(buf));
+    if (InputLog::recording()) {
+      for (size_t i = 0; i < count; ++i) {
+        const HidrawReportView &r = reports[i];
+        size_t size = r.result > 0 ? static_cast<size_t>(r.result) : 0;
+        InputLog::record(
+            InputLogKind::Hidraw, decl.id, r.data, size, static_cast<int32_t>(r.result)
+        );
+      }
+    }
 
-    if (decl.on_event.empty()) {
+    if (count == 0 || decl.on_event.empty()) {
       return;
     }
 
-    auto &state = AelkeyState::instance();
     sol::state_view lua(state.lua_vm);
 
     sol::object obj = lua[decl.on_event];
@@ -97,30 +187,206 @@ class DispatcherHidraw : public Dispatcher<DispatcherHidraw> {
       return;
     }
 
-    sol::function cb = obj.as<sol::function>();
+    sol::protected_function pf = obj.as<sol::function>();
+
+    // the callback may close the device, so do not touch decl afterwards
+    const std::string device = decl.id;
+    const std::string callback = decl.on_event;
+
+    if (decl.batch) {
+      sol::table batch = lua.create_table(static_cast<int>(count), 0);
+      for (size_t i = 0; i < count; ++i) {
+        batch[i + 1] = make_report_table(lua, device, reports[i]);
+      }
+      LatencyScope latency(device, reports[0].time_ns);
+      TRACE_SCOPE(TraceCategory::Hidraw, "report_batch", device);
+      call_callback(pf, callback, batch);
+      return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      sol::table report = make_report_table(lua, device, reports[i]);
+      LatencyScope latency(device, reports[i].time_ns);
+      TRACE_SCOPE(TraceCategory::Hidraw, "report", device);
+      call_callback(pf, callback, report);
+    }
+  }
+
+ private:
+  // Upper bound on reports consumed per wakeup so that one busy device
+  // cannot starve the rest of the loop. Level-triggered epoll picks up
+  // whatever is left on the next iteration.
+  static constexpr size_t kMaxDrain = 64;
+
+  void handle_hidraw_event(int fd, const InputDecl &decl, uint32_t events) {
+    if (!(events & EPOLLIN)) {
+      return;
+    }
+
+    size_t count = drain_reports(fd);
+    deliver_reports(decl, reports_.data(), count);
+  }
 
-    sol::table tbl = lua.create_table();
-    tbl["device"] = decl.id;
+  // One report (or the final status) from an io_uring read
+  void handle_uring_report(int fd, const uint8_t *data, int res) {
+    auto it = devices_.find(fd);
+    if (it == devices_.end()) {
+      return;
+    }
 
-    if (r > 0) {
-      tbl["data"] = std::string_view(reinterpret_cast<const char *>(buf), r);
-      tbl["size"] = static_cast<int>(r);
+    HidrawReportView report{ data, res, monotonic_ns() };
+    deliver_reports(it->second, &report, 1);
+  }
+
+  // Read pending reports until EAGAIN, a disconnect/error, or kMaxDrain.
+  size_t drain_reports(int fd) {
+    if (buffer_.empty()) {
+      buffer_.resize(kMaxDrain * HIDRAW_MAX_REPORT_SIZE);
+      reports_.resize(kMaxDrain);
+    }
+
+    size_t count = 0;
+    while (count < kMaxDrain) {
+      uint8_t *dst = buffer_.data() + count * HIDRAW_MAX_REPORT_SIZE;
+      ssize_t r = ::read(fd, dst, HIDRAW_MAX_REPORT_SIZE);
+      if (r < 0) {
+        int err = errno;
+        if (err == EINTR) {
+          continue;
+        }
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+          break;
+        }
+        r = -err;
+      }
+
+      reports_[count++] = HidrawReportView{ dst, r, monotonic_ns() };
+
+      if (r <= 0) {
+        break;  // disconnect or error ends the batch
+      }
+    }
+
+    return count;
+  }
+
+  bool start_reader(int fd) {
+    if (notify_fd_ < 0) {
+      notify_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (notify_fd_ < 0) {
+        perror("eventfd hidraw");
+        return false;
+      }
+      register_fd(notify_fd_, EPOLLIN);
+    }
+
+    auto reader = std::make_unique<HidrawReader>(fd, notify_fd_);
+    if (!reader->start()) {
+      return false;
+    }
+
+    readers_[fd] = std::move(reader);
+    return true;
+  }
+
+  // Drain every reader ring and deliver its reports on the loop thread.
+  void handle_reader_notify() {
+    uint64_t count;
+    if (read(notify_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+      perror("read hidraw notify");
+    }
+
+    retired_readers_.clear();
+
+    if (reports_.size() < kMaxDrain) {
+      reports_.resize(kMaxDrain);
+    }
+
+    // collect fds first: callbacks may add or remove devices
+    std::vector<int> fds;
+    fds.reserve(readers_.size());
+    for (auto &[fd, reader] : readers_) {
+      fds.push_back(fd);
+    }
+
+    for (int fd : fds) {
+      auto rit = readers_.find(fd);
+      auto dit = devices_.find(fd);
+      if (rit == readers_.end() || dit == devices_.end()) {
+        continue;
+      }
+
+      // keep the reader alive even if the callback closes the device
+      HidrawReader *reader = rit->second.get();
+      auto &ring = reader->ring();
+
+      size_t n = std::min(ring.readable(), kMaxDrain);
+      for (size_t i = 0; i < n; ++i) {
+        HidrawReportSlot &slot = ring.at(i);
+        reports_[i] = HidrawReportView{ slot.data, slot.result, slot.time_ns, slot.dropped };
+      }
+
+      deliver_reports(dit->second, reports_.data(), n);
+      ring.pop(n);
+
+      if (ring.readable() > 0) {
+        // more than kMaxDrain queued: come back on the next iteration
+        uint64_t one = 1;
+        if (write(notify_fd_, &one, sizeof(one)) < 0) {
+          perror("write hidraw notify");
+        }
+      }
+    }
+  }
+
+  static sol::table make_report_table(
+      sol::state_view lua, const std::string &device, const HidrawReportView &rep
+  ) {
+    sol::table tbl = lua.create_table(0, 6);
+    tbl["device"] = device;
+
+    if (rep.result > 0) {
+      tbl["data"] = std::string_view(reinterpret_cast<const char *>(rep.data), rep.result);
+      tbl["size"] = static_cast<int>(rep.result);
       tbl["status"] = "ok";
-    } else if (r == 0) {
+    } else if (rep.result == 0) {
       tbl["status"] = "disconnect";
     } else {
-      tbl["status"] = strerror(errno);
+      tbl["status"] = strerror(static_cast<int>(-rep.result));
     }
 
-    sol::protected_function pf = cb;
-    sol::protected_function_result res = pf(tbl);
+    // monotonic read time, comparable with aelkey.util.now()
+    tbl["sec"] = static_cast<int>(rep.time_ns / 1000000000ULL);
+    tbl["usec"] = static_cast<int>((rep.time_ns / 1000ULL) % 1000000ULL);
+
+    if (rep.dropped > 0) {
+      tbl["dropped"] = static_cast<int>(rep.dropped);
+    }
+
+    return tbl;
+  }
+
+  static void call_callback(
+      sol::protected_function &pf, const std::string &callback, const sol::table &arg
+  ) {
+    CallbackTimer timer(callback);
+    sol::protected_function_result res = pf(arg);
     if (!res.valid()) {
       sol::error err = res;
       fprintf(stderr, "Lua hidraw callback error: %s\n", err.what());
     }
   }
 
-  std::map<int, InputDecl> devices_;
+  std::map<int, InputDecl> devices_;  // copies; see set_callback()
+
+  // fd → reader thread (grabbed or threaded devices)
+  std::map<int, std::unique_ptr<HidrawReader>> readers_;
+  std::vector<std::unique_ptr<HidrawReader>> retired_readers_;
+  int notify_fd_ = -1;
+
+  // reusable drain storage: kMaxDrain slots of HIDRAW_MAX_REPORT_SIZE bytes
+  std::vector<uint8_t> buffer_;
+  std::vector<HidrawReportView> reports_;
 };
 
 template class Dispatcher<DispatcherHidraw>;
@@ -6,6 +6,7 @@
 
 #include "device_backend_libusb.h"
 #include "dispatcher.h"
+#include "io_pool.h"
 
 class DispatcherLibUSB : public Dispatcher<DispatcherLibUSB> {
   friend class Singleton<DispatcherLibUSB>;
@@ -27,6 +28,11 @@ class DispatcherLibUSB : public Dispatcher<DispatcherLibUSB> {
       return false;
     }
 
+    // With I/O threads, libusb handles its own events off the loop
+    if (IoPool::instance().running() && IoPool::instance().start_libusb(ctx)) {
+      return true;
+    }
+
     libusb_set_pollfd_notifiers(
         ctx,
         [](int fd, short events, void *user_data) {
@@ -46,6 +52,10 @@ class DispatcherLibUSB : public Dispatcher<DispatcherLibUSB> {
     return "libusb";
   }
 
+  bool input_source() const override {
+    return true;
+  }
+
   void on_add_fd(int fd, short events) {
     if (get_payload(fd)) {
       return;
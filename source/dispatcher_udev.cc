@@ -7,9 +7,11 @@
 #include <sol/sol.hpp>
 
 #include "aelkey_state.h"
+#include "callback_stats.h"
 #include "device_declarations.h"
 #include "device_manager.h"
 #include "dispatcher_registry.h"
+#include "input_log.h"
 
 DispatcherUdev::~DispatcherUdev() {
   if (mon_) {
@@ -122,6 +124,12 @@ struct udev *DispatcherUdev::get_udev() const {
 }
 
 void DispatcherUdev::notify_state_change(const InputDecl &decl, const char *state) {
+  if (InputLog::recording() && state) {
+    // "<state>\0<on_state>": watchlist decls are not in input_map
+    std::string data = std::string(state) + '\0' + decl.on_state;
+    InputLog::record(InputLogKind::State, decl.id, data.data(), data.size());
+  }
+
   if (decl.on_state.empty()) {
     return;
   }
@@ -138,6 +146,7 @@ void DispatcherUdev::notify_state_change(const InputDecl &decl, const char *stat
   tbl["device"] = decl.id;
   tbl["state"] = state ? state : "";
 
+  CallbackTimer timer(decl.on_state);
   sol::protected_function pf = cb;
   sol::protected_function_result result = pf(tbl);
   if (!result.valid()) {
@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/**
+ * @file evdev_key_state.h
+ * @brief Key state tracking and EVIOCGKEY resync for evdev devices.
+ */
+
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+#include <linux/input.h>
+#include <sys/ioctl.h>
+
+// Key state as delivered to Lua for one evdev device.
+//
+// After input was lost (SYN_DROPPED, or a frame dropped on the way to the
+// loop) resync() builds a frame from EVIOCGKEY that presses or releases
+// every key whose state differs from what Lua has seen, so that no press
+// is left without its release.
+class EvdevKeyState {
+ public:
+  // Record the keys of a delivered frame
+  void track(const struct input_event *events, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      if (events[i].type == EV_KEY && events[i].code < KEY_CNT) {
+        keys_.set(events[i].code, events[i].value != 0);
+      }
+    }
+  }
+
+  // Up to max events, ending in SYN_REPORT and stamped with time; 0 if
+  // nothing differs or the device has no keys
+  size_t resync(int fd, const struct timeval &time, struct input_event *out, size_t max) const {
+    uint8_t down[KEY_MAX / 8 + 1] = {};
+    if (max < 2 || ioctl(fd, EVIOCGKEY(sizeof(down)), down) < 0) {
+      return 0;
+    }
+
+    struct input_event base{};
+    base.time = time;
+
+    size_t n = 0;
+    for (unsigned code = 0; code < KEY_CNT && n + 1 < max; ++code) {
+      bool pressed = (down[code / 8] >> (code % 8)) & 1;
+      if (pressed != keys_.test(code)) {
+        out[n] = base;
+        out[n].type = EV_KEY;
+        out[n].code = static_cast<uint16_t>(code);
+        out[n].value = pressed ? 1 : 0;
+        ++n;
+      }
+    }
+    if (n == 0) {
+      return 0;
+    }
+
+    out[n] = base;
+    out[n].type = EV_SYN;
+    out[n].code = SYN_REPORT;
+    return n + 1;
+  }
+
+ private:
+  std::bitset<KEY_CNT> keys_;
+};
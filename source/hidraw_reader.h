@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "util/clock.h"
+#include "util/spsc_ring.h"
+#include "util/worker_thread.h"
+
+// HID_MAX_BUFFER_SIZE in the kernel
+static constexpr size_t HIDRAW_MAX_REPORT_SIZE = 4096;
+
+struct HidrawReportSlot {
+  uint64_t time_ns = 0;
+  ssize_t result = 0;     // > 0: size, 0: disconnect, < 0: -errno
+  uint32_t dropped = 0;   // reports lost to a full ring before this one
+  uint8_t data[HIDRAW_MAX_REPORT_SIZE];
+};
+
+// Dedicated reader thread for one hidraw fd.
+//
+// The thread may block in read() (grabbed devices keep blocking
+// semantics), pushes every report into an SPSC ring, and wakes the main
+// loop through a shared eventfd. The main loop drains the ring and runs
+// the Lua callback, so it never blocks on the device.
+class HidrawReader {
+ public:
+  static constexpr size_t kRingDepth = 64;
+
+  HidrawReader(int fd, int notify_fd) : fd_(fd), notify_fd_(notify_fd), ring_(kRingDepth) {}
+
+  ~HidrawReader() {
+    stop();
+  }
+
+  HidrawReader(const HidrawReader &) = delete;
+  HidrawReader &operator=(const HidrawReader &) = delete;
+
+  bool start() {
+    stop_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd_ < 0) {
+      perror("eventfd hidraw reader");
+      return false;
+    }
+
+    thread_ = std::thread([this] {
+      worker_thread_defaults();
+      run();
+    });
+    return true;
+  }
+
+  void stop() {
+    if (thread_.joinable()) {
+      uint64_t one = 1;
+      if (write(stop_fd_, &one, sizeof(one)) < 0) {
+        perror("write hidraw reader stop");
+      }
+      thread_.join();
+    }
+
+    if (stop_fd_ >= 0) {
+      close(stop_fd_);
+      stop_fd_ = -1;
+    }
+  }
+
+  int fd() const {
+    return fd_;
+  }
+
+  SpscRing<HidrawReportSlot> &ring() {
+    return ring_;
+  }
+
+ private:
+  void run() {
+    struct pollfd pfds[2] = {
+      { fd_, POLLIN, 0 },
+      { stop_fd_, POLLIN, 0 },
+    };
+
+    uint32_t dropped = 0;
+
+    while (true) {
+      int rc = poll(pfds, 2, -1);
+      if (rc < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror("poll hidraw reader");
+        break;
+      }
+
+      if (pfds[1].revents) {
+        break;
+      }
+
+      if (!pfds[0].revents) {
+        continue;
+      }
+
+      HidrawReportSlot *slot = ring_.claim();
+      if (!slot) {
+        // main loop is behind: keep the kernel queue moving, count the loss
+        uint8_t scratch[HIDRAW_MAX_REPORT_SIZE];
+        ssize_t r = read(fd_, scratch, sizeof(scratch));
+        if (r > 0) {
+          ++dropped;  // reported with the next slot
+          continue;
+        }
+        if (r < 0 && (errno == EINTR || errno == EAGAIN)) {
+          continue;
+        }
+        break;  // disconnect/error while full: the main loop sees udev remove
+      }
+
+      ssize_t r = read(fd_, slot->data, sizeof(slot->data));
+      if (r < 0) {
+        int err = errno;
+        if (err == EINTR || err == EAGAIN || err == EWOULDBLOCK) {
+          continue;
+        }
+        r = -err;
+      }
+
+      slot->time_ns = monotonic_ns();
+      slot->result = r;
+      slot->dropped = dropped;
+      dropped = 0;
+      ring_.publish();
+
+      uint64_t one = 1;
+      if (write(notify_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("write hidraw reader notify");
+      }
+
+      if (r <= 0) {
+        break;  // disconnect or error: nothing more to read
+      }
+    }
+  }
+
+  int fd_ = -1;
+  int notify_fd_ = -1;
+  int stop_fd_ = -1;
+
+  SpscRing<HidrawReportSlot> ring_;
+  std::thread thread_;
+};
@@ -0,0 +1,264 @@
+#include "input_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/clock.h"
+#include "util/worker_thread.h"
+
+namespace {
+
+constexpr char MAGIC[8] = { 'A', 'E', 'L', 'K', 'L', 'O', 'G', '1' };
+constexpr uint32_t VERSION = 1;
+
+size_t padded(size_t n) {
+  return (n + 7) & ~size_t{ 7 };
+}
+
+bool write_all(int fd, const uint8_t *data, size_t size) {
+  while (size > 0) {
+    ssize_t w = ::write(fd, data, size);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += w;
+    size -= static_cast<size_t>(w);
+  }
+  return true;
+}
+
+// Records queued by the loop thread for the writer thread
+struct Writer {
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<uint8_t> queued;  // whole records
+  bool stopping = false;
+  uint64_t dropped = 0;  // records refused while the disk fell behind
+};
+
+Writer writer;
+
+// Queued bytes before records are dropped instead
+constexpr size_t MAX_QUEUED = 16 * 1024 * 1024;
+
+}  // namespace
+
+int InputLog::fd_ = -1;
+uint64_t InputLog::start_ns_ = 0;
+uint64_t InputLog::records_ = 0;
+
+bool InputLog::start(const std::string &path) {
+  if (recording()) {
+    return true;
+  }
+
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    std::fprintf(stderr, "input log: %s: %s\n", path.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  InputLogHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.header_size = sizeof(InputLogHeader);
+  header.start_realtime_ns = clock_ns(CLOCK_REALTIME);
+
+  if (!write_all(fd, reinterpret_cast<const uint8_t *>(&header), sizeof(header))) {
+    perror("input log: write");
+    ::close(fd);
+    return false;
+  }
+
+  fd_ = fd;
+  start_ns_ = monotonic_ns();
+  records_ = 0;
+
+  writer.stopping = false;
+  writer.dropped = 0;
+  writer.thread = std::thread(run_writer);
+  return true;
+}
+
+void InputLog::stop() {
+  if (!recording()) {
+    return;
+  }
+
+  // the writer empties the queue before it exits
+  {
+    std::lock_guard lock(writer.mutex);
+    writer.stopping = true;
+  }
+  writer.wake.notify_one();
+  writer.thread.join();
+
+  if (writer.dropped > 0) {
+    auto dropped = static_cast<unsigned long long>(writer.dropped);
+    std::fprintf(stderr, "input log: %llu records dropped\n", dropped);
+  }
+
+  ::close(fd_);
+  fd_ = -1;
+}
+
+void InputLog::run_writer() {
+  worker_thread_defaults();
+
+  std::vector<uint8_t> batch;
+  bool failed = false;
+
+  while (true) {
+    bool stopping;
+    {
+      std::unique_lock lock(writer.mutex);
+      writer.wake.wait(lock, [] { return writer.stopping || !writer.queued.empty(); });
+      batch.swap(writer.queued);  // both buffers keep their capacity
+      stopping = writer.stopping;
+    }
+
+    if (!batch.empty() && !failed && !write_all(fd_, batch.data(), batch.size())) {
+      perror("input log: write");
+      failed = true;  // reported once; the loop keeps running
+    }
+    batch.clear();
+
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+void InputLog::record(
+    InputLogKind kind, std::string_view id, const void *data, size_t size, int32_t status,
+    uint32_t aux
+) {
+  if (!recording()) {
+    return;
+  }
+
+  size_t id_len = std::min<size_t>(id.size(), UINT16_MAX);
+  size_t total = padded(sizeof(InputLogRecord) + id_len + size);
+
+  InputLogRecord rec{};
+  rec.size = static_cast<uint32_t>(total);
+  rec.kind = static_cast<uint16_t>(kind);
+  rec.id_len = static_cast<uint16_t>(id_len);
+  rec.time_ns = monotonic_ns() - start_ns_;
+  rec.data_len = static_cast<uint32_t>(size);
+  rec.status = status;
+  rec.aux = aux;
+
+  static const uint8_t zeros[8] = {};
+  {
+    std::lock_guard lock(writer.mutex);
+    if (writer.queued.size() + total > MAX_QUEUED) {
+      ++writer.dropped;
+      return;
+    }
+    auto append = [](const void *p, size_t n) {
+      const auto *bytes = static_cast<const uint8_t *>(p);
+      writer.queued.insert(writer.queued.end(), bytes, bytes + n);
+    };
+    append(&rec, sizeof(rec));
+    append(id.data(), id_len);
+    append(data, size);
+    append(zeros, total - sizeof(rec) - id_len - size);
+  }
+  writer.wake.notify_one();
+
+  ++records_;
+}
+
+bool InputLogReader::open(const std::string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::fprintf(stderr, "input log: %s: %s\n", path.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  struct stat st{};
+  if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(InputLogHeader)) {
+    std::fprintf(stderr, "input log: %s: not an input log\n", path.c_str());
+    ::close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mem == MAP_FAILED) {
+    perror("input log: mmap");
+    return false;
+  }
+
+  const auto *header = static_cast<const InputLogHeader *>(mem);
+  if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION ||
+      header->header_size < sizeof(InputLogHeader) || header->header_size > size) {
+    std::fprintf(stderr, "input log: %s: not an input log\n", path.c_str());
+    munmap(mem, size);
+    return false;
+  }
+
+  madvise(mem, size, MADV_SEQUENTIAL);
+
+  data_ = static_cast<const uint8_t *>(mem);
+  size_ = size;
+  offset_ = header->header_size;
+  start_realtime_ns_ = header->start_realtime_ns;
+  return true;
+}
+
+void InputLogReader::close() {
+  if (data_) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  offset_ = 0;
+  start_realtime_ns_ = 0;
+}
+
+bool InputLogReader::next(InputLogEntry &entry) {
+  if (!data_ || size_ - offset_ < sizeof(InputLogRecord)) {
+    return false;
+  }
+
+  InputLogRecord rec;
+  std::memcpy(&rec, data_ + offset_, sizeof(rec));
+
+  if (rec.size < sizeof(rec) || rec.size > size_ - offset_ ||
+      sizeof(rec) + size_t{ rec.id_len } + rec.data_len > rec.size) {
+    offset_ = size_;  // truncated or damaged
+    return false;
+  }
+
+  const uint8_t *p = data_ + offset_ + sizeof(rec);
+  entry.kind = static_cast<InputLogKind>(rec.kind);
+  entry.time_ns = rec.time_ns;
+  entry.id = std::string_view(reinterpret_cast<const char *>(p), rec.id_len);
+  entry.data = p + rec.id_len;
+  entry.size = rec.data_len;
+  entry.status = rec.status;
+  entry.aux = rec.aux;
+
+  offset_ += rec.size;
+  return true;
+}
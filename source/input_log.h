@@ -0,0 +1,124 @@
+#pragma once
+
+// Binary log of everything delivered to Lua, for replay without the
+// physical devices (aelkey.start{ record = path } / { replay = path }).
+//
+// Layout: an InputLogHeader, then InputLogRecords back to back. Each
+// record is followed by the device id and its data, padded to 8 bytes,
+// so the file can be mapped and walked in place. Records are queued for a
+// writer thread, which writes whatever is queued as soon as it wakes:
+// disk I/O stays off the loop thread, and a crash loses only the records
+// not picked up yet. The reader stops at the last whole one.
+//
+//   kind      id                 data                      status     aux
+//   Evdev     device id          input_event[] (one frame)
+//   Hidraw    device id          report bytes              read()
+//   Usb       device id          transfer bytes            libusb     endpoint | type << 8
+//   Gatt      characteristic     notification value
+//   State     device id          "add"/"remove" NUL on_state
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+enum class InputLogKind : uint16_t {
+  Evdev = 1,
+  Hidraw = 2,
+  Usb = 3,
+  Gatt = 4,
+  State = 5,
+};
+
+struct InputLogHeader {
+  char magic[8];  // "AELKLOG1"
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t start_realtime_ns;
+  uint64_t reserved;
+};
+
+struct InputLogRecord {
+  uint32_t size;  // header, id, data, and padding
+  uint16_t kind;
+  uint16_t id_len;
+  uint64_t time_ns;  // since the start of the recording
+  uint32_t data_len;
+  int32_t status;
+  uint32_t aux;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(InputLogHeader) == 32);
+static_assert(sizeof(InputLogRecord) == 32);
+
+// One record of a mapped log; views point into the mapping
+struct InputLogEntry {
+  InputLogKind kind;
+  uint64_t time_ns;
+  std::string_view id;
+  const uint8_t *data;
+  size_t size;
+  int32_t status;
+  uint32_t aux;
+};
+
+// Recorder, called from the delivery paths on the loop thread
+class InputLog {
+ public:
+  static bool recording() {
+    return fd_ >= 0;
+  }
+
+  static bool start(const std::string &path);
+  static void stop();
+
+  static void record(
+      InputLogKind kind, std::string_view id, const void *data, size_t size, int32_t status = 0,
+      uint32_t aux = 0
+  );
+
+  static uint64_t records() {
+    return records_;
+  }
+
+ private:
+  static void run_writer();
+
+  static int fd_;
+  static uint64_t start_ns_;
+  static uint64_t records_;
+};
+
+// Read-only mapping of a log
+class InputLogReader {
+ public:
+  InputLogReader() = default;
+  ~InputLogReader() {
+    close();
+  }
+
+  InputLogReader(const InputLogReader &) = delete;
+  InputLogReader &operator=(const InputLogReader &) = delete;
+
+  bool open(const std::string &path);
+  void close();
+
+  // Next record; false at the end or at a damaged record
+  bool next(InputLogEntry &entry);
+
+  bool at_end() const {
+    return offset_ >= size_;
+  }
+
+  // CLOCK_REALTIME when the recording started
+  uint64_t start_realtime_ns() const {
+    return start_realtime_ns_;
+  }
+
+ private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  uint64_t start_realtime_ns_ = 0;
+};
@@ -0,0 +1,566 @@
+#include "io_pool.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "aelkey_state.h"
+#include "aelkey_usb.h"
+#include "dispatcher_evdev.h"
+#include "dispatcher_hidraw.h"
+#include "evdev_key_state.h"
+#include "trace.h"
+#include "util/clock.h"
+#include "util/worker_thread.h"
+
+namespace {
+
+// Token for the per-worker stop eventfd
+constexpr uint64_t STOP_TOKEN = 0;
+
+// evdev: read raw input_event records and split them into SYN_REPORT frames
+class EvdevIoSource : public IoSource {
+ public:
+  static constexpr size_t kRingDepth = 64;
+
+  EvdevIoSource(std::string id, int fd) : IoSource(std::move(id), fd), ring_(kRingDepth) {}
+
+  bool read_available(uint32_t events) override {
+    if (events & (EPOLLHUP | EPOLLERR)) {
+      publish_hangup();
+      return false;
+    }
+
+    struct input_event buf[64];
+    while (true) {
+      ssize_t r = ::read(fd_, buf, sizeof(buf));
+      if (r < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          return true;
+        }
+        publish_hangup();
+        return false;
+      }
+      if (r == 0) {
+        publish_hangup();
+        return false;
+      }
+
+      uint64_t now = monotonic_ns();
+      size_t n = static_cast<size_t>(r) / sizeof(struct input_event);
+      for (size_t i = 0; i < n; ++i) {
+        accept(buf[i], now);
+      }
+    }
+  }
+
+  void deliver() override {
+    auto &evdev = DispatcherEvdev::instance();
+
+    size_t n = ring_.readable();
+    for (size_t i = 0; i < n; ++i) {
+      EvdevFrameSlot &slot = ring_.at(i);
+      if (slot.hangup) {
+        ring_.pop(n);
+        evdev.handle_hangup(id_);  // removes this source
+        return;
+      }
+      if (slot.dropped) {
+        AelkeyState::instance().loop_stats.count_input(id_, 0, slot.dropped);
+      }
+      evdev.deliver_frame(id_, slot.events, slot.count);
+    }
+    ring_.pop(n);
+  }
+
+ private:
+  void accept(const struct input_event &ev, uint64_t now) {
+    if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+      // kernel queue overflowed: discard until the next full frame
+      count_ = 0;
+      syncing_ = true;
+      dropped_ = true;
+      ++dropped_frames_;
+      return;
+    }
+
+    if (syncing_) {
+      if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+        syncing_ = false;
+      }
+      return;
+    }
+
+    frame_[count_++] = ev;
+
+    if ((ev.type == EV_SYN && ev.code == SYN_REPORT) || count_ == IO_FRAME_MAX_EVENTS) {
+      publish_frame(now);
+    }
+  }
+
+  void publish_frame(uint64_t now) {
+    if (dropped_ && !publish_key_resync(now)) {
+      drop_frame();
+      return;
+    }
+
+    EvdevFrameSlot *slot = ring_.claim();
+    if (!slot) {
+      drop_frame();
+      return;
+    }
+
+    slot->time_ns = now;
+    slot->count = static_cast<uint16_t>(count_);
+    slot->dropped = dropped_frames_;
+    slot->hangup = false;
+    std::memcpy(slot->events, frame_, count_ * sizeof(struct input_event));
+    keys_.track(frame_, count_);
+    ring_.publish();
+
+    count_ = 0;
+    dropped_ = false;
+    dropped_frames_ = 0;
+  }
+
+  // Loop thread is behind: lose the frame, and resync before the next one
+  void drop_frame() {
+    count_ = 0;
+    dropped_ = true;
+    ++dropped_frames_;
+  }
+
+  // After lost input, publish a frame that brings the keys the loop has
+  // seen pressed in line with the device, so that no press is left
+  // without its release. False if the ring is still full.
+  bool publish_key_resync(uint64_t now) {
+    struct timeval time{};
+    if (count_ > 0) {
+      time = frame_[0].time;
+    }
+
+    struct input_event sync[IO_FRAME_MAX_EVENTS];
+    size_t n = keys_.resync(fd_, time, sync, IO_FRAME_MAX_EVENTS);
+    if (n == 0) {
+      return true;  // nothing to resync
+    }
+
+    EvdevFrameSlot *slot = ring_.claim();
+    if (!slot) {
+      return false;
+    }
+    slot->time_ns = now;
+    slot->count = static_cast<uint16_t>(n);
+    slot->dropped = dropped_frames_;
+    slot->hangup = false;
+    std::memcpy(slot->events, sync, n * sizeof(struct input_event));
+    keys_.track(sync, n);
+    ring_.publish();
+
+    dropped_frames_ = 0;
+    return true;
+  }
+
+  void publish_hangup() {
+    EvdevFrameSlot *slot = ring_.claim();
+    if (!slot) {
+      return;  // udev remove still detaches the device
+    }
+
+    slot->time_ns = monotonic_ns();
+    slot->count = 0;
+    slot->dropped = 0;
+    slot->hangup = true;
+    ring_.publish();
+  }
+
+  SpscRing<EvdevFrameSlot> ring_;
+
+  // I/O thread only
+  struct input_event frame_[IO_FRAME_MAX_EVENTS];
+  size_t count_ = 0;
+  bool syncing_ = false;
+  bool dropped_ = false;          // resync keys before the next frame
+  uint32_t dropped_frames_ = 0;  // reported with the next frame
+  EvdevKeyState keys_;  // as published to the loop
+};
+
+// hidraw: one ring slot per report
+class HidrawIoSource : public IoSource {
+ public:
+  static constexpr size_t kRingDepth = 64;
+
+  HidrawIoSource(std::string id, int fd)
+      : IoSource(std::move(id), fd), ring_(kRingDepth), views_(ring_.capacity()) {}
+
+  bool read_available(uint32_t events) override {
+    while (true) {
+      HidrawReportSlot *slot = ring_.claim();
+      if (!slot) {
+        // loop thread is behind; keep the kernel queue moving
+        uint8_t scratch[HIDRAW_MAX_REPORT_SIZE];
+        ssize_t r = ::read(fd_, scratch, sizeof(scratch));
+        if (r > 0) {
+          ++dropped_;
+          continue;
+        }
+        if (r < 0 && (errno == EINTR)) {
+          continue;
+        }
+        return r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+      }
+
+      ssize_t r = ::read(fd_, slot->data, sizeof(slot->data));
+      if (r < 0) {
+        int err = errno;
+        if (err == EINTR) {
+          continue;
+        }
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+          return true;
+        }
+        r = -err;
+      }
+
+      slot->time_ns = monotonic_ns();
+      slot->result = r;
+      slot->dropped = dropped_;
+      dropped_ = 0;
+      ring_.publish();
+
+      if (r <= 0) {
+        return false;
+      }
+    }
+  }
+
+  void deliver() override {
+    auto &state = AelkeyState::instance();
+
+    size_t n = ring_.readable();
+    for (size_t i = 0; i < n; ++i) {
+      HidrawReportSlot &slot = ring_.at(i);
+      views_[i] = HidrawReportView{ slot.data, slot.result, slot.time_ns, slot.dropped };
+    }
+
+    auto it = state.input_map.find(id_);
+    if (it != state.input_map.end()) {
+      DispatcherHidraw::instance().deliver_reports(it->second, views_.data(), n);
+    }
+    ring_.pop(n);
+  }
+
+ private:
+  SpscRing<HidrawReportSlot> ring_;
+  std::vector<HidrawReportView> views_;
+
+  // I/O thread only
+  uint32_t dropped_ = 0;
+};
+
+}  // namespace
+
+bool IoPool::start(int threads) {
+  if (running() || threads <= 0) {
+    return running();
+  }
+
+  notify_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (notify_fd_ < 0) {
+    perror("eventfd io_pool");
+    return false;
+  }
+  register_fd(notify_fd_, EPOLLIN);
+
+  for (int i = 0; i < threads; ++i) {
+    auto worker = std::make_unique<Worker>();
+
+    worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+    worker->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (worker->epfd < 0 || worker->stop_fd < 0) {
+      perror("io_pool worker");
+      if (worker->epfd >= 0) {
+        close(worker->epfd);
+      }
+      if (worker->stop_fd >= 0) {
+        close(worker->stop_fd);
+      }
+      break;
+    }
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = STOP_TOKEN;
+    epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->stop_fd, &ev);
+
+    Worker *w = worker.get();
+    worker->thread = std::thread([this, w] { run_worker(*w); });
+    workers_.push_back(std::move(worker));
+  }
+
+  if (workers_.empty()) {
+    unregister_fd(notify_fd_);
+    close(notify_fd_);
+    notify_fd_ = -1;
+    return false;
+  }
+
+  return true;
+}
+
+void IoPool::stop() {
+  if (usb_thread_.joinable()) {
+    usb_stop_ = true;
+    libusb_interrupt_event_handler(usb_ctx_);
+    usb_thread_.join();
+  }
+  usb_ctx_ = nullptr;
+  usb_ring_.reset();
+
+  for (auto &worker : workers_) {
+    uint64_t one = 1;
+    if (write(worker->stop_fd, &one, sizeof(one)) < 0) {
+      perror("write io_pool stop");
+    }
+    worker->thread.join();
+    close(worker->stop_fd);
+    close(worker->epfd);
+  }
+  workers_.clear();
+
+  fd_tokens_.clear();
+  sources_.clear();
+  deliver_list_.clear();
+
+  if (notify_fd_ >= 0) {
+    cleanup_fds();
+    close(notify_fd_);
+    notify_fd_ = -1;
+  }
+}
+
+bool IoPool::add_evdev(const std::string &id, int fd) {
+  return add_source(std::make_shared<EvdevIoSource>(id, fd));
+}
+
+bool IoPool::add_hidraw(const std::string &id, int fd) {
+  return add_source(std::make_shared<HidrawIoSource>(id, fd));
+}
+
+bool IoPool::add_source(std::shared_ptr<IoSource> source) {
+  if (!running()) {
+    return false;
+  }
+
+  Worker *worker = workers_[next_worker_++ % workers_.size()].get();
+  uint64_t token = next_token_++;
+  int fd = source->fd();
+
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->sources[token] = source;
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLHUP | EPOLLERR;
+    ev.data.u64 = token;
+    if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      perror("epoll_ctl io_pool ADD");
+      worker->sources.erase(token);
+      return false;
+    }
+  }
+
+  fd_tokens_[fd] = { worker, token };
+  sources_[fd] = std::move(source);
+  return true;
+}
+
+void IoPool::remove(int fd) {
+  auto it = fd_tokens_.find(fd);
+  if (it == fd_tokens_.end()) {
+    return;
+  }
+
+  auto [worker, token] = it->second;
+  {
+    // after this, the worker can no longer be inside the source
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    epoll_ctl(worker->epfd, EPOLL_CTL_DEL, fd, nullptr);
+    worker->sources.erase(token);
+  }
+
+  fd_tokens_.erase(it);
+  sources_.erase(fd);
+}
+
+void IoPool::run_worker(Worker &worker) {
+  constexpr int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+
+  worker_thread_defaults();
+
+  while (true) {
+    int n = epoll_wait(worker.epfd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait io_pool");
+      return;
+    }
+
+    bool stop = false;
+    bool published = false;
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      for (int i = 0; i < n; ++i) {
+        uint64_t token = events[i].data.u64;
+        if (token == STOP_TOKEN) {
+          stop = true;
+          continue;
+        }
+
+        auto it = worker.sources.find(token);
+        if (it == worker.sources.end()) {
+          continue;  // removed after epoll_wait returned
+        }
+
+        published = true;
+        TRACE_SCOPE(TraceCategory::Io, "read", it->second->id());
+        if (!it->second->read_available(events[i].events)) {
+          epoll_ctl(worker.epfd, EPOLL_CTL_DEL, it->second->fd(), nullptr);
+        }
+      }
+    }
+
+    if (published) {
+      notify();
+    }
+    if (stop) {
+      return;
+    }
+  }
+}
+
+void IoPool::notify() {
+  uint64_t one = 1;
+  if (write(notify_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("write io_pool notify");
+  }
+}
+
+void IoPool::handle_event(EpollPayload *payload, uint32_t events) {
+  if (!(events & EPOLLIN)) {
+    return;
+  }
+
+  uint64_t count;
+  if (read(notify_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    perror("read io_pool notify");
+  }
+
+  if (usb_ring_) {
+    deliver_transfers();
+  }
+
+  // callbacks may open or close devices, so work on a snapshot
+  deliver_list_.clear();
+  for (auto &[fd, source] : sources_) {
+    deliver_list_.push_back(source);
+  }
+
+  for (auto &source : deliver_list_) {
+    source->deliver();
+  }
+  deliver_list_.clear();
+}
+
+bool IoPool::start_libusb(libusb_context *ctx) {
+  if (usb_ctx_) {
+    return true;
+  }
+  if (!running() || !ctx) {
+    return false;
+  }
+
+  usb_ring_ = std::make_unique<SpscRing<UsbTransferSlot>>(256);
+  usb_ctx_ = ctx;
+  usb_stop_ = false;
+  usb_thread_ = std::thread([this] { run_libusb(); });
+  return true;
+}
+
+void IoPool::run_libusb() {
+  worker_thread_defaults();
+  while (!usb_stop_.load(std::memory_order_relaxed)) {
+    timeval tv{ 0, 100000 };
+    libusb_handle_events_timeout_completed(usb_ctx_, &tv, nullptr);
+  }
+}
+
+void IoPool::queue_transfer(libusb_transfer *transfer) {
+  bool transient = transfer->status == LIBUSB_TRANSFER_COMPLETED ||
+                   transfer->status == LIBUSB_TRANSFER_OVERFLOW ||
+                   transfer->status == LIBUSB_TRANSFER_TIMED_OUT;
+
+  UsbTransferSlot *slot = usb_ring_->claim();
+  if (!slot) {
+    // the data is lost; the transfer is queued again, or still has to be
+    // finished (released, detached, freed) on the loop thread
+    usb_overruns_.fetch_add(1, std::memory_order_relaxed);
+    if (transient && usb_resubmit_transfer(transfer)) {
+      return;
+    }
+    {
+      std::lock_guard lock(usb_unfinished_mutex_);
+      usb_unfinished_.emplace_back(transfer, transfer->status);
+    }
+    notify();
+    return;
+  }
+
+  slot->time_ns = monotonic_ns();
+  slot->transfer = transfer;
+  slot->status = transfer->status;
+  usb_copy_transfer(transfer, slot->data, slot->packets);
+
+  // the data is copied, so the endpoint can be re-armed before Lua runs
+  slot->resubmitted = transient && usb_resubmit_transfer(transfer);
+
+  usb_ring_->publish();
+  notify();
+}
+
+void IoPool::deliver_transfers() {
+  size_t n = usb_ring_->readable();
+  for (size_t i = 0; i < n; ++i) {
+    UsbTransferSlot &slot = usb_ring_->at(i);
+    usb_deliver_transfer(
+        slot.transfer,
+        slot.data.data(),
+        static_cast<int>(slot.data.size()),
+        slot.status,
+        slot.packets
+    );
+    if (!slot.resubmitted) {
+      usb_finish_transfer(slot.transfer, slot.status);
+    }
+  }
+  usb_ring_->pop(n);
+
+  std::vector<std::pair<libusb_transfer *, libusb_transfer_status>> unfinished;
+  {
+    std::lock_guard lock(usb_unfinished_mutex_);
+    unfinished.swap(usb_unfinished_);
+  }
+  for (auto [transfer, status] : unfinished) {
+    usb_finish_transfer(transfer, status);
+  }
+}
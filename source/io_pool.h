@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libusb-1.0/libusb.h>
+#include <linux/input.h>
+
+#include "dispatcher.h"
+#include "hidraw_reader.h"
+#include "util/spsc_ring.h"
+
+// Events in one evdev frame slot; longer frames are split.
+static constexpr size_t IO_FRAME_MAX_EVENTS = 128;
+
+struct EvdevFrameSlot {
+  uint64_t time_ns = 0;  // monotonic read time
+  uint16_t count = 0;
+  uint32_t dropped = 0;  // frames lost (SYN_DROPPED or a full ring) before this one
+  bool hangup = false;   // device is gone, no events
+  struct input_event events[IO_FRAME_MAX_EVENTS];
+};
+
+struct UsbTransferSlot {
+  uint64_t time_ns = 0;
+  libusb_transfer *transfer = nullptr;
+  libusb_transfer_status status = LIBUSB_TRANSFER_COMPLETED;
+  bool resubmitted = false;
+  std::vector<uint8_t> data;  // capacity is reused between transfers
+  std::vector<libusb_iso_packet_descriptor> packets;  // isochronous transfers
+};
+
+// A device fd served by an I/O thread.
+//
+// read_available() runs on the I/O thread: it reads, timestamps, and
+// splits the input into records, and publishes them into a ring.
+// deliver() runs on the loop thread and hands the records to Lua.
+class IoSource {
+ public:
+  IoSource(std::string id, int fd) : id_(std::move(id)), fd_(fd) {}
+  virtual ~IoSource() = default;
+
+  // Returns false once the fd is finished (hangup or fatal error).
+  virtual bool read_available(uint32_t events) = 0;
+  virtual void deliver() = 0;
+
+  const std::string &id() const {
+    return id_;
+  }
+
+  int fd() const {
+    return fd_;
+  }
+
+ protected:
+  std::string id_;
+  int fd_ = -1;
+};
+
+class IoPool : public Dispatcher<IoPool> {
+  friend class Singleton<IoPool>;
+  friend class Dispatcher<IoPool>;
+
+ protected:
+  IoPool() = default;
+  ~IoPool() {
+    stop();
+  }
+
+ public:
+  const char *type() const override {
+    return "io_pool";
+  }
+
+  bool input_source() const override {
+    return true;
+  }
+
+  // Start `threads` I/O threads. Devices opened afterwards are read on
+  // them instead of on the loop thread.
+  bool start(int threads);
+  void stop();
+
+  bool running() const {
+    return !workers_.empty();
+  }
+
+  bool add_evdev(const std::string &id, int fd);
+  bool add_hidraw(const std::string &id, int fd);
+  void remove(int fd);
+
+  // libusb: event handling moves to a dedicated thread
+  bool start_libusb(libusb_context *ctx);
+  bool handles_libusb() const {
+    return usb_ctx_ != nullptr;
+  }
+
+  // Called from the libusb event thread for every completed transfer.
+  void queue_transfer(libusb_transfer *transfer);
+
+  // Completed transfers whose data was lost to a full ring
+  uint64_t usb_overruns() const {
+    return usb_overruns_.load(std::memory_order_relaxed);
+  }
+
+  // Loop thread: records were published
+  void handle_event(EpollPayload *payload, uint32_t events) override;
+
+  // I/O threads: wake the loop thread
+  void notify();
+
+ private:
+  struct Worker {
+    int epfd = -1;
+    int stop_fd = -1;
+    std::thread thread;
+    std::mutex mutex;  // guards sources while a batch is processed
+    std::map<uint64_t, std::shared_ptr<IoSource>> sources;
+  };
+
+  bool add_source(std::shared_ptr<IoSource> source);
+  void run_worker(Worker &worker);
+  void run_libusb();
+  void deliver_transfers();
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  int notify_fd_ = -1;
+  uint64_t next_token_ = 1;
+  size_t next_worker_ = 0;
+
+  // fd → (worker, token), loop thread only
+  std::map<int, std::pair<Worker *, uint64_t>> fd_tokens_;
+  std::map<int, std::shared_ptr<IoSource>> sources_;
+  std::vector<std::shared_ptr<IoSource>> deliver_list_;
+
+  // libusb event thread
+  libusb_context *usb_ctx_ = nullptr;
+  std::thread usb_thread_;
+  std::atomic<bool> usb_stop_{ false };
+  std::unique_ptr<SpscRing<UsbTransferSlot>> usb_ring_;
+  std::atomic<uint64_t> usb_overruns_{ 0 };
+
+  // transfers that found the ring full and were not queued again; the
+  // loop thread finishes them without delivering
+  std::mutex usb_unfinished_mutex_;
+  std::vector<std::pair<libusb_transfer *, libusb_transfer_status>> usb_unfinished_;
+};
+
+template class Dispatcher<IoPool>;
@@ -0,0 +1,74 @@
+#include "latency_stats.h"
+
+#include <cstdio>
+
+#include <sys/time.h>
+
+#include "util/clock.h"
+
+void LatencyStats::begin(const std::string &device, uint64_t event_ns) {
+  uint64_t now = monotonic_ns();
+
+  current_ = &devices_[device];
+  current_event_ns_ = event_ns;
+  current_start_ns_ = now;
+  output_seen_ = false;
+
+  if (event_ns != 0 && event_ns <= now) {
+    current_->queue.record(now - event_ns);
+  }
+}
+
+void LatencyStats::end() {
+  if (!current_) {
+    return;
+  }
+
+  current_->callback.record(monotonic_ns() - current_start_ns_);
+  current_ = nullptr;
+}
+
+void LatencyStats::output_written() {
+  if (!current_ || output_seen_ || current_event_ns_ == 0) {
+    return;
+  }
+
+  uint64_t now = monotonic_ns();
+  if (current_event_ns_ <= now) {
+    current_->output.record(now - current_event_ns_);
+  }
+  output_seen_ = true;
+}
+
+void LatencyStats::dump() const {
+  auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+
+  for (const auto &[device, lat] : devices_) {
+    std::printf(
+        "latency %s: n=%llu queue p50=%.0fus p99=%.0fus | callback p50=%.0fus p99=%.0fus "
+        "| output p50=%.0fus p99=%.0fus max=%.0fus\n",
+        device.c_str(),
+        static_cast<unsigned long long>(lat.callback.count()),
+        us(lat.queue.percentile(50)),
+        us(lat.queue.percentile(99)),
+        us(lat.callback.percentile(50)),
+        us(lat.callback.percentile(99)),
+        us(lat.output.percentile(50)),
+        us(lat.output.percentile(99)),
+        us(lat.output.max())
+    );
+  }
+  std::fflush(stdout);
+}
+
+uint64_t evdev_time_to_monotonic_ns(const struct timeval &tv) {
+  uint64_t event_ns = static_cast<uint64_t>(tv.tv_sec) * 1000000000ULL +
+                      static_cast<uint64_t>(tv.tv_usec) * 1000ULL;
+
+  uint64_t real = clock_ns(CLOCK_REALTIME);
+  uint64_t mono = monotonic_ns();
+  if (event_ns > real || real - event_ns > mono) {
+    return 0;  // not a realtime stamp we can place
+  }
+  return mono - (real - event_ns);
+}
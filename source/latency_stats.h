@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include <sys/time.h>
+
+#include "singleton.h"
+#include "util/latency_histogram.h"
+
+// Per-device latency of the input → Lua → uinput path, in nanoseconds.
+struct DeviceLatency {
+  LatencyHistogram queue;     // event timestamp → callback start
+  LatencyHistogram callback;  // callback start → callback end
+  LatencyHistogram output;    // event timestamp → first uinput SYN_REPORT
+};
+
+// Collects DeviceLatency while aelkey.start{ latency = true } is active.
+//
+// Input dispatchers wrap each Lua callback in a LatencyScope carrying the
+// event timestamp (CLOCK_MONOTONIC); the uinput write path calls
+// output_written(). Everything runs on the loop thread.
+class LatencyStats : public Singleton<LatencyStats> {
+  friend class Singleton<LatencyStats>;
+
+ protected:
+  LatencyStats() = default;
+  ~LatencyStats() = default;
+
+ public:
+  void set_enabled(bool enabled) {
+    enabled_ = enabled;
+  }
+
+  bool enabled() const {
+    return enabled_;
+  }
+
+  void begin(const std::string &device, uint64_t event_ns);
+  void end();
+
+  // uinput SYN_REPORT written
+  void output_written();
+
+  const DeviceLatency *find(const std::string &device) const {
+    auto it = devices_.find(device);
+    return it != devices_.end() ? &it->second : nullptr;
+  }
+
+  const std::map<std::string, DeviceLatency> &devices() const {
+    return devices_;
+  }
+
+  // Clears the histograms in place; safe inside a callback
+  void reset() {
+    for (auto &[device, lat] : devices_) {
+      lat = DeviceLatency{};
+    }
+  }
+
+  // Print a one-line summary per device to stdout
+  void dump() const;
+
+ private:
+  bool enabled_ = false;
+
+  // callback in progress (callbacks do not nest across devices)
+  DeviceLatency *current_ = nullptr;
+  uint64_t current_event_ns_ = 0;
+  uint64_t current_start_ns_ = 0;
+  bool output_seen_ = false;
+
+  std::map<std::string, DeviceLatency> devices_;
+};
+
+// Times one Lua callback for LatencyStats; no-op when disabled.
+class LatencyScope {
+ public:
+  LatencyScope(const std::string &device, uint64_t event_ns) {
+    auto &stats = LatencyStats::instance();
+    if (stats.enabled()) {
+      active_ = true;
+      stats.begin(device, event_ns);
+    }
+  }
+
+  ~LatencyScope() {
+    if (active_) {
+      LatencyStats::instance().end();
+    }
+  }
+
+  LatencyScope(const LatencyScope &) = delete;
+  LatencyScope &operator=(const LatencyScope &) = delete;
+
+ private:
+  bool active_ = false;
+};
+
+// Convert an evdev timestamp (CLOCK_REALTIME unless changed with
+// EVIOCSCLOCKID) to CLOCK_MONOTONIC.
+uint64_t evdev_time_to_monotonic_ns(const struct timeval &tv);
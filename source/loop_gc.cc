@@ -0,0 +1,144 @@
+#include "loop_gc.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "aelkey_state.h"
+#include "trace.h"
+#include "util/clock.h"
+
+namespace {
+
+// Forced steps start once the heap doubles, and at least this much
+constexpr int MIN_GROWTH_KB = 1024;
+
+void set_mode(lua_State *L, const GcOptions &options, bool generational) {
+#if LUA_VERSION_NUM >= 505
+  lua_gc(L, generational ? LUA_GCGEN : LUA_GCINC);
+  if (options.pause > 0) {
+    lua_gc(L, LUA_GCPARAM, LUA_GCPPAUSE, options.pause);
+  }
+  if (options.stepmul > 0) {
+    lua_gc(L, LUA_GCPARAM, LUA_GCPSTEPMUL, options.stepmul);
+  }
+#elif LUA_VERSION_NUM == 504
+  if (generational) {
+    lua_gc(L, LUA_GCGEN, 0, 0);
+  } else {
+    // 0 keeps the current value
+    lua_gc(L, LUA_GCINC, options.pause, options.stepmul, 0);
+  }
+#else
+  if (generational) {
+    std::cerr << "aelkey gc: generational mode needs Lua 5.4, using incremental" << std::endl;
+  }
+  if (options.pause > 0) {
+    lua_gc(L, LUA_GCSETPAUSE, options.pause);
+  }
+  if (options.stepmul > 0) {
+    lua_gc(L, LUA_GCSETSTEPMUL, options.stepmul);
+  }
+#endif
+}
+
+}  // namespace
+
+void LoopGc::apply(const GcOptions &options, lua_State *L) {
+  if (!options.enabled || !L) {
+    return;
+  }
+
+  L_ = L;
+  options_ = options;
+
+  generational_ = options.mode == "generational";
+  if (!options.mode.empty() && !generational_ && options.mode != "incremental") {
+    std::cerr << "aelkey gc: unknown mode '" << options.mode << "', using incremental"
+              << std::endl;
+  }
+#if LUA_VERSION_NUM < 504
+  generational_ = false;
+#endif
+
+  if (!options.mode.empty() || options.pause > 0 || options.stepmul > 0) {
+    set_mode(L_, options_, generational_);
+  }
+
+  if (!options.automatic) {
+    lua_gc(L_, LUA_GCSTOP, 0);
+    stopped_ = true;
+  }
+
+  update_limit();
+}
+
+void LoopGc::restore() {
+  if (!L_) {
+    return;
+  }
+
+  if (stopped_) {
+    lua_gc(L_, LUA_GCRESTART, 0);
+    stopped_ = false;
+  }
+  L_ = nullptr;
+}
+
+void LoopGc::idle(const std::function<bool()> &pending) {
+  if (!L_ || idle_done_) {
+    return;
+  }
+
+  uint64_t deadline = monotonic_ns() + static_cast<uint64_t>(options_.idle_budget_us) * 1000ULL;
+  auto &stats = AelkeyState::instance().loop_stats.gc;
+
+  do {
+    ++stats.idle_steps;
+    if (step()) {
+      idle_done_ = true;
+      return;
+    }
+  } while (monotonic_ns() < deadline && !pending());
+}
+
+void LoopGc::activity() {
+  if (!L_) {
+    return;
+  }
+
+  idle_done_ = false;
+
+  if (stopped_ && heap_kb() > limit_kb_) {
+    ++AelkeyState::instance().loop_stats.gc.forced_steps;
+    step();
+  }
+}
+
+bool LoopGc::step() {
+  auto &stats = AelkeyState::instance().loop_stats.gc;
+  TRACE_SCOPE(TraceCategory::Loop, "gc", "");
+
+  uint64_t t0 = monotonic_ns();
+  int finished = lua_gc(L_, LUA_GCSTEP, options_.step_kb);
+  uint64_t elapsed = monotonic_ns() - t0;
+
+  stats.total_ns += elapsed;
+  stats.pause.record(elapsed);
+
+  // In generational mode each step is a whole minor collection
+  if (finished || generational_) {
+    ++stats.cycles;
+    update_limit();
+    return true;
+  }
+  return false;
+}
+
+int LoopGc::heap_kb() const {
+  return lua_gc(L_, LUA_GCCOUNT, 0);
+}
+
+void LoopGc::update_limit() {
+  int kb = heap_kb();
+  limit_kb_ = std::max(kb * 2, kb + MIN_GROWTH_KB);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include <lua.hpp>
+
+#include "loop_options.h"
+
+// Runs the Lua collector in the loop's idle time.
+//
+// Before the loop blocks for events, idle() performs collector steps
+// until the current cycle finishes, input is pending, or the idle budget
+// is spent. With automatic collection stopped, garbage left over from a
+// burst of events is collected in the next idle period; activity() only
+// steps when the heap has doubled since the last finished cycle.
+//
+// Step durations go to AelkeyState::loop_stats.gc.
+class LoopGc {
+ public:
+  LoopGc() = default;
+  ~LoopGc() {
+    restore();
+  }
+
+  LoopGc(const LoopGc &) = delete;
+  LoopGc &operator=(const LoopGc &) = delete;
+
+  void apply(const GcOptions &options, lua_State *L);
+
+  // Restarts the automatic collector if it was stopped. The mode and
+  // parameters are left as configured.
+  void restore();
+
+  bool active() const {
+    return L_ != nullptr;
+  }
+
+  // The loop is about to block; pending() returns true once input arrives
+  void idle(const std::function<bool()> &pending);
+
+  // Events were dispatched
+  void activity();
+
+ private:
+  // One collector step; returns true when a cycle finished
+  bool step();
+  int heap_kb() const;
+  void update_limit();
+
+  lua_State *L_ = nullptr;
+  GcOptions options_;
+  bool generational_ = false;
+  bool stopped_ = false;
+
+  bool idle_done_ = false;  // cycle finished and no events since
+  int limit_kb_ = 0;        // forced step above this heap size
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// aelkey.start{ realtime = { ... } }
+struct RealtimeOptions {
+  bool enabled = false;
+
+  // SCHED_FIFO priority for the loop thread; 0 keeps the current policy.
+  int priority = 0;
+
+  // Pin the loop thread to this CPU; -1 leaves affinity alone.
+  int cpu = -1;
+
+  // mlockall() pages once touched, and pre-fault the heap and stack.
+  bool lock_memory = false;
+};
+
+// aelkey.start{ gc = { ... } }
+struct GcOptions {
+  bool enabled = false;
+
+  // "incremental" or "generational" (Lua 5.4+); empty keeps the current mode
+  std::string mode;
+
+  // Work per idle step in KB, as for collectgarbage("step", n)
+  int step_kb = 0;
+
+  // Collector pause and step multiplier (percent); 0 keeps the current value
+  int pause = 0;
+  int stepmul = 0;
+
+  // Longest time spent collecting before the loop blocks (microseconds)
+  int idle_budget_us = 1000;
+
+  // false: stop the automatic collector. The loop then collects while
+  // idle, and between events only once the heap has doubled.
+  bool automatic = true;
+};
+
+// Options accepted by aelkey.start{ ... }
+struct LoopOptions {
+  // Number of I/O threads reading evdev, hidraw, and libusb devices.
+  // 0 reads every device on the loop thread.
+  int io_threads = 0;
+
+  // Wait on io_uring instead of epoll_wait() when the kernel allows it.
+  bool io_uring = false;
+
+  // After events, poll without blocking for this many ms before
+  // blocking again. 0 always blocks.
+  int busy_poll_ms = 0;
+
+  // Record per-device latency histograms (aelkey.stats.latency), and
+  // print them every latency_dump seconds if > 0.
+  bool latency = false;
+  int latency_dump = 0;
+
+  // Log Lua callbacks that run longer than this (microseconds); 0: off
+  int callback_budget_us = 0;
+
+  // Record a trace ring of this many events; SIGUSR2 or
+  // aelkey.stats.trace_dump() writes it to trace_file.
+  bool trace = false;
+  size_t trace_capacity = 64 * 1024;
+  std::string trace_file;
+
+  // Serve counters and commands on this Unix socket path; empty: off
+  std::string control_socket;
+
+  // Append everything delivered to Lua to this input log
+  std::string record;
+
+  // Feed this input log to Lua instead of opening input devices.
+  // replay_speed scales the recorded timing, 0 is as fast as possible;
+  // replay_stop ends the loop when the log is finished.
+  std::string replay;
+  double replay_speed = 1.0;
+  bool replay_stop = true;
+
+  // "pool": serve small Lua allocations from LuaPool (not with LuaJIT)
+  std::string allocator;
+
+  RealtimeOptions realtime;
+  GcOptions gc;
+};
@@ -0,0 +1,197 @@
+#include "loop_realtime.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "util/worker_thread.h"
+
+namespace {
+
+// Heap and stack touched up front so callbacks never page-fault
+constexpr size_t PREFAULT_HEAP_BYTES = 8 * 1024 * 1024;
+constexpr size_t PREFAULT_STACK_BYTES = 256 * 1024;
+
+// glibc defaults, used when neither the environment nor GLIBC_TUNABLES
+// set a value
+constexpr int DEFAULT_TRIM_THRESHOLD = 128 * 1024;
+constexpr int DEFAULT_MMAP_MAX = 65536;
+
+std::string status(int err) {
+  return err == 0 ? "ok" : std::string("failed (") + std::strerror(err) + ")";
+}
+
+// mallopt() has no getter. The only other sources of a setting are the
+// MALLOC_*_ variable and the glibc.malloc tunable read at startup, so the
+// value in effect is taken from those, falling back to the default.
+int malloc_setting(const char *env, std::string_view tunable, int fallback) {
+  if (const char *value = std::getenv(env); value && *value) {
+    return std::atoi(value);
+  }
+
+  if (const char *tunables = std::getenv("GLIBC_TUNABLES")) {
+    std::string_view rest(tunables);
+    while (!rest.empty()) {
+      size_t end = rest.find(':');
+      std::string_view item = rest.substr(0, end);
+      if (item.size() > tunable.size() && item.starts_with(tunable) &&
+          item[tunable.size()] == '=') {
+        return std::atoi(std::string(item.substr(tunable.size() + 1)).c_str());
+      }
+      rest = (end == std::string_view::npos) ? std::string_view() : rest.substr(end + 1);
+    }
+  }
+
+  return fallback;
+}
+
+void prefault_stack() {
+  volatile unsigned char stack[PREFAULT_STACK_BYTES];
+  for (size_t i = 0; i < sizeof(stack); i += 4096) {
+    stack[i] = 0;
+  }
+}
+
+}  // namespace
+
+void LoopRealtime::apply(const RealtimeOptions &options, lua_State *L) {
+  if (!options.enabled) {
+    return;
+  }
+
+  if (options.priority > 0) {
+    set_priority(options.priority);
+  }
+  if (options.cpu >= 0) {
+    pin_cpu(options.cpu);
+  }
+  if (options.lock_memory) {
+    lock_memory(L);
+  }
+
+  for (const auto &line : report_) {
+    std::cout << "aelkey realtime: " << line << std::endl;
+  }
+}
+
+void LoopRealtime::set_priority(int priority) {
+  pthread_t self = pthread_self();
+  pthread_getschedparam(self, &old_policy_, &old_param_);
+
+  int lo = sched_get_priority_min(SCHED_FIFO);
+  int hi = sched_get_priority_max(SCHED_FIFO);
+  priority = std::max(lo, std::min(hi, priority));
+
+  struct sched_param param{};
+  param.sched_priority = priority;
+
+  int err = pthread_setschedparam(self, SCHED_FIFO, &param);
+  policy_changed_ = (err == 0);
+  if (policy_changed_) {
+    set_worker_policy(&old_policy_, &old_param_);
+  }
+  report_.push_back("SCHED_FIFO " + std::to_string(priority) + ": " + status(err));
+}
+
+void LoopRealtime::pin_cpu(int cpu) {
+  pthread_t self = pthread_self();
+  CPU_ZERO(&old_affinity_);
+  pthread_getaffinity_np(self, sizeof(old_affinity_), &old_affinity_);
+
+  int err = EINVAL;
+  if (cpu < CPU_SETSIZE) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    err = pthread_setaffinity_np(self, sizeof(set), &set);
+  }
+
+  affinity_changed_ = (err == 0);
+  if (affinity_changed_) {
+    set_worker_affinity(&old_affinity_);
+  }
+  report_.push_back("cpu " + std::to_string(cpu) + ": " + status(err));
+}
+
+void LoopRealtime::lock_memory(lua_State *L) {
+  // compact the Lua heap before locking it
+  if (L) {
+    lua_gc(L, LUA_GCCOLLECT, 0);
+  }
+
+  // keep freed memory in the process instead of returning it to the
+  // kernel, so it does not fault again on the next allocation
+  old_trim_threshold_ = malloc_setting(
+      "MALLOC_TRIM_THRESHOLD_", "glibc.malloc.trim_threshold", DEFAULT_TRIM_THRESHOLD
+  );
+  old_mmap_max_ = malloc_setting("MALLOC_MMAP_MAX_", "glibc.malloc.mmap_max", DEFAULT_MMAP_MAX);
+  trim_tuned_ = (old_trim_threshold_ != -1) && mallopt(M_TRIM_THRESHOLD, -1) == 1;
+  mmap_tuned_ = (old_mmap_max_ != 0) && mallopt(M_MMAP_MAX, 0) == 1;
+
+  // MCL_ONFAULT: lock pages as they are touched. Reserved but unused
+  // address space (the Lua pool region) would otherwise be faulted in
+  // and committed all at once.
+  int err = 0;
+  if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) < 0) {
+    err = errno;
+  }
+  memory_locked_ = (err == 0);
+  report_.push_back("mlockall: " + status(err));
+
+  if (!memory_locked_) {
+    return;
+  }
+
+  // pre-fault a heap reserve and the stack, which are sure to be used
+  auto *reserve = static_cast<unsigned char *>(std::malloc(PREFAULT_HEAP_BYTES));
+  if (reserve) {
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < PREFAULT_HEAP_BYTES; i += static_cast<size_t>(page)) {
+      reserve[i] = 0;
+    }
+    std::free(reserve);
+  }
+  prefault_stack();
+}
+
+void LoopRealtime::restore() {
+  pthread_t self = pthread_self();
+
+  if (policy_changed_) {
+    pthread_setschedparam(self, old_policy_, &old_param_);
+    set_worker_policy(nullptr, nullptr);
+    policy_changed_ = false;
+  }
+
+  if (affinity_changed_) {
+    pthread_setaffinity_np(self, sizeof(old_affinity_), &old_affinity_);
+    set_worker_affinity(nullptr);
+    affinity_changed_ = false;
+  }
+
+  // only what lock_memory() changed, back to the value it replaced
+  if (trim_tuned_) {
+    mallopt(M_TRIM_THRESHOLD, old_trim_threshold_);
+    trim_tuned_ = false;
+  }
+  if (mmap_tuned_) {
+    mallopt(M_MMAP_MAX, old_mmap_max_);
+    mmap_tuned_ = false;
+  }
+
+  if (memory_locked_) {
+    munlockall();
+    memory_locked_ = false;
+  }
+
+  report_.clear();
+}
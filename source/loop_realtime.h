@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <lua.hpp>
+#include <sched.h>
+
+#include "loop_options.h"
+
+// Applies RealtimeOptions to the calling (loop) thread and undoes them
+// when the loop ends. Every step is best effort: what could not be
+// applied is reported and the loop runs anyway. Threads started in the
+// meantime go back to the old policy and affinity through
+// worker_thread_defaults().
+class LoopRealtime {
+ public:
+  LoopRealtime() = default;
+  ~LoopRealtime() {
+    restore();
+  }
+
+  LoopRealtime(const LoopRealtime &) = delete;
+  LoopRealtime &operator=(const LoopRealtime &) = delete;
+
+  // L: Lua state whose heap is collected before memory is locked
+  void apply(const RealtimeOptions &options, lua_State *L);
+  void restore();
+
+ private:
+  void set_priority(int priority);
+  void pin_cpu(int cpu);
+  void lock_memory(lua_State *L);
+
+  std::vector<std::string> report_;  // one line per step, e.g. "SCHED_FIFO 50: ok"
+
+  bool policy_changed_ = false;
+  int old_policy_ = SCHED_OTHER;
+  struct sched_param old_param_{};
+
+  bool affinity_changed_ = false;
+  cpu_set_t old_affinity_;
+
+  bool memory_locked_ = false;
+
+  // malloc settings replaced by lock_memory()
+  bool trim_tuned_ = false;
+  int old_trim_threshold_ = 0;
+  bool mmap_tuned_ = false;
+  int old_mmap_max_ = 0;
+};
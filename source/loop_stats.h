@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "util/latency_histogram.h"
+
+// Counters for the adaptive busy-poll mode (aelkey.start{ busy_poll = ms })
+struct BusyPollStats {
+  uint64_t spin_polls = 0;      // zero-timeout epoll_wait() calls
+  uint64_t spin_hits = 0;       // ... that returned events
+  uint64_t spin_idle_ns = 0;    // time spent in zero-timeout calls that found nothing
+  uint64_t spin_cpu_ns = 0;     // loop thread CPU time used by those calls
+  uint64_t blocking_waits = 0;  // blocking epoll_wait() calls
+};
+
+// Lua collector steps run by the loop (aelkey.start{ gc = ... })
+struct GcStats {
+  uint64_t idle_steps = 0;    // before blocking for events
+  uint64_t forced_steps = 0;  // automatic collector stopped and heap over the limit
+  uint64_t cycles = 0;        // collection cycles finished by these steps
+  uint64_t total_ns = 0;
+  LatencyHistogram pause;  // duration of each step
+};
+
+// Per input device
+struct InputCounters {
+  uint64_t events = 0;   // evdev events, hidraw reports, USB transfers, GATT notifications
+  uint64_t dropped = 0;  // SYN_DROPPED frames and hidraw reports lost to a full ring
+};
+
+// Loop-wide statistics, read by aelkey.stats and the control socket
+struct LoopStats {
+  BusyPollStats busy_poll;
+  GcStats gc;
+
+  std::map<std::string, InputCounters> inputs;
+  std::map<std::string, uint64_t> outputs;  // uinput events written per device
+
+  void count_input(const std::string &id, uint64_t events, uint64_t dropped = 0) {
+    auto &c = inputs[id];
+    c.events += events;
+    c.dropped += dropped;
+  }
+
+  void count_output(const std::string &id) {
+    ++outputs[id];
+  }
+};
@@ -0,0 +1,220 @@
+#include "lua_pool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/mman.h>
+
+namespace {
+
+// 16-byte steps up to 128, then 32-byte steps up to 256
+constexpr size_t NUM_CLASSES = 12;
+
+size_t class_index(size_t size) {
+  return size <= 128 ? (size + 15) / 16 - 1 : (size - 128 + 31) / 32 + 7;
+}
+
+size_t class_size(size_t index) {
+  return index < 8 ? (index + 1) * 16 : 128 + (index - 7) * 32;
+}
+
+struct FreeSlot {
+  FreeSlot *next;
+};
+
+class PoolAllocator {
+ public:
+  PoolAllocator(lua_Alloc prev, void *prev_ud) : prev_(prev), prev_ud_(prev_ud) {}
+
+  bool reserve() {
+    // Pages are only backed once a chunk is used
+    void *mem = mmap(
+        nullptr,
+        LuaPool::kRegionBytes,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0
+    );
+    if (mem == MAP_FAILED) {
+      perror("lua pool: mmap");
+      return false;
+    }
+
+    base_ = static_cast<char *>(mem);
+    end_ = base_ + LuaPool::kRegionBytes;
+    next_chunk_ = base_;
+    return true;
+  }
+
+  void *realloc(void *ptr, size_t osize, size_t nsize) {
+    if (nsize == 0) {
+      if (ptr) {
+        release(ptr, osize);
+      }
+      return nullptr;
+    }
+
+    // ptr == nullptr: osize is the object type, not a size
+    if (!ptr) {
+      return allocate(nsize);
+    }
+
+    ++stats_.reallocs;
+    stats_.bytes_allocated += nsize;
+
+    bool mine = owns(ptr);
+    if (mine && nsize <= LuaPool::kMaxSmall && class_index(nsize) == class_index(osize)) {
+      return ptr;  // same slot size
+    }
+    if (!mine && nsize > LuaPool::kMaxSmall) {
+      return prev_(prev_ud_, ptr, osize, nsize);
+    }
+
+    // moves between the pool and the previous allocator, or between classes
+    void *block = allocate_block(nsize);
+    if (!block) {
+      return nullptr;  // Lua keeps the old block
+    }
+    std::memcpy(block, ptr, std::min(osize, nsize));
+    release_block(ptr, osize);
+    return block;
+  }
+
+  void end_frame() {
+    stats_.allocs_per_frame.record(stats_.allocs - frame_allocs_);
+    stats_.bytes_per_frame.record(stats_.bytes_allocated - frame_bytes_);
+    frame_allocs_ = stats_.allocs;
+    frame_bytes_ = stats_.bytes_allocated;
+  }
+
+  const LuaPoolStats &stats() const {
+    return stats_;
+  }
+
+ private:
+  bool owns(const void *p) const {
+    return p >= base_ && p < end_;
+  }
+
+  void *allocate(size_t size) {
+    ++stats_.allocs;
+    stats_.bytes_allocated += size;
+    return allocate_block(size);
+  }
+
+  void release(void *p, size_t size) {
+    ++stats_.frees;
+    release_block(p, size);
+  }
+
+  void *allocate_block(size_t size) {
+    if (size <= LuaPool::kMaxSmall) {
+      void *p = pool_alloc(class_index(size));
+      if (p) {
+        ++stats_.pool_allocs;
+        return p;
+      }
+    }
+    ++stats_.fallback_allocs;
+    return prev_(prev_ud_, nullptr, 0, size);
+  }
+
+  void release_block(void *p, size_t size) {
+    if (owns(p)) {
+      auto *slot = static_cast<FreeSlot *>(p);
+      size_t c = class_index(size);
+      slot->next = free_[c];
+      free_[c] = slot;
+    } else {
+      prev_(prev_ud_, p, size, 0);
+    }
+  }
+
+  void *pool_alloc(size_t c) {
+    if (FreeSlot *slot = free_[c]) {
+      free_[c] = slot->next;
+      return slot;
+    }
+
+    size_t size = class_size(c);
+    if (!bump_[c] || bump_[c] + size > bump_end_[c]) {
+      if (next_chunk_ + LuaPool::kChunkBytes > end_) {
+        return nullptr;  // region exhausted
+      }
+      bump_[c] = next_chunk_;
+      bump_end_[c] = next_chunk_ + LuaPool::kChunkBytes;
+      next_chunk_ += LuaPool::kChunkBytes;
+      stats_.pool_bytes += LuaPool::kChunkBytes;
+    }
+
+    void *p = bump_[c];
+    bump_[c] += size;
+    return p;
+  }
+
+  lua_Alloc prev_;
+  void *prev_ud_;
+
+  char *base_ = nullptr;
+  char *end_ = nullptr;
+  char *next_chunk_ = nullptr;
+
+  FreeSlot *free_[NUM_CLASSES] = {};
+  char *bump_[NUM_CLASSES] = {};
+  char *bump_end_[NUM_CLASSES] = {};
+
+  LuaPoolStats stats_;
+  uint64_t frame_allocs_ = 0;
+  uint64_t frame_bytes_ = 0;
+};
+
+// Never destroyed: the Lua state may be closed after static destructors run
+PoolAllocator *pool = nullptr;
+
+void *pool_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  return static_cast<PoolAllocator *>(ud)->realloc(ptr, osize, nsize);
+}
+
+}  // namespace
+
+bool LuaPool::install(lua_State *L) {
+#ifdef LUAJIT_VERSION
+  (void)L;
+  std::fprintf(stderr, "lua pool: not supported with LuaJIT\n");
+  return false;
+#else
+  if (pool) {
+    void *ud = nullptr;
+    return lua_getallocf(L, &ud) == pool_lua_alloc && ud == pool;
+  }
+
+  void *prev_ud = nullptr;
+  lua_Alloc prev = lua_getallocf(L, &prev_ud);
+
+  auto *allocator = new PoolAllocator(prev, prev_ud);
+  if (!allocator->reserve()) {
+    delete allocator;
+    return false;
+  }
+
+  pool = allocator;
+  lua_setallocf(L, pool_lua_alloc, pool);
+  return true;
+#endif
+}
+
+bool LuaPool::installed() {
+  return pool != nullptr;
+}
+
+const LuaPoolStats *LuaPool::stats() {
+  return pool ? &pool->stats() : nullptr;
+}
+
+void LuaPool::end_frame() {
+  if (pool) {
+    pool->end_frame();
+  }
+}
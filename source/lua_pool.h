@@ -0,0 +1,52 @@
+#pragma once
+
+// Size-class pool allocator for the Lua state.
+//
+// Small blocks (up to 256 bytes: strings, tables, closures, userdata
+// headers) come from per-class free lists carved out of 64 KB chunks in
+// one reserved address range; larger blocks go to the allocator the
+// state had before. Lua runs on the loop thread only, so nothing here
+// takes a lock.
+//
+// install() swaps the allocator of a live state: blocks allocated
+// earlier are recognised by address and freed through the previous
+// allocator. Once installed it stays for the lifetime of the process.
+
+#include <cstddef>
+#include <cstdint>
+
+#include <lua.hpp>
+
+#include "util/latency_histogram.h"
+
+struct LuaPoolStats {
+  uint64_t allocs = 0;     // new blocks
+  uint64_t frees = 0;      // blocks released
+  uint64_t reallocs = 0;   // resized blocks
+  uint64_t pool_allocs = 0;       // new blocks served from the pool
+  uint64_t fallback_allocs = 0;   // new blocks from the previous allocator
+  uint64_t bytes_allocated = 0;   // total requested by new blocks and resizes
+  uint64_t pool_bytes = 0;        // chunk memory handed to size classes
+
+  // Per loop wakeup that dispatched events (see LuaPool::end_frame)
+  LatencyHistogram allocs_per_frame;
+  LatencyHistogram bytes_per_frame;
+};
+
+class LuaPool {
+ public:
+  static constexpr size_t kMaxSmall = 256;
+  static constexpr size_t kChunkBytes = 64 * 1024;
+  static constexpr size_t kRegionBytes = size_t{ 256 } << 20;  // address space, not memory
+
+  // Returns false when the allocator cannot be used (LuaJIT, no address space)
+  static bool install(lua_State *L);
+
+  static bool installed();
+
+  // nullptr until installed
+  static const LuaPoolStats *stats();
+
+  // Record allocations since the previous call as one frame
+  static void end_frame();
+};
@@ -0,0 +1,267 @@
+#include "replay_driver.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <iostream>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "aelkey_state.h"
+#include "aelkey_usb.h"
+#include "device_backend_gatt.h"
+#include "device_declarations.h"
+#include "dispatcher_evdev.h"
+#include "dispatcher_hidraw.h"
+#include "dispatcher_udev.h"
+#include "util/clock.h"
+
+bool ReplayDriver::start(const std::string &path, double speed, bool stop_loop) {
+  if (running()) {
+    return true;
+  }
+
+  if (!reader_.open(path)) {
+    return false;
+  }
+
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    perror("replay: timerfd_create");
+    reader_.close();
+    return false;
+  }
+  register_fd(timer_fd_, EPOLLIN);
+
+  // Declared inputs stand in for the recorded devices
+  auto &state = AelkeyState::instance();
+  for (const auto &decl : state.input_decls) {
+    if (decl.id.empty() || state.input_map.contains(decl.id)) {
+      continue;
+    }
+    InputDecl replayed = decl;
+    replayed.fd = -1;
+    replayed.devnode = "replay:" + path;
+    state.input_map[decl.id] = replayed;
+    devices_.push_back(decl.id);
+  }
+
+  speed_ = speed > 0 ? speed : 0;
+  stop_loop_ = stop_loop;
+  start_ns_ = monotonic_ns();
+  delivered_ = 0;
+  time_shift_ns_ = static_cast<int64_t>(clock_ns(CLOCK_REALTIME) - reader_.start_realtime_ns());
+
+  has_next_ = reader_.next(next_);
+  if (!has_next_) {
+    std::fprintf(stderr, "replay: %s: no records\n", path.c_str());
+  }
+  arm(has_next_ ? due_ns(next_) : start_ns_);
+  return true;
+}
+
+void ReplayDriver::stop() {
+  if (!running()) {
+    return;
+  }
+
+  unregister_fd(timer_fd_);
+  close(timer_fd_);
+  timer_fd_ = -1;
+  reader_.close();
+  has_next_ = false;
+
+  auto &state = AelkeyState::instance();
+  for (const auto &id : devices_) {
+    auto it = state.input_map.find(id);
+    if (it != state.input_map.end() && it->second.type == "gatt") {
+      DeviceBackendGATT::instance().remove_routes(id);
+    }
+    state.input_map.erase(id);
+  }
+  devices_.clear();
+}
+
+void ReplayDriver::handle_event(EpollPayload *, uint32_t events) {
+  if (!(events & EPOLLIN)) {
+    return;
+  }
+
+  uint64_t expirations;
+  if (read(timer_fd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+    perror("replay: read timerfd");
+  }
+
+  uint64_t now = monotonic_ns();
+  size_t batch = 0;
+
+  while (has_next_) {
+    uint64_t due = due_ns(next_);
+    if (due > now) {
+      arm(due);
+      return;
+    }
+    if (batch == kMaxBatch) {
+      arm(now);  // let the rest of the loop run
+      return;
+    }
+
+    // the mapping outlives the entry; advance first so that a callback
+    // stopping the replay leaves nothing half-done
+    InputLogEntry entry = next_;
+    has_next_ = reader_.next(next_);
+
+    deliver(entry);
+    ++delivered_;
+    ++batch;
+
+    if (!running()) {
+      return;
+    }
+  }
+
+  finish();
+}
+
+uint64_t ReplayDriver::due_ns(const InputLogEntry &entry) const {
+  if (speed_ == 0) {
+    return 0;
+  }
+  return start_ns_ + static_cast<uint64_t>(static_cast<double>(entry.time_ns) / speed_);
+}
+
+void ReplayDriver::arm(uint64_t due_ns) {
+  // 0 disarms a timerfd; anything in the past fires immediately
+  struct itimerspec its{};
+  uint64_t ns = std::max<uint64_t>(due_ns, 1);
+  its.it_value.tv_sec = static_cast<time_t>(ns / 1000000000ULL);
+  its.it_value.tv_nsec = static_cast<long>(ns % 1000000000ULL);
+
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr) < 0) {
+    perror("replay: timerfd_settime");
+  }
+}
+
+void ReplayDriver::deliver(const InputLogEntry &entry) {
+  auto &state = AelkeyState::instance();
+  std::string id(entry.id);
+
+  switch (entry.kind) {
+    case InputLogKind::Evdev: {
+      size_t count = entry.size / sizeof(struct input_event);
+      events_.resize(count);
+      std::memcpy(events_.data(), entry.data, count * sizeof(struct input_event));
+
+      // recorded times, moved to when the replay started; at speed 1
+      // they line up with the replayed delivery
+      for (auto &ev : events_) {
+        int64_t ns = static_cast<int64_t>(ev.input_event_sec) * 1000000000LL +
+                     static_cast<int64_t>(ev.input_event_usec) * 1000LL + time_shift_ns_;
+        int64_t usec = ns / 1000LL % 1000000LL;
+        ev.input_event_sec = static_cast<decltype(ev.input_event_sec)>(ns / 1000000000LL);
+        ev.input_event_usec = static_cast<decltype(ev.input_event_usec)>(usec);
+      }
+
+      DispatcherEvdev::instance().deliver_frame(id, events_.data(), count);
+      break;
+    }
+
+    case InputLogKind::Hidraw: {
+      auto it = state.input_map.find(id);
+      if (it == state.input_map.end()) {
+        break;
+      }
+      HidrawReportView report{ entry.data, entry.status, monotonic_ns() };
+      DispatcherHidraw::instance().deliver_reports(it->second, &report, 1);
+      break;
+    }
+
+    case InputLogKind::Usb:
+      usb_deliver_data(
+          id,
+          static_cast<uint8_t>(entry.aux & 0xff),
+          static_cast<uint8_t>(entry.aux >> 8),
+          entry.data,
+          static_cast<int>(entry.size),
+          static_cast<libusb_transfer_status>(entry.status)
+      );
+      break;
+
+    case InputLogKind::Gatt:
+      route_gatt(id);
+      DeviceBackendGATT::instance().deliver_notification(id, entry.data, entry.size);
+      break;
+
+    case InputLogKind::State: {
+      // "<state>\0<on_state>"
+      std::string_view data(reinterpret_cast<const char *>(entry.data), entry.size);
+      size_t nul = data.find('\0');
+      std::string change(data.substr(0, nul));
+
+      auto it = state.input_map.find(id);
+      if (it != state.input_map.end()) {
+        DispatcherUdev::instance().notify_state_change(it->second, change.c_str());
+      } else if (nul != std::string_view::npos) {
+        InputDecl decl;
+        decl.id = id;
+        decl.on_state = std::string(data.substr(nul + 1));
+        DispatcherUdev::instance().notify_state_change(decl, change.c_str());
+      }
+      break;
+    }
+
+    default:
+      break;  // written by a newer version
+  }
+}
+
+void ReplayDriver::route_gatt(const std::string &char_path) {
+  auto &gatt = DeviceBackendGATT::instance();
+  if (gatt.has_route(char_path)) {
+    return;
+  }
+
+  // Nothing was subscribed; pick the replayed gatt input whose declared
+  // characteristic (or service) matches the recorded path, else the first
+  int handle = DeviceBackendGATT::characteristic_handle(char_path);
+  const InputDecl *pick = nullptr;
+  int pick_score = -1;
+
+  auto &state = AelkeyState::instance();
+  for (const auto &id : devices_) {
+    auto it = state.input_map.find(id);
+    if (it == state.input_map.end() || it->second.type != "gatt") {
+      continue;
+    }
+    const InputDecl &decl = it->second;
+
+    int score = 0;
+    if (decl.characteristic && decl.characteristic == handle) {
+      score = 2;
+    } else if (decl.service) {
+      std::string service = std::format("/service{:04x}/", decl.service);
+      score = char_path.find(service) != std::string::npos ? 1 : 0;
+    }
+    if (score > pick_score) {
+      pick = &decl;
+      pick_score = score;
+    }
+  }
+
+  if (pick) {
+    gatt.add_route(char_path, *pick);
+  }
+}
+
+void ReplayDriver::finish() {
+  double ms = static_cast<double>(monotonic_ns() - start_ns_) / 1e6;
+  std::cout << "aelkey replay: " << delivered_ << " records in " << ms << " ms" << std::endl;
+
+  if (stop_loop_) {
+    AelkeyState::instance().loop_should_stop = true;
+  }
+}
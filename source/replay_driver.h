@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <linux/input.h>
+
+#include "dispatcher.h"
+#include "input_log.h"
+#include "singleton.h"
+
+// Feeds an input log (see input_log.h) through the regular delivery
+// paths: evdev frames, hidraw reports, USB transfers, GATT notifications,
+// and device state changes reach Lua as if the devices were attached.
+//
+// The declared inputs are entered into input_map without opening any
+// hardware; outputs are created as usual. A timerfd paces the records at
+// the recorded rate, scaled by speed, or as fast as possible (speed 0)
+// in batches so that other fds are still served.
+class ReplayDriver : public Dispatcher<ReplayDriver> {
+  friend class Singleton<ReplayDriver>;
+  friend class Dispatcher<ReplayDriver>;
+
+ protected:
+  ReplayDriver() = default;
+  ~ReplayDriver() {
+    stop();
+  }
+
+ public:
+  const char *type() const override {
+    return "replay";
+  }
+
+  // stop_loop: aelkey.stop() once the log is finished
+  bool start(const std::string &path, double speed, bool stop_loop);
+
+  // Close the log and remove the replayed devices from input_map
+  void stop();
+
+  bool running() const {
+    return timer_fd_ >= 0;
+  }
+
+  void handle_event(EpollPayload *payload, uint32_t events) override;
+
+ private:
+  static constexpr size_t kMaxBatch = 256;
+
+  uint64_t due_ns(const InputLogEntry &entry) const;
+  void arm(uint64_t due_ns);
+  void deliver(const InputLogEntry &entry);
+  void route_gatt(const std::string &char_path);
+  void finish();
+
+  InputLogReader reader_;
+  InputLogEntry next_{};
+  bool has_next_ = false;
+
+  int timer_fd_ = -1;
+  double speed_ = 1.0;
+  bool stop_loop_ = true;
+
+  uint64_t start_ns_ = 0;
+  uint64_t delivered_ = 0;
+  int64_t time_shift_ns_ = 0;  // replay start - recording start, CLOCK_REALTIME
+
+  std::vector<std::string> devices_;       // entered into input_map
+  std::vector<struct input_event> events_;  // aligned copy of an evdev frame
+};
+
+template class Dispatcher<ReplayDriver>;
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 
 #include <sol/sol.hpp>
@@ -11,8 +12,11 @@
 #include <unistd.h>
 
 #include "aelkey_state.h"
+#include "callback_stats.h"
 #include "dispatcher.h"
 #include "dispatcher_registry.h"
+#include "trace.h"
+#include "uring_loop.h"
 
 struct TickCb {
   bool is_function = false;      // true if using a sol::function
@@ -54,32 +58,7 @@ class TickScheduler : public Dispatcher<TickScheduler> {
 
     auto cb = it->second;  // copy so we can erase safely after
 
-    if (cb.native) {
-      try {
-        cb.native();
-      } catch (const std::exception &e) {
-        fprintf(stderr, "tick native error: %s\n", e.what());
-      } catch (...) {
-        fprintf(stderr, "tick native error: unknown exception\n");
-      }
-    } else if (cb.is_function && cb.fn.valid()) {
-      sol::protected_function pf = cb.fn;
-      sol::protected_function_result result = pf();
-      if (!result.valid()) {
-        sol::error err = result;
-        fprintf(stderr, "tick function error: %s\n", err.what());
-      }
-    } else if (!cb.name.empty()) {
-      sol::state_view lua_state(AelkeyState::instance().lua_vm);
-      sol::object obj = lua_state[cb.name];
-      if (obj.is<sol::function>()) {
-        sol::protected_function pf = obj.as<sol::function>();
-        sol::protected_function_result result = pf();
-        if (!result.valid()) {
-          sol::error err = result;
-        }
-      }
-    }
+    run_callback(cb);
 
     if (cb.oneshot) {
       unregister_fd(fd);
@@ -89,8 +68,25 @@ class TickScheduler : public Dispatcher<TickScheduler> {
   // Schedule a timer with the given callback.
   // - ms: delay/interval in milliseconds
   // - cb: callback descriptor (Lua function, global name, or native)
-  // Returns timerfd on success, -1 on failure.
+  // Returns timerfd (0 for an io_uring timer) on success, -1 on failure.
   int schedule(int ms, TickCb cb) {
+    // io_uring loop: IORING_OP_TIMEOUT instead of a timerfd
+    auto &uring = UringLoop::instance();
+    if (uring.active()) {
+      auto id_slot = std::make_shared<uint64_t>(0);
+      uint64_t id = uring.add_timer(ms, cb.oneshot, [this, cb, id_slot]() {
+        if (cb.oneshot) {
+          uring_timers_.erase(*id_slot);
+        }
+        run_callback(cb);
+      });
+      if (id != 0) {
+        *id_slot = id;
+        uring_timers_[id] = UringTick{ ms, std::move(cb) };
+        return 0;
+      }
+    }
+
     int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
     if (fd < 0) {
       perror("timerfd_create");
@@ -121,16 +117,7 @@ class TickScheduler : public Dispatcher<TickScheduler> {
 
   void cancel_matching(const TickCb &key) {
     for (auto it = callbacks_.begin(); it != callbacks_.end();) {
-      auto &existing = it->second;
-      bool match = false;
-
-      if (key.is_function && existing.is_function) {
-        match = (existing.fn == key.fn);
-      } else if (!key.is_function && !existing.is_function) {
-        match = (existing.name == key.name);
-      }
-
-      if (match) {
+      if (same_callback(it->second, key)) {
         int fd = it->first;
         unregister_fd(fd);
         it = callbacks_.erase(it);
@@ -138,6 +125,19 @@ class TickScheduler : public Dispatcher<TickScheduler> {
         ++it;
       }
     }
+
+    for (auto it = uring_timers_.begin(); it != uring_timers_.end();) {
+      if (same_callback(it->second.cb, key)) {
+        UringLoop::instance().remove_timer(it->first);
+        it = uring_timers_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  size_t timer_count() const {
+    return callbacks_.size() + uring_timers_.size();
   }
 
   // Cancel any timers whose callback matches the provided key.
@@ -149,10 +149,77 @@ class TickScheduler : public Dispatcher<TickScheduler> {
       unregister_fd(fd);
     }
     callbacks_.clear();
+
+    for (auto &[id, tick] : uring_timers_) {
+      UringLoop::instance().remove_timer(id);
+    }
+    uring_timers_.clear();
+  }
+
+  // Called after the io_uring loop is torn down: its timers are gone, so
+  // schedule their callbacks again on timerfds. They restart from a full
+  // period.
+  void move_uring_timers() {
+    auto timers = std::move(uring_timers_);
+    uring_timers_.clear();
+    for (auto &[id, tick] : timers) {
+      schedule(tick.ms, std::move(tick.cb));
+    }
   }
 
  private:
+  static bool same_callback(const TickCb &a, const TickCb &b) {
+    if (a.is_function && b.is_function) {
+      return a.fn == b.fn;
+    }
+    if (!a.is_function && !b.is_function) {
+      return a.name == b.name;
+    }
+    return false;
+  }
+
+  void run_callback(const TickCb &cb) {
+    TRACE_SCOPE(TraceCategory::Tick, "tick", cb.name);
+
+    if (cb.native) {
+      try {
+        cb.native();
+      } catch (const std::exception &e) {
+        fprintf(stderr, "tick native error: %s\n", e.what());
+      } catch (...) {
+        fprintf(stderr, "tick native error: unknown exception\n");
+      }
+    } else if (cb.is_function && cb.fn.valid()) {
+      CallbackTimer timer("tick(function)");
+      sol::protected_function pf = cb.fn;
+      sol::protected_function_result result = pf();
+      if (!result.valid()) {
+        sol::error err = result;
+        fprintf(stderr, "tick function error: %s\n", err.what());
+      }
+    } else if (!cb.name.empty()) {
+      sol::state_view lua_state(AelkeyState::instance().lua_vm);
+      sol::object obj = lua_state[cb.name];
+      if (obj.is<sol::function>()) {
+        CallbackTimer timer(cb.name);
+        sol::protected_function pf = obj.as<sol::function>();
+        sol::protected_function_result result = pf();
+        if (!result.valid()) {
+          sol::error err = result;
+        }
+      }
+    }
+  }
+
   std::map<int, TickCb> callbacks_;
+
+  struct UringTick {
+    int ms = 0;
+    TickCb cb;
+  };
+
+  // io_uring timer id → callback
+  std::map<uint64_t, UringTick> uring_timers_;
 };
 
 template class Dispatcher<TickScheduler>;
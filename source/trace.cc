@@ -0,0 +1,201 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<bool> Trace::enabled_{ false };
+std::atomic<uint64_t> Trace::head_{ 0 };
+std::unique_ptr<TraceRecord[]> Trace::ring_;
+size_t Trace::mask_ = 0;
+
+namespace {
+
+uint32_t current_tid() {
+  thread_local uint32_t tid = static_cast<uint32_t>(syscall(SYS_gettid));
+  return tid;
+}
+
+void write_json_string(FILE *f, const char *s) {
+  std::fputc('"', f);
+  for (; *s; ++s) {
+    unsigned char c = static_cast<unsigned char>(*s);
+    if (c == '"' || c == '\\') {
+      std::fputc('\\', f);
+      std::fputc(c, f);
+    } else if (c < 0x20) {
+      std::fprintf(f, "\\u%04x", c);
+    } else {
+      std::fputc(c, f);
+    }
+  }
+  std::fputc('"', f);
+}
+
+}  // namespace
+
+const char *trace_category_name(TraceCategory category) {
+  switch (category) {
+    case TraceCategory::Loop:
+      return "loop";
+    case TraceCategory::Evdev:
+      return "evdev";
+    case TraceCategory::Hidraw:
+      return "hidraw";
+    case TraceCategory::Usb:
+      return "libusb";
+    case TraceCategory::Gatt:
+      return "gatt";
+    case TraceCategory::Tick:
+      return "tick";
+    case TraceCategory::Uinput:
+      return "uinput";
+    case TraceCategory::Io:
+      return "io";
+  }
+  return "unknown";
+}
+
+void Trace::start(size_t capacity) {
+  if (!ring_) {
+    size_t cap = 1;
+    while (cap < std::max<size_t>(capacity, 2)) {
+      cap <<= 1;
+    }
+    ring_ = std::make_unique<TraceRecord[]>(cap);
+    mask_ = cap - 1;
+  }
+  enabled_.store(true, std::memory_order_release);
+}
+
+void Trace::stop() {
+  enabled_.store(false, std::memory_order_release);
+}
+
+TraceRecord *Trace::claim(uint64_t &index) {
+  if (!ring_) {
+    return nullptr;
+  }
+
+  // oldest records are overwritten; seq marks the slot busy meanwhile
+  index = head_.fetch_add(1, std::memory_order_relaxed);
+  TraceRecord *rec = &ring_[index & mask_];
+  rec->seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);  // seq 0 before the new fields
+  return rec;
+}
+
+void Trace::complete(
+    TraceCategory category, const char *name, std::string_view id, uint64_t start_ns,
+    uint64_t end_ns
+) {
+  uint64_t index;
+  TraceRecord *rec = claim(index);
+  if (!rec) {
+    return;
+  }
+
+  TraceEvent &ev = rec->event;
+  ev.ts_ns = start_ns;
+  ev.dur_ns = end_ns - start_ns;
+  ev.name = name;
+  ev.tid = current_tid();
+  ev.category = category;
+  ev.instant = false;
+  trace_copy_id(ev.id, id);
+  rec->seq.store(index + 1, std::memory_order_release);
+}
+
+void Trace::instant(TraceCategory category, const char *name, std::string_view id) {
+  uint64_t index;
+  TraceRecord *rec = claim(index);
+  if (!rec) {
+    return;
+  }
+
+  TraceEvent &ev = rec->event;
+  ev.ts_ns = monotonic_ns();
+  ev.dur_ns = 0;
+  ev.name = name;
+  ev.tid = current_tid();
+  ev.category = category;
+  ev.instant = true;
+  trace_copy_id(ev.id, id);
+  rec->seq.store(index + 1, std::memory_order_release);
+}
+
+std::vector<TraceEvent> Trace::snapshot() {
+  std::vector<TraceEvent> events;
+  if (!ring_) {
+    return events;
+  }
+
+  uint64_t head = head_.load(std::memory_order_acquire);
+  uint64_t size = mask_ + 1;
+  uint64_t begin = head > size ? head - size : 0;
+  events.reserve(head - begin);
+
+  for (uint64_t i = begin; i < head; ++i) {
+    const TraceRecord &slot = ring_[i & mask_];
+    if (slot.seq.load(std::memory_order_acquire) != i + 1) {
+      continue;  // being written or already overwritten
+    }
+
+    // copy, then check that no writer claimed the slot meanwhile
+    TraceEvent ev = slot.event;
+    ev.id[TRACE_ID_SIZE - 1] = '\0';
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != i + 1) {
+      continue;  // overwritten while copying
+    }
+    events.push_back(ev);
+  }
+  return events;
+}
+
+bool Trace::write(const std::string &path, const std::vector<TraceEvent> &events) {
+  FILE *f = std::fopen(path.c_str(), "w");
+  if (!f) {
+    perror("trace dump");
+    return false;
+  }
+
+  std::fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+  bool first = true;
+  int pid = static_cast<int>(getpid());
+
+  for (const TraceEvent &ev : events) {
+    std::fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+    write_json_string(f, ev.name ? ev.name : "");
+    std::fprintf(
+        f,
+        ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,",
+        trace_category_name(ev.category),
+        ev.instant ? "i" : "X",
+        static_cast<double>(ev.ts_ns) / 1000.0
+    );
+    if (ev.instant) {
+      std::fprintf(f, "\"s\":\"t\",");
+    } else {
+      std::fprintf(f, "\"dur\":%.3f,", static_cast<double>(ev.dur_ns) / 1000.0);
+    }
+    std::fprintf(f, "\"pid\":%d,\"tid\":%u", pid, ev.tid);
+    if (ev.id[0]) {
+      std::fprintf(f, ",\"args\":{\"id\":");
+      write_json_string(f, ev.id);
+      std::fprintf(f, "}");
+    }
+    std::fprintf(f, "}");
+    first = false;
+  }
+
+  std::fprintf(f, "\n]}\n");
+  bool ok = std::ferror(f) == 0;
+  ok = (std::fclose(f) == 0) && ok;
+  return ok;
+}
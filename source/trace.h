@@ -0,0 +1,147 @@
+#pragma once
+
+// Trace ring: fixed-size binary records in a lock-free in-memory ring,
+// exported as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+// Instrumentation goes through the TRACE_* macros. Without
+// -DAELKEY_TRACE (meson -Dtracing=false) they compile to nothing; with
+// it, a disabled trace costs one relaxed load per point.
+//
+//   TRACE_SCOPE(TraceCategory::Evdev, "frame", device_id);   // duration
+//   TRACE_INSTANT(TraceCategory::Uinput, "syn_report", dev); // point
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util/clock.h"
+
+enum class TraceCategory : uint8_t {
+  Loop,
+  Evdev,
+  Hidraw,
+  Usb,
+  Gatt,
+  Tick,
+  Uinput,
+  Io,
+};
+
+const char *trace_category_name(TraceCategory category);
+
+static constexpr size_t TRACE_ID_SIZE = 26;
+
+// Truncates on a UTF-8 character boundary
+inline void trace_copy_id(char (&dst)[TRACE_ID_SIZE], std::string_view id) {
+  size_t n = std::min(id.size(), TRACE_ID_SIZE - 1);
+  while (n > 0 && n < id.size() && (static_cast<unsigned char>(id[n]) & 0xc0) == 0x80) {
+    --n;  // id[n] continues the character before it
+  }
+  std::memcpy(dst, id.data(), n);
+  dst[n] = '\0';
+}
+
+struct TraceEvent {
+  uint64_t ts_ns = 0;
+  uint64_t dur_ns = 0;
+  const char *name = nullptr;  // string literal
+  uint32_t tid = 0;
+  TraceCategory category = TraceCategory::Loop;
+  bool instant = false;
+  char id[TRACE_ID_SIZE] = {};  // device id or callback name, truncated
+};
+
+struct alignas(64) TraceRecord {
+  std::atomic<uint64_t> seq{ 0 };  // index + 1 once complete
+  TraceEvent event;
+};
+
+class Trace {
+ public:
+  static constexpr size_t kDefaultCapacity = 64 * 1024;
+
+  static bool enabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Allocates the ring on first use; capacity rounds up to a power of two
+  static void start(size_t capacity = kDefaultCapacity);
+  static void stop();
+
+  static void complete(
+      TraceCategory category, const char *name, std::string_view id, uint64_t start_ns,
+      uint64_t end_ns
+  );
+  static void instant(TraceCategory category, const char *name, std::string_view id);
+
+  // Complete records in the ring, oldest first. Cheap enough for the
+  // loop thread; write() can then run anywhere.
+  static std::vector<TraceEvent> snapshot();
+
+  // Write events as Chrome trace JSON; returns false on I/O error
+  static bool write(const std::string &path, const std::vector<TraceEvent> &events);
+
+  static bool dump(const std::string &path) {
+    return write(path, snapshot());
+  }
+
+ private:
+  static TraceRecord *claim(uint64_t &index);
+
+  static std::atomic<bool> enabled_;
+  static std::atomic<uint64_t> head_;
+  static std::unique_ptr<TraceRecord[]> ring_;
+  static size_t mask_;
+};
+
+// Records one duration event from construction to destruction.
+class TraceScope {
+ public:
+  TraceScope(TraceCategory category, const char *name, std::string_view id)
+      : active_(Trace::enabled()) {
+    if (active_) {
+      category_ = category;
+      name_ = name;
+      trace_copy_id(id_, id);
+      start_ = monotonic_ns();
+    }
+  }
+
+  ~TraceScope() {
+    if (active_) {
+      Trace::complete(category_, name_, id_, start_, monotonic_ns());
+    }
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+ private:
+  bool active_;
+  TraceCategory category_ = TraceCategory::Loop;
+  const char *name_ = nullptr;
+  char id_[TRACE_ID_SIZE];  // copied: the traced code may free the original
+  uint64_t start_ = 0;
+};
+
+#ifdef AELKEY_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(category, name, id) \
+  TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(category, name, id)
+#define TRACE_INSTANT(category, name, id) \
+  do {                                    \
+    if (Trace::enabled()) {               \
+      Trace::instant(category, name, id); \
+    }                                     \
+  } while (0)
+#else
+#define TRACE_SCOPE(category, name, id) ((void)0)
+#define TRACE_INSTANT(category, name, id) ((void)0)
+#endif
@@ -0,0 +1,419 @@
+#include "uring_loop.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+
+#ifdef AELKEY_HAVE_IO_URING
+#include <liburing.h>
+#endif
+
+#include "trace.h"
+#include "util/clock.h"
+
+#ifdef AELKEY_HAVE_IO_URING
+
+namespace {
+
+constexpr unsigned RING_ENTRIES = 256;
+
+// Provided buffers: one HID report (HID_MAX_BUFFER_SIZE) or up to
+// 170 input_event records per completion.
+constexpr uint16_t BUF_GROUP = 0;
+constexpr unsigned BUF_COUNT = 256;
+constexpr unsigned BUF_SIZE = 4096;
+
+constexpr uint64_t IGNORE_TOKEN = 0;
+constexpr uint64_t EPOLL_TOKEN = 1;
+
+// nullptr if the submission queue stays full even after submitting
+io_uring_sqe *get_sqe(io_uring *ring) {
+  io_uring_sqe *sqe = io_uring_get_sqe(ring);
+  if (!sqe) {
+    io_uring_submit(ring);
+    sqe = io_uring_get_sqe(ring);
+  }
+  if (!sqe) {
+    std::fprintf(stderr, "io_uring: submission queue full\n");
+  }
+  return sqe;
+}
+
+}  // namespace
+
+bool UringLoop::setup(int epfd) {
+  if (active()) {
+    return true;
+  }
+
+  auto *ring = new io_uring{};
+  int rc = io_uring_queue_init(RING_ENTRIES, ring, 0);
+  if (rc < 0) {
+    std::fprintf(stderr, "io_uring: %s\n", std::strerror(-rc));
+    delete ring;
+    return false;
+  }
+
+  int err = 0;
+  io_uring_buf_ring *br = io_uring_setup_buf_ring(ring, BUF_COUNT, BUF_GROUP, 0, &err);
+  if (!br) {
+    std::fprintf(stderr, "io_uring buffer ring: %s\n", std::strerror(-err));
+    io_uring_queue_exit(ring);
+    delete ring;
+    return false;
+  }
+
+  void *mem = nullptr;
+  if (posix_memalign(&mem, 4096, BUF_COUNT * BUF_SIZE) != 0) {
+    io_uring_free_buf_ring(ring, br, BUF_COUNT, BUF_GROUP);
+    io_uring_queue_exit(ring);
+    delete ring;
+    return false;
+  }
+
+  ring_ = ring;
+  buf_ring_ = br;
+  buffers_ = static_cast<uint8_t *>(mem);
+  epfd_ = epfd;
+
+  int mask = io_uring_buf_ring_mask(BUF_COUNT);
+  for (unsigned i = 0; i < BUF_COUNT; ++i) {
+    io_uring_buf_ring_add(br, buffers_ + i * BUF_SIZE, BUF_SIZE, i, mask, i);
+  }
+  io_uring_buf_ring_advance(br, BUF_COUNT);
+
+  return true;
+}
+
+void UringLoop::teardown() {
+  if (!ring_) {
+    return;
+  }
+
+  io_uring_free_buf_ring(ring_, buf_ring_, BUF_COUNT, BUF_GROUP);
+  io_uring_queue_exit(ring_);
+  delete ring_;
+  std::free(buffers_);
+
+  ring_ = nullptr;
+  buf_ring_ = nullptr;
+  buffers_ = nullptr;
+  epfd_ = -1;
+  epoll_armed_ = false;
+  epoll_ready_ = false;
+
+  reads_.clear();
+  read_tokens_.clear();
+  timers_.clear();
+  unarmed_.clear();
+}
+
+bool UringLoop::add_read(int fd, ReadHandler handler) {
+  if (!active() || read_tokens_.contains(fd)) {
+    return false;
+  }
+
+  uint64_t token = next_token_++;
+  Read &read = reads_[token];
+  read.fd = fd;
+  read.handler = std::make_shared<ReadHandler>(std::move(handler));
+  read_tokens_[fd] = token;
+
+  arm_read(token, read);
+  io_uring_submit(ring_);
+  return true;
+}
+
+void UringLoop::remove_read(int fd) {
+  auto it = read_tokens_.find(fd);
+  if (it == read_tokens_.end()) {
+    return;
+  }
+
+  uint64_t token = it->second;
+  read_tokens_.erase(it);
+  reads_.erase(token);
+
+  // cancel before the caller closes the fd; without an sqe the read
+  // ends on its own once the fd is closed
+  io_uring_sqe *sqe = get_sqe(ring_);
+  if (!sqe) {
+    return;
+  }
+  io_uring_prep_cancel64(sqe, token, 0);
+  io_uring_sqe_set_data64(sqe, IGNORE_TOKEN);
+  io_uring_submit(ring_);
+}
+
+uint64_t UringLoop::add_timer(int ms, bool oneshot, TimerHandler handler) {
+  if (!active() || ms <= 0) {
+    return 0;
+  }
+
+  uint64_t token = next_token_++;
+  Timer &timer = timers_[token];
+  timer.interval_ns = static_cast<uint64_t>(ms) * 1000000ull;
+  timer.deadline_ns = monotonic_ns() + timer.interval_ns;
+  timer.oneshot = oneshot;
+  timer.handler = std::make_shared<TimerHandler>(std::move(handler));
+
+  arm_timer(token, timer);
+  io_uring_submit(ring_);
+  return token;
+}
+
+void UringLoop::remove_timer(uint64_t id) {
+  if (!active() || !timers_.erase(id)) {
+    return;
+  }
+
+  // without an sqe the timeout still completes; handle_cqe ignores
+  // tokens that are no longer timers
+  io_uring_sqe *sqe = get_sqe(ring_);
+  if (!sqe) {
+    return;
+  }
+  io_uring_prep_timeout_remove(sqe, id, 0);
+  io_uring_sqe_set_data64(sqe, IGNORE_TOKEN);
+  io_uring_submit(ring_);
+}
+
+bool UringLoop::run_once() {
+  // Single-shot poll: arming checks readiness right away, so events left
+  // on the epoll ready list are never missed.
+  if (!epoll_armed_) {
+    arm_epoll();
+  }
+  rearm_pending();
+
+  int rc = io_uring_submit_and_wait(ring_, 1);
+  if (rc < 0 && rc != -EINTR && rc != -ETIME) {
+    std::fprintf(stderr, "io_uring_submit_and_wait: %s\n", std::strerror(-rc));
+  }
+
+  epoll_ready_ = false;
+
+  TRACE_SCOPE(TraceCategory::Loop, "uring", "");
+
+  // Only what is in the queue now; handlers may queue more work
+  unsigned ready = io_uring_cq_ready(ring_);
+  for (unsigned i = 0; i < ready; ++i) {
+    io_uring_cqe *cqe = nullptr;
+    if (io_uring_peek_cqe(ring_, &cqe) != 0 || !cqe) {
+      break;
+    }
+
+    uint64_t token = io_uring_cqe_get_data64(cqe);
+    int res = cqe->res;
+    uint32_t flags = cqe->flags;
+    io_uring_cqe_seen(ring_, cqe);
+
+    handle_cqe(token, res, flags);
+  }
+
+  return epoll_ready_;
+}
+
+bool UringLoop::has_completions() const {
+  return io_uring_cq_ready(ring_) > 0;
+}
+
+void UringLoop::handle_cqe(uint64_t token, int res, uint32_t flags) {
+  if (token == IGNORE_TOKEN) {
+    return;
+  }
+
+  if (token == EPOLL_TOKEN) {
+    epoll_armed_ = false;
+    epoll_ready_ = res > 0;
+    return;
+  }
+
+  if (timers_.contains(token)) {
+    handle_timer(token, res);
+    return;
+  }
+
+  handle_read(token, res, flags);
+}
+
+void UringLoop::handle_read(uint64_t token, int res, uint32_t flags) {
+  bool has_buffer = flags & IORING_CQE_F_BUFFER;
+  bool more = flags & IORING_CQE_F_MORE;
+  uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+
+  auto it = reads_.find(token);
+  if (it == reads_.end()) {
+    // removed while in flight
+    if (has_buffer) {
+      recycle_buffer(bid);
+    }
+    return;
+  }
+
+  if (res == -EINVAL && it->second.multishot) {
+    // kernel without multishot read (< 6.7): one read per submission
+    it->second.multishot = false;
+    arm_read(token, it->second);
+    return;
+  }
+
+  if (res == -ENOBUFS || res == -EINTR || res == -EAGAIN) {
+    if (!more) {
+      arm_read(token, it->second);
+    }
+    return;
+  }
+
+  auto handler = it->second.handler;  // the handler may remove this read
+
+  if (res <= 0 || !has_buffer) {
+    int fd = it->second.fd;
+    reads_.erase(it);
+    read_tokens_.erase(fd);
+    if (has_buffer) {
+      recycle_buffer(bid);
+    }
+    (*handler)(nullptr, res < 0 ? res : 0);
+    return;
+  }
+
+  (*handler)(buffers_ + static_cast<size_t>(bid) * BUF_SIZE, res);
+  recycle_buffer(bid);
+
+  if (!more) {
+    it = reads_.find(token);
+    if (it != reads_.end()) {
+      arm_read(token, it->second);
+    }
+  }
+}
+
+void UringLoop::handle_timer(uint64_t token, int res) {
+  if (res != -ETIME) {
+    return;  // cancelled or removed
+  }
+
+  auto it = timers_.find(token);
+  Timer &timer = it->second;
+  auto handler = timer.handler;
+
+  if (timer.oneshot) {
+    timers_.erase(it);
+  } else {
+    // absolute deadlines do not drift; skip ticks that were missed
+    uint64_t now = monotonic_ns();
+    do {
+      timer.deadline_ns += timer.interval_ns;
+    } while (timer.deadline_ns <= now);
+    arm_timer(token, timer);
+  }
+
+  (*handler)();
+}
+
+void UringLoop::rearm_pending() {
+  std::vector<uint64_t> tokens;
+  tokens.swap(unarmed_);
+  for (uint64_t token : tokens) {
+    if (auto r = reads_.find(token); r != reads_.end()) {
+      arm_read(token, r->second);
+    } else if (auto t = timers_.find(token); t != timers_.end()) {
+      arm_timer(token, t->second);
+    }
+  }
+}
+
+void UringLoop::arm_epoll() {
+  io_uring_sqe *sqe = get_sqe(ring_);
+  if (!sqe) {
+    return;  // retried by the next run_once()
+  }
+  io_uring_prep_poll_add(sqe, epfd_, POLLIN);
+  io_uring_sqe_set_data64(sqe, EPOLL_TOKEN);
+  epoll_armed_ = true;
+}
+
+void UringLoop::arm_read(uint64_t token, const Read &read) {
+  io_uring_sqe *sqe = get_sqe(ring_);
+  if (!sqe) {
+    unarmed_.push_back(token);  // retried by the next run_once()
+    return;
+  }
+  if (read.multishot) {
+    io_uring_prep_read_multishot(sqe, read.fd, 0, -1, BUF_GROUP);
+  } else {
+    io_uring_prep_read(sqe, read.fd, nullptr, BUF_SIZE, -1);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+  }
+  io_uring_sqe_set_data64(sqe, token);
+}
+
+void UringLoop::arm_timer(uint64_t token, Timer &timer) {
+  timer.ts.tv_sec = static_cast<long long>(timer.deadline_ns / 1000000000ull);
+  timer.ts.tv_nsec = static_cast<long long>(timer.deadline_ns % 1000000000ull);
+
+  io_uring_sqe *sqe = get_sqe(ring_);
+  if (!sqe) {
+    unarmed_.push_back(token);  // retried by the next run_once()
+    return;
+  }
+  io_uring_prep_timeout(sqe, &timer.ts, 0, IORING_TIMEOUT_ABS);
+  io_uring_sqe_set_data64(sqe, token);
+}
+
+void UringLoop::recycle_buffer(uint16_t bid) {
+  io_uring_buf_ring_add(
+      buf_ring_,
+      buffers_ + static_cast<size_t>(bid) * BUF_SIZE,
+      BUF_SIZE,
+      bid,
+      io_uring_buf_ring_mask(BUF_COUNT),
+      0
+  );
+  io_uring_buf_ring_advance(buf_ring_, 1);
+}
+
+#else  // !AELKEY_HAVE_IO_URING
+
+bool UringLoop::setup(int) {
+  std::fprintf(stderr, "io_uring: not available in this build\n");
+  return false;
+}
+
+void UringLoop::teardown() {}
+
+bool UringLoop::add_read(int, ReadHandler) {
+  return false;
+}
+
+void UringLoop::remove_read(int) {}
+
+uint64_t UringLoop::add_timer(int, bool, TimerHandler) {
+  return 0;
+}
+
+void UringLoop::remove_timer(uint64_t) {}
+
+bool UringLoop::run_once() {
+  return true;
+}
+
+bool UringLoop::has_completions() const {
+  return false;
+}
+
+void UringLoop::handle_cqe(uint64_t, int, uint32_t) {}
+void UringLoop::handle_read(uint64_t, int, uint32_t) {}
+void UringLoop::handle_timer(uint64_t, int) {}
+void UringLoop::arm_epoll() {}
+void UringLoop::arm_read(uint64_t, const Read &) {}
+void UringLoop::arm_timer(uint64_t, Timer &) {}
+void UringLoop::rearm_pending() {}
+void UringLoop::recycle_buffer(uint16_t) {}
+
+#endif  // AELKEY_HAVE_IO_URING
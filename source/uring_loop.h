@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <linux/time_types.h>
+
+#include "singleton.h"
+
+struct io_uring;
+struct io_uring_buf_ring;
+
+// io_uring front end for the event loop.
+//
+// Device fds get multishot reads into a shared provided-buffer ring and
+// ticks become IORING_OP_TIMEOUT, so one io_uring_enter() harvests
+// reports from every device. Everything else stays on the epoll fd,
+// which is itself polled through the ring.
+//
+// setup() fails when the kernel (or liburing at build time) does not
+// support this; the loop then keeps using epoll_wait().
+class UringLoop : public Singleton<UringLoop> {
+  friend class Singleton<UringLoop>;
+
+ protected:
+  UringLoop() = default;
+  ~UringLoop() {
+    teardown();
+  }
+
+ public:
+  // data == nullptr: the fd is finished, res is 0 or -errno
+  using ReadHandler = std::function<void(const uint8_t *data, int res)>;
+  using TimerHandler = std::function<void()>;
+
+  bool setup(int epfd);
+  void teardown();
+
+  bool active() const {
+    return ring_ != nullptr;
+  }
+
+  bool add_read(int fd, ReadHandler handler);
+  void remove_read(int fd);
+
+  // Returns a timer id, 0 on failure
+  uint64_t add_timer(int ms, bool oneshot, TimerHandler handler);
+  void remove_timer(uint64_t id);
+
+  // Wait for completions and run their handlers.
+  // Returns true when the epoll fd has events to dispatch.
+  bool run_once();
+
+  // Completions are waiting to be handled
+  bool has_completions() const;
+
+ private:
+  struct Read {
+    int fd = -1;
+    bool multishot = true;
+    std::shared_ptr<ReadHandler> handler;
+  };
+
+  struct Timer {
+    uint64_t interval_ns = 0;
+    uint64_t deadline_ns = 0;
+    bool oneshot = false;
+    struct __kernel_timespec ts{};  // must stay valid until submitted
+    std::shared_ptr<TimerHandler> handler;
+  };
+
+  void handle_cqe(uint64_t token, int res, uint32_t flags);
+  void handle_read(uint64_t token, int res, uint32_t flags);
+  void handle_timer(uint64_t token, int res);
+
+  void arm_epoll();
+  void arm_read(uint64_t token, const Read &read);
+  void arm_timer(uint64_t token, Timer &timer);
+  void rearm_pending();  // reads and timers that found no free sqe
+  void recycle_buffer(uint16_t bid);
+
+  struct io_uring *ring_ = nullptr;
+  struct io_uring_buf_ring *buf_ring_ = nullptr;
+  uint8_t *buffers_ = nullptr;
+
+  int epfd_ = -1;
+  bool epoll_armed_ = false;
+  bool epoll_ready_ = false;
+
+  uint64_t next_token_ = 2;  // 0: ignored completions, 1: epoll fd
+
+  std::map<uint64_t, Read> reads_;
+  std::map<int, uint64_t> read_tokens_;  // fd → token
+  std::map<uint64_t, Timer> timers_;
+  std::vector<uint64_t> unarmed_;  // reads and timers waiting for an sqe
+};
@@ -0,0 +1,30 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/**
+ * @file clock.h
+ * @brief Cheap monotonic timestamps for the event loop hot paths.
+ *
+ * clock_gettime(CLOCK_MONOTONIC) is served from the vDSO on Linux,
+ * so these helpers are safe to call once per report or callback.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <time.h>
+
+inline uint64_t timespec_to_ns(const struct timespec &ts) {
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+inline uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return timespec_to_ns(ts);
+}
+
+inline uint64_t monotonic_ns() {
+  return clock_ns(CLOCK_MONOTONIC);
+}
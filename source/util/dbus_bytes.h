@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/**
+ * @file dbus_bytes.h
+ * @brief D-Bus byte arrays ("ay") in and out of messages in one step.
+ *
+ * dbus_message_iter_get_fixed_array points into the message itself, so
+ * a value can be handed on (to Lua, to a callback) without a copy; the
+ * view is valid as long as the message is. Appending copies the bytes
+ * into the message once, instead of one append call per byte.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include <dbus/dbus.h>
+
+// The ay at iter, viewed in place; empty if iter is not at one
+inline std::span<const uint8_t> dbus_byte_array(DBusMessageIter *iter) {
+  if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY ||
+      dbus_message_iter_get_element_type(iter) != DBUS_TYPE_BYTE) {
+    return {};
+  }
+
+  DBusMessageIter array;
+  dbus_message_iter_recurse(iter, &array);
+
+  const uint8_t *data = nullptr;
+  int size = 0;
+  dbus_message_iter_get_fixed_array(&array, &data, &size);
+  if (!data || size <= 0) {
+    return {};
+  }
+  return { data, static_cast<size_t>(size) };
+}
+
+// The ay that is the first argument of msg (ReadValue replies)
+inline std::span<const uint8_t> dbus_byte_array(DBusMessage *msg) {
+  DBusMessageIter iter;
+  if (!dbus_message_iter_init(msg, &iter)) {
+    return {};
+  }
+  return dbus_byte_array(&iter);
+}
+
+inline bool dbus_append_byte_array(DBusMessageIter *iter, const uint8_t *data, size_t size) {
+  DBusMessageIter array;
+  if (!dbus_message_iter_open_container(
+          iter, DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE_AS_STRING, &array
+      )) {
+    return false;
+  }
+
+  bool ok = dbus_message_iter_append_fixed_array(
+      &array, DBUS_TYPE_BYTE, &data, static_cast<int>(size)
+  );
+  return dbus_message_iter_close_container(iter, &array) && ok;
+}
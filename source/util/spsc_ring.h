@@ -0,0 +1,88 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/**
+ * @file spsc_ring.h
+ * @brief Bounded lock-free single-producer/single-consumer ring.
+ *
+ * Slots are preallocated and filled in place, so large records (HID
+ * reports, input frames) move between threads without allocation.
+ *
+ * Producer thread:
+ *   if (T *slot = ring.claim()) { fill(*slot); ring.publish(); }
+ *
+ * Consumer thread:
+ *   size_t n = ring.readable();
+ *   for (size_t i = 0; i < n; ++i) use(ring.at(i));
+ *   ring.pop(n);
+ *
+ * Capacity is rounded up to a power of two.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+template <typename T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    capacity_ = cap;
+    mask_ = cap - 1;
+    slots_ = std::make_unique<T[]>(cap);
+  }
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  // --- producer side ---
+
+  // Slot to fill, or nullptr when the ring is full.
+  T *claim() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == capacity_) {
+      return nullptr;
+    }
+    return &slots_[tail & mask_];
+  }
+
+  // Make the claimed slot visible to the consumer.
+  void publish() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // --- consumer side ---
+
+  // Number of published slots not yet popped.
+  size_t readable() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed);
+  }
+
+  // i-th readable slot, counted from the oldest.
+  T &at(size_t i) {
+    return slots_[(head_.load(std::memory_order_relaxed) + i) & mask_];
+  }
+
+  // Release n slots back to the producer.
+  void pop(size_t n) {
+    head_.store(head_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+  }
+
+ private:
+  alignas(64) std::atomic<size_t> head_{ 0 };
+  alignas(64) std::atomic<size_t> tail_{ 0 };
+
+  size_t capacity_ = 0;
+  size_t mask_ = 0;
+  std::unique_ptr<T[]> slots_;
+};
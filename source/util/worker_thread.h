@@ -0,0 +1,67 @@
+// SPDX-FileCopyrightText: Copyright 2025 xiota
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+/**
+ * @file worker_thread.h
+ * @brief Default scheduling for threads started while the loop runs.
+ *
+ * A thread inherits the policy and CPU affinity of the thread that
+ * creates it. With the realtime loop options the loop thread runs
+ * SCHED_FIFO pinned to one CPU, so reader threads started from it
+ * (hidraw readers, I/O threads, the libusb thread) would compete with
+ * the loop on its own core. Each of them calls worker_thread_defaults()
+ * before doing anything else.
+ */
+
+#pragma once
+
+#include <mutex>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace worker_thread_detail {
+
+inline std::mutex mutex;
+inline bool have_policy = false;
+inline int policy = SCHED_OTHER;
+inline struct sched_param param{};
+inline bool have_affinity = false;
+inline cpu_set_t affinity;
+
+}  // namespace worker_thread_detail
+
+// Policy the loop thread had before it went realtime; nullptr once it
+// is restored
+inline void set_worker_policy(const int *policy, const struct sched_param *param) {
+  std::lock_guard lock(worker_thread_detail::mutex);
+  worker_thread_detail::have_policy = (policy != nullptr);
+  if (policy) {
+    worker_thread_detail::policy = *policy;
+    worker_thread_detail::param = *param;
+  }
+}
+
+// Affinity the loop thread had before it was pinned; nullptr once it is
+// restored
+inline void set_worker_affinity(const cpu_set_t *set) {
+  std::lock_guard lock(worker_thread_detail::mutex);
+  worker_thread_detail::have_affinity = (set != nullptr);
+  if (set) {
+    worker_thread_detail::affinity = *set;
+  }
+}
+
+// Give the calling thread the policy and affinity the loop thread had
+// before the realtime options were applied
+inline void worker_thread_defaults() {
+  pthread_t self = pthread_self();
+
+  std::lock_guard lock(worker_thread_detail::mutex);
+  if (worker_thread_detail::have_policy) {
+    pthread_setschedparam(self, worker_thread_detail::policy, &worker_thread_detail::param);
+  }
+  if (worker_thread_detail::have_affinity) {
+    pthread_setaffinity_np(self, sizeof(cpu_set_t), &worker_thread_detail::affinity);
+  }
+}